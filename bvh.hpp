@@ -0,0 +1,484 @@
+#pragma once
+
+// Bounding volume hierarchy over the world space AABBs of the scene objects.
+// Built top-down with a binned surface area heuristic, and stored as a flat
+// array of 32 byte nodes: the two children of a node are always adjacent,
+// and come after their parent, so a refit is a single backwards pass.
+// Supports frustum, ray and nearest object queries.
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "culling.hpp"
+
+struct BVHNode {
+	glm::vec3 boundsMin;
+	uint32_t leftFirst;		// first child if count == 0, else first primitive
+	glm::vec3 boundsMax;
+	uint32_t count;			// number of primitives, 0 for inner nodes
+};
+
+struct BVH {
+	static constexpr int BINS = 12;
+	static constexpr uint32_t MAX_LEAF_SIZE = 4;
+	// Also the size of the traversal stacks
+	static constexpr int MAX_DEPTH = 64;
+
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> primitives;			// object indices, grouped by leaf
+	std::vector<glm::vec3> objMin, objMax;		// object bounds
+
+	void build(const BoundsSoA &B);
+	void refit(const BoundsSoA &B);
+	bool empty() const { return nodes.empty(); }
+
+	// Objects whose AABB intersects the frustum (same results as cullAABBs)
+	void queryFrustum(const Frustum &F, std::vector<uint32_t> &result) const;
+	// Closest object whose AABB is hit by the ray within maxT
+	bool queryRay(const glm::vec3 &origin, const glm::vec3 &dir, float maxT,
+				  uint32_t &object, float &t) const;
+	// Object whose AABB is closest to the point
+	bool queryNearest(const glm::vec3 &point, uint32_t &object, float &distance) const;
+
+	void copyBounds(const BoundsSoA &B);
+	void updateNodeBounds(uint32_t node);
+	void subdivide(uint32_t node, int depth);
+};
+
+inline float surfaceArea(const glm::vec3 &mn, const glm::vec3 &mx) {
+	glm::vec3 e = glm::max(mx - mn, glm::vec3(0.0f));
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+inline void BVH::copyBounds(const BoundsSoA &B) {
+	objMin.resize(B.size());
+	objMax.resize(B.size());
+	for (size_t i = 0; i < B.size(); i++) {
+		glm::vec3 c(B.cx[i], B.cy[i], B.cz[i]);
+		glm::vec3 e(B.ex[i], B.ey[i], B.ez[i]);
+		objMin[i] = c - e;
+		objMax[i] = c + e;
+	}
+}
+
+inline void BVH::updateNodeBounds(uint32_t node) {
+	BVHNode &N = nodes[node];
+	N.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	N.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (uint32_t i = 0; i < N.count; i++) {
+		uint32_t o = primitives[N.leftFirst + i];
+		N.boundsMin = glm::min(N.boundsMin, objMin[o]);
+		N.boundsMax = glm::max(N.boundsMax, objMax[o]);
+	}
+}
+
+inline void BVH::build(const BoundsSoA &B) {
+	copyBounds(B);
+	const uint32_t n = static_cast<uint32_t>(B.size());
+
+	primitives.resize(n);
+	for (uint32_t i = 0; i < n; i++) {
+		primitives[i] = i;
+	}
+	nodes.clear();
+	if (n == 0) {
+		return;
+	}
+	nodes.reserve(2 * n);
+	nodes.push_back({glm::vec3(0.0f), 0, glm::vec3(0.0f), n});
+	updateNodeBounds(0);
+	subdivide(0, 0);
+}
+
+// Splits a node where the SAH cost, evaluated at the boundaries of BINS
+// bins of the centroids along each axis, is minimum
+inline void BVH::subdivide(uint32_t node, int depth) {
+	if (nodes[node].count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH - 1) {
+		return;
+	}
+	const uint32_t first = nodes[node].leftFirst, count = nodes[node].count;
+
+	glm::vec3 cMin(std::numeric_limits<float>::max()), cMax(-std::numeric_limits<float>::max());
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t o = primitives[first + i];
+		glm::vec3 c = (objMin[o] + objMax[o]) * 0.5f;
+		cMin = glm::min(cMin, c);
+		cMax = glm::max(cMax, c);
+	}
+
+	int bestAxis = -1, bestSplit = 0;
+	float bestCost = std::numeric_limits<float>::max();
+	for (int axis = 0; axis < 3; axis++) {
+		if (cMax[axis] <= cMin[axis]) {
+			continue;
+		}
+		struct Bin {
+			glm::vec3 mn{std::numeric_limits<float>::max()};
+			glm::vec3 mx{-std::numeric_limits<float>::max()};
+			uint32_t count = 0;
+		} bins[BINS];
+		float scale = BINS / (cMax[axis] - cMin[axis]);
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t o = primitives[first + i];
+			float c = (objMin[o][axis] + objMax[o][axis]) * 0.5f;
+			int b = std::min(BINS - 1, static_cast<int>((c - cMin[axis]) * scale));
+			bins[b].mn = glm::min(bins[b].mn, objMin[o]);
+			bins[b].mx = glm::max(bins[b].mx, objMax[o]);
+			bins[b].count++;
+		}
+
+		// Sweep from both sides to get the cost of every split plane
+		float leftArea[BINS - 1], rightArea[BINS - 1];
+		uint32_t leftCount[BINS - 1], rightCount[BINS - 1];
+		Bin left, right;
+		for (int i = 0; i < BINS - 1; i++) {
+			left.count += bins[i].count;
+			left.mn = glm::min(left.mn, bins[i].mn);
+			left.mx = glm::max(left.mx, bins[i].mx);
+			leftCount[i] = left.count;
+			leftArea[i] = left.count ? surfaceArea(left.mn, left.mx) : 0.0f;
+
+			const Bin &r = bins[BINS - 1 - i];
+			right.count += r.count;
+			right.mn = glm::min(right.mn, r.mn);
+			right.mx = glm::max(right.mx, r.mx);
+			rightCount[BINS - 2 - i] = right.count;
+			rightArea[BINS - 2 - i] = right.count ? surfaceArea(right.mn, right.mx) : 0.0f;
+		}
+		for (int i = 0; i < BINS - 1; i++) {
+			float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (leftCount[i] && rightCount[i] && cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	// Not splitting costs as many intersection tests as the primitives
+	const BVHNode &N = nodes[node];
+	if (bestAxis < 0 || bestCost >= count * surfaceArea(N.boundsMin, N.boundsMax)) {
+		return;
+	}
+
+	// Same binning as above, so that both sides get exactly the counted objects
+	float scale = BINS / (cMax[bestAxis] - cMin[bestAxis]);
+	uint32_t *begin = primitives.data() + first;
+	uint32_t *mid = std::partition(begin, begin + count, [&](uint32_t o) {
+		float c = (objMin[o][bestAxis] + objMax[o][bestAxis]) * 0.5f;
+		return std::min(BINS - 1, static_cast<int>((c - cMin[bestAxis]) * scale)) <= bestSplit;
+	});
+	uint32_t leftCount = static_cast<uint32_t>(mid - begin);
+	if (leftCount == 0 || leftCount == count) {
+		return;
+	}
+
+	uint32_t leftChild = static_cast<uint32_t>(nodes.size());
+	nodes.push_back({glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount});
+	nodes.push_back({glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount});
+	nodes[node].leftFirst = leftChild;
+	nodes[node].count = 0;
+
+	updateNodeBounds(leftChild);
+	updateNodeBounds(leftChild + 1);
+	subdivide(leftChild, depth + 1);
+	subdivide(leftChild + 1, depth + 1);
+}
+
+// Keeps the topology and recomputes the bounds, for objects that moved.
+// The tree gets worse as objects move away from where they were at build
+// time, so large changes should rather rebuild it.
+inline void BVH::refit(const BoundsSoA &B) {
+	copyBounds(B);
+	for (size_t i = nodes.size(); i-- > 0;) {
+		BVHNode &N = nodes[i];
+		if (N.count > 0) {
+			updateNodeBounds(static_cast<uint32_t>(i));
+		} else {
+			const BVHNode &L = nodes[N.leftFirst], &R = nodes[N.leftFirst + 1];
+			N.boundsMin = glm::min(L.boundsMin, R.boundsMin);
+			N.boundsMax = glm::max(L.boundsMax, R.boundsMax);
+		}
+	}
+}
+
+inline void BVH::queryFrustum(const Frustum &F, std::vector<uint32_t> &result) const {
+	result.clear();
+	if (nodes.empty()) {
+		return;
+	}
+
+	// Nodes entirely inside the frustum are added without further tests
+	struct Entry { uint32_t node; bool inside; };
+	Entry stack[MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = {0, false};
+	while (top > 0) {
+		Entry e = stack[--top];
+		const BVHNode &N = nodes[e.node];
+		bool inside = e.inside;
+		if (!inside) {
+			glm::vec3 c = (N.boundsMin + N.boundsMax) * 0.5f;
+			glm::vec3 x = (N.boundsMax - N.boundsMin) * 0.5f;
+			bool outside = false;
+			inside = true;
+			for (const auto &p : F.planes) {
+				float d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+				float r = std::abs(p.x) * x.x + std::abs(p.y) * x.y + std::abs(p.z) * x.z;
+				if (d + r < 0.0f) {
+					outside = true;
+					break;
+				}
+				if (d - r < 0.0f) {
+					inside = false;
+				}
+			}
+			if (outside) {
+				continue;
+			}
+		}
+
+		if (N.count > 0) {
+			for (uint32_t i = 0; i < N.count; i++) {
+				uint32_t o = primitives[N.leftFirst + i];
+				if (inside) {
+					result.push_back(o);
+					continue;
+				}
+				glm::vec3 c = (objMin[o] + objMax[o]) * 0.5f;
+				glm::vec3 x = (objMax[o] - objMin[o]) * 0.5f;
+				if (aabbInFrustum(F, c.x, c.y, c.z, x.x, x.y, x.z)) {
+					result.push_back(o);
+				}
+			}
+		} else {
+			stack[top++] = {N.leftFirst, inside};
+			stack[top++] = {N.leftFirst + 1, inside};
+		}
+	}
+}
+
+// Slab test, returns the entry distance or +inf if the box is missed
+inline float rayBoxDistance(const glm::vec3 &origin, const glm::vec3 &invDir,
+							const glm::vec3 &mn, const glm::vec3 &mx, float maxT) {
+	glm::vec3 t0 = (mn - origin) * invDir;
+	glm::vec3 t1 = (mx - origin) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+	return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+
+inline bool BVH::queryRay(const glm::vec3 &origin, const glm::vec3 &dir, float maxT,
+						  uint32_t &object, float &t) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	const float inf = std::numeric_limits<float>::infinity();
+	glm::vec3 invDir(dir.x != 0.0f ? 1.0f / dir.x : inf,
+					 dir.y != 0.0f ? 1.0f / dir.y : inf,
+					 dir.z != 0.0f ? 1.0f / dir.z : inf);
+
+	float best = maxT;
+	bool found = false;
+	uint32_t stack[MAX_DEPTH + 1];
+	int top = 0;
+	if (rayBoxDistance(origin, invDir, nodes[0].boundsMin, nodes[0].boundsMax, best) < inf) {
+		stack[top++] = 0;
+	}
+	while (top > 0) {
+		const BVHNode &N = nodes[stack[--top]];
+		if (N.count > 0) {
+			for (uint32_t i = 0; i < N.count; i++) {
+				uint32_t o = primitives[N.leftFirst + i];
+				float d = rayBoxDistance(origin, invDir, objMin[o], objMax[o], best);
+				if (d < best || (!found && d <= best)) {
+					best = d;
+					object = o;
+					found = true;
+				}
+			}
+			continue;
+		}
+		// Visit the closest child first, so that the farther one is more
+		// likely to be rejected by the distance found in the meantime
+		uint32_t a = N.leftFirst, b = N.leftFirst + 1;
+		float da = rayBoxDistance(origin, invDir, nodes[a].boundsMin, nodes[a].boundsMax, best);
+		float db = rayBoxDistance(origin, invDir, nodes[b].boundsMin, nodes[b].boundsMax, best);
+		if (da > db) {
+			std::swap(a, b);
+			std::swap(da, db);
+		}
+		if (db < inf) {
+			stack[top++] = b;
+		}
+		if (da < inf) {
+			stack[top++] = a;
+		}
+	}
+	if (found) {
+		t = best;
+	}
+	return found;
+}
+
+inline float pointBoxDistance2(const glm::vec3 &p, const glm::vec3 &mn, const glm::vec3 &mx) {
+	glm::vec3 d = glm::max(glm::max(mn - p, p - mx), glm::vec3(0.0f));
+	return glm::dot(d, d);
+}
+
+inline bool BVH::queryNearest(const glm::vec3 &point, uint32_t &object, float &distance) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	float best = std::numeric_limits<float>::max();
+	uint32_t stack[MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const BVHNode &N = nodes[stack[--top]];
+		if (pointBoxDistance2(point, N.boundsMin, N.boundsMax) >= best) {
+			continue;
+		}
+		if (N.count > 0) {
+			for (uint32_t i = 0; i < N.count; i++) {
+				uint32_t o = primitives[N.leftFirst + i];
+				float d = pointBoxDistance2(point, objMin[o], objMax[o]);
+				if (d < best) {
+					best = d;
+					object = o;
+				}
+			}
+			continue;
+		}
+		uint32_t a = N.leftFirst, b = N.leftFirst + 1;
+		if (pointBoxDistance2(point, nodes[a].boundsMin, nodes[a].boundsMax) >
+			pointBoxDistance2(point, nodes[b].boundsMin, nodes[b].boundsMax)) {
+			std::swap(a, b);
+		}
+		stack[top++] = b;
+		stack[top++] = a;
+	}
+	distance = std::sqrt(best);
+	return true;
+}
+
+// Build and query throughput on random boxes, checked against brute force
+inline bool bvhBenchmark(uint32_t objects) {
+	using Clock = std::chrono::high_resolution_clock;
+	auto ms = [](Clock::time_point a, Clock::time_point b) {
+		return std::chrono::duration<double, std::milli>(b - a).count();
+	};
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> pos(-100.0f, 100.0f), size(0.05f, 1.0f);
+	BoundsSoA B;
+	B.resize(objects);
+	for (uint32_t i = 0; i < objects; i++) {
+		B.set(i, glm::vec3(pos(rng), pos(rng) * 0.1f, pos(rng)),
+			  glm::vec3(size(rng), size(rng), size(rng)));
+	}
+
+	BVH bvh;
+	auto t0 = Clock::now();
+	bvh.build(B);
+	auto t1 = Clock::now();
+	bvh.refit(B);
+	auto t2 = Clock::now();
+	std::printf("bvh: %u objects, %zu nodes, build %.2f ms, refit %.2f ms\n",
+				objects, bvh.nodes.size(), ms(t0, t1), ms(t1, t2));
+
+	bool ok = true;
+	const int frustumQueries = 1000, pointQueries = 100000;
+
+	// Cameras spread over the scene, looking in random directions
+	std::vector<Frustum> frusta;
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 50.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	for (int i = 0; i < frustumQueries; i++) {
+		glm::vec3 eye(pos(rng), 0.0f, pos(rng));
+		float a = angle(rng);
+		glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(std::cos(a), 0.0f, std::sin(a)),
+									 glm::vec3(0.0f, 1.0f, 0.0f));
+		frusta.push_back(extractFrustum(proj * view));
+	}
+	std::vector<uint32_t> result;
+	size_t found = 0;
+	t0 = Clock::now();
+	for (const Frustum &F : frusta) {
+		bvh.queryFrustum(F, result);
+		found += result.size();
+	}
+	t1 = Clock::now();
+	std::vector<uint8_t> visible(objects);
+	size_t expected = 0;
+	for (const Frustum &F : frusta) {
+		expected += cullAABBs(F, B, 0, objects, visible.data());
+	}
+	t2 = Clock::now();
+	std::printf("bvh: frustum %.1f us/query (linear SIMD %.1f us), %zu hits %s\n",
+				ms(t0, t1) * 1000.0 / frustumQueries, ms(t1, t2) * 1000.0 / frustumQueries,
+				found, found == expected ? "ok" : "MISMATCH");
+	ok = ok && found == expected;
+
+	// Rays and nearest points, compared with brute force on a subset
+	std::vector<glm::vec3> origins(pointQueries), dirs(pointQueries);
+	for (int i = 0; i < pointQueries; i++) {
+		origins[i] = glm::vec3(pos(rng), pos(rng) * 0.1f, pos(rng));
+		float a = angle(rng);
+		dirs[i] = glm::vec3(std::cos(a), 0.0f, std::sin(a));
+	}
+	int hits = 0;
+	t0 = Clock::now();
+	for (int i = 0; i < pointQueries; i++) {
+		uint32_t o;
+		float t;
+		hits += bvh.queryRay(origins[i], dirs[i], 1000.0f, o, t);
+	}
+	t1 = Clock::now();
+	for (int i = 0; i < pointQueries; i++) {
+		uint32_t o;
+		float d;
+		bvh.queryNearest(origins[i], o, d);
+	}
+	t2 = Clock::now();
+	std::printf("bvh: ray %.0f queries/ms (%d hits), nearest %.0f queries/ms\n",
+				pointQueries / ms(t0, t1), hits, pointQueries / ms(t1, t2));
+
+	int wrong = 0;
+	glm::vec3 inf(std::numeric_limits<float>::infinity());
+	for (int i = 0; i < 200; i++) {
+		float bestT = 1000.0f, bestD = std::numeric_limits<float>::max();
+		bool any = false;
+		glm::vec3 invDir(1.0f / dirs[i].x, dirs[i].y != 0.0f ? 1.0f / dirs[i].y : inf.y,
+						 1.0f / dirs[i].z);
+		for (uint32_t o = 0; o < objects; o++) {
+			float t = rayBoxDistance(origins[i], invDir, bvh.objMin[o], bvh.objMax[o], bestT);
+			if (t <= bestT) {
+				bestT = t;
+				any = true;
+			}
+			bestD = std::min(bestD, pointBoxDistance2(origins[i], bvh.objMin[o], bvh.objMax[o]));
+		}
+		uint32_t o;
+		float t = 0.0f, d = 0.0f;
+		bool hit = bvh.queryRay(origins[i], dirs[i], 1000.0f, o, t);
+		// Without objects there is no nearest one on either side
+		bool nearest = bvh.queryNearest(origins[i], o, d);
+		if (hit != any || (hit && t != bestT) || nearest != (objects > 0) ||
+			(nearest && d != std::sqrt(bestD))) {
+			wrong++;
+		}
+	}
+	std::printf("bvh: ray / nearest against brute force %s\n", wrong ? "MISMATCH" : "ok");
+	return ok && wrong == 0;
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+// CPU view frustum culling.
+// Object bounds are kept as world space AABBs in struct-of-arrays form
+// (centers and half extents), so the plane tests can run on 8 (AVX) or
+// 4 (SSE / NEON) objects per iteration, with a scalar loop for the rest.
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+struct Frustum {
+	// Planes are (nx, ny, nz, d): a point p is inside when dot(n, p) + d >= 0
+	// Order: left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+};
+
+// Extracts the frustum planes from a view-projection matrix with Vulkan
+// clip conventions (0 <= z <= w). Works with the flipped Y of our proj.
+inline Frustum extractFrustum(const glm::mat4 &viewProj) {
+	glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+	Frustum F;
+	F.planes[0] = row3 + row0;
+	F.planes[1] = row3 - row0;
+	F.planes[2] = row3 + row1;
+	F.planes[3] = row3 - row1;
+	F.planes[4] = row2;
+	F.planes[5] = row3 - row2;
+
+	for (auto &p : F.planes) {
+		p /= glm::length(glm::vec3(p));
+	}
+	return F;
+}
+
+// Axis aligned box transformed by an affine matrix, as center / half extent
+inline void transformAABB(const glm::mat4 &M, const glm::vec3 &localMin,
+						  const glm::vec3 &localMax, glm::vec3 &center, glm::vec3 &extent) {
+	glm::vec3 c = (localMin + localMax) * 0.5f;
+	glm::vec3 e = (localMax - localMin) * 0.5f;
+
+	center = glm::vec3(M * glm::vec4(c, 1.0f));
+	glm::mat3 A(M);
+	extent = glm::vec3(
+		std::abs(A[0][0]) * e.x + std::abs(A[1][0]) * e.y + std::abs(A[2][0]) * e.z,
+		std::abs(A[0][1]) * e.x + std::abs(A[1][1]) * e.y + std::abs(A[2][1]) * e.z,
+		std::abs(A[0][2]) * e.x + std::abs(A[1][2]) * e.y + std::abs(A[2][2]) * e.z);
+}
+
+struct CullingStats {
+	uint32_t tested = 0;
+	uint32_t visible = 0;
+	uint32_t culled = 0;
+};
+
+// World space bounds of all the drawable objects, struct-of-arrays
+struct BoundsSoA {
+	std::vector<float> cx, cy, cz;
+	std::vector<float> ex, ey, ez;
+
+	void resize(size_t n) {
+		cx.resize(n); cy.resize(n); cz.resize(n);
+		ex.resize(n); ey.resize(n); ez.resize(n);
+	}
+	size_t size() const { return cx.size(); }
+
+	void set(size_t i, const glm::vec3 &center, const glm::vec3 &extent) {
+		cx[i] = center.x; cy[i] = center.y; cz[i] = center.z;
+		ex[i] = extent.x; ey[i] = extent.y; ez[i] = extent.z;
+	}
+};
+
+// Scalar AABB / frustum test, used for the tail of the arrays
+inline bool aabbInFrustum(const Frustum &F, float cx, float cy, float cz,
+						  float ex, float ey, float ez) {
+	for (const auto &p : F.planes) {
+		float d = p.x * cx + p.y * cy + p.z * cz + p.w;
+		float r = std::abs(p.x) * ex + std::abs(p.y) * ey + std::abs(p.z) * ez;
+		if (d + r < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool sphereInFrustum(const Frustum &F, const glm::vec3 &center, float radius) {
+	for (const auto &p : F.planes) {
+		if (glm::dot(glm::vec3(p), center) + p.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Tests the objects [first, first + count) of B against the frustum and
+// writes 1 (visible) or 0 (culled) in visible[i]. Returns how many passed.
+inline uint32_t cullAABBs(const Frustum &F, const BoundsSoA &B, size_t first,
+						  size_t count, uint8_t *visible) {
+	uint32_t passed = 0;
+	size_t i = first;
+	const size_t end = first + count;
+
+#if defined(__AVX__)
+	__m256 signMask = _mm256_set1_ps(-0.0f);
+	__m256 zero = _mm256_setzero_ps();
+	for (; i + 8 <= end; i += 8) {
+		__m256 cx = _mm256_loadu_ps(&B.cx[i]), cy = _mm256_loadu_ps(&B.cy[i]);
+		__m256 cz = _mm256_loadu_ps(&B.cz[i]);
+		__m256 ex = _mm256_loadu_ps(&B.ex[i]), ey = _mm256_loadu_ps(&B.ey[i]);
+		__m256 ez = _mm256_loadu_ps(&B.ez[i]);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (const auto &p : F.planes) {
+			__m256 nx = _mm256_set1_ps(p.x), ny = _mm256_set1_ps(p.y);
+			__m256 nz = _mm256_set1_ps(p.z);
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx),
+						_mm256_mul_ps(ny, cy)),
+						_mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(p.w)));
+			__m256 r = _mm256_add_ps(_mm256_add_ps(
+						_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), ex),
+						_mm256_mul_ps(_mm256_andnot_ps(signMask, ny), ey)),
+						_mm256_mul_ps(_mm256_andnot_ps(signMask, nz), ez));
+			inside = _mm256_and_ps(inside,
+						_mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+		}
+		int mask = _mm256_movemask_ps(inside);
+		for (int k = 0; k < 8; k++) {
+			visible[i + k] = (mask >> k) & 1;
+			passed += (mask >> k) & 1;
+		}
+	}
+#elif defined(CULLING_SSE)
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= end; i += 4) {
+		__m128 cx = _mm_loadu_ps(&B.cx[i]), cy = _mm_loadu_ps(&B.cy[i]);
+		__m128 cz = _mm_loadu_ps(&B.cz[i]);
+		__m128 ex = _mm_loadu_ps(&B.ex[i]), ey = _mm_loadu_ps(&B.ey[i]);
+		__m128 ez = _mm_loadu_ps(&B.ez[i]);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (const auto &p : F.planes) {
+			__m128 nx = _mm_set1_ps(p.x), ny = _mm_set1_ps(p.y), nz = _mm_set1_ps(p.z);
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+						_mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(p.w)));
+			__m128 r = _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex),
+						_mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+						_mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = (mask >> k) & 1;
+			passed += (mask >> k) & 1;
+		}
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= end; i += 4) {
+		float32x4_t cx = vld1q_f32(&B.cx[i]), cy = vld1q_f32(&B.cy[i]);
+		float32x4_t cz = vld1q_f32(&B.cz[i]);
+		float32x4_t ex = vld1q_f32(&B.ex[i]), ey = vld1q_f32(&B.ey[i]);
+		float32x4_t ez = vld1q_f32(&B.ez[i]);
+		uint32x4_t inside = vdupq_n_u32(0xFFFFFFFFu);
+		for (const auto &p : F.planes) {
+			float32x4_t d = vdupq_n_f32(p.w);
+			d = vmlaq_n_f32(d, cx, p.x);
+			d = vmlaq_n_f32(d, cy, p.y);
+			d = vmlaq_n_f32(d, cz, p.z);
+			d = vmlaq_n_f32(d, ex, std::abs(p.x));
+			d = vmlaq_n_f32(d, ey, std::abs(p.y));
+			d = vmlaq_n_f32(d, ez, std::abs(p.z));
+			inside = vandq_u32(inside, vcgeq_f32(d, vdupq_n_f32(0.0f)));
+		}
+		uint32_t lanes[4];
+		vst1q_u32(lanes, inside);
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = lanes[k] ? 1 : 0;
+			passed += visible[i + k];
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		visible[i] = aabbInFrustum(F, B.cx[i], B.cy[i], B.cz[i],
+								   B.ex[i], B.ey[i], B.ez[i]) ? 1 : 0;
+		passed += visible[i];
+	}
+	return passed;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+// CPU side of the frame pacing:
+// - FrameLimiter holds the frames to a target rate. It sleeps while the
+//   next frame is far away and spins on the clock for the last stretch,
+//   since the OS may oversleep by a millisecond (or a whole 15.6 ms tick
+//   on Windows): the stretch follows twice the oversleeps seen, growing at
+//   once and shrinking slowly, and never exceeds half a frame.
+// - FrameTimes collects the time between the starts of consecutive
+//   frames; its percentiles are printed with the frame statistics, to
+//   compare the present modes and limits on the actual machine. Other
+//   durations measured once per frame can be added to one as well.
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Shortest stretch before the deadline spent spinning instead of sleeping
+const std::chrono::microseconds FRAME_LIMITER_MIN_SPIN(1000);
+
+struct FrameLimiter {
+	using Clock = std::chrono::steady_clock;
+
+	Clock::duration period = Clock::duration::zero();
+	Clock::duration spin = FRAME_LIMITER_MIN_SPIN;
+	Clock::time_point next;
+	bool started = false;
+
+	// No limit if fps is 0
+	void init(float fps);
+	bool enabled() const { return period > Clock::duration::zero(); }
+	// Returns when the next frame may start
+	void wait();
+};
+
+inline void FrameLimiter::init(float fps) {
+	period = fps > 0.0f ?
+		std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps)) :
+		Clock::duration::zero();
+	spin = FRAME_LIMITER_MIN_SPIN;
+	started = false;
+}
+
+inline void FrameLimiter::wait() {
+	if (!enabled()) {
+		return;
+	}
+	Clock::time_point now = Clock::now();
+	// After a hitch of more than a frame, start over instead of catching up
+	if (!started || now > next + period) {
+		next = now;
+		started = true;
+	}
+
+	if (next - now > spin) {
+		Clock::time_point wakeUp = next - spin;
+		std::this_thread::sleep_until(wakeUp);
+		now = Clock::now();
+		Clock::duration late = (now - wakeUp) * 2;
+		if (late > spin) {
+			spin = std::min(late, period / 2);
+		} else {
+			spin -= (spin - FRAME_LIMITER_MIN_SPIN) / 16;
+		}
+		spin = std::max<Clock::duration>(spin, FRAME_LIMITER_MIN_SPIN);
+	}
+	while (now < next) {
+		std::this_thread::yield();
+		now = Clock::now();
+	}
+	next += period;
+}
+
+struct FrameTimes {
+	using Clock = std::chrono::steady_clock;
+
+	std::vector<float> milliseconds;
+	Clock::time_point last;
+	bool started = false;
+
+	struct Summary {
+		size_t frames = 0;
+		float average = 0.0f, p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+	};
+
+	// Called at the start of every frame
+	void tick();
+	// A sample measured elsewhere
+	void add(float ms) { milliseconds.push_back(ms); }
+	// The next frame does not follow the last one (e.g. after a pause)
+	void pause() { started = false; }
+	// Distribution of the frame times since the last call, which are cleared
+	Summary summarize();
+	void reset();
+};
+
+inline void FrameTimes::tick() {
+	Clock::time_point now = Clock::now();
+	if (started) {
+		milliseconds.push_back(std::chrono::duration<float, std::milli>(now - last).count());
+	}
+	last = now;
+	started = true;
+}
+
+inline FrameTimes::Summary FrameTimes::summarize() {
+	Summary S;
+	S.frames = milliseconds.size();
+	if (S.frames == 0) {
+		return S;
+	}
+	std::sort(milliseconds.begin(), milliseconds.end());
+	auto percentile = [&](float p) {
+		size_t i = static_cast<size_t>(p * (S.frames - 1) + 0.5f);
+		return milliseconds[i];
+	};
+	float sum = 0.0f;
+	for (float t : milliseconds) {
+		sum += t;
+	}
+	S.average = sum / S.frames;
+	S.p50 = percentile(0.50f);
+	S.p95 = percentile(0.95f);
+	S.p99 = percentile(0.99f);
+	S.max = milliseconds.back();
+	milliseconds.clear();
+	return S;
+}
+
+inline void FrameTimes::reset() {
+	milliseconds.clear();
+	started = false;
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+// Impostors of the statues: every statue (a mesh with its texture) is
+// rendered on the CPU, orthographically, from IMPOSTOR_VIEWS directions
+// around its vertical axis into an atlas of views. From far away the
+// statue is drawn as a single quad turned towards the camera, textured
+// with the view closest to the direction it is seen from.
+// Two atlases are baked: the albedo, with the coverage in alpha, and the
+// model space normals, so that the quad is lit like the mesh whatever the
+// rotation of the instance. --cook saves them next to the mesh
+// (<mesh>.obj.<texture>.impostor.png and .impostor_normals.png), without
+// them they are baked when the scene is loaded.
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <filesystem>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+// stb_image.h and stb_image_write.h are included, with their
+// implementations, by museum_project.hpp
+
+const int IMPOSTOR_VIEWS = 16;
+const int IMPOSTOR_GRID = 4;				// views per row of the atlas
+const int IMPOSTOR_CELL_SIZE = 256;			// pixels per side of a view
+const int IMPOSTOR_SUPERSAMPLING = 2;		// samples per pixel, per axis
+
+// The square of the views leaves this much room around the statue, so
+// that the mipmaps of neighbouring views do not bleed into each other
+const float IMPOSTOR_MARGIN = 1.1f;
+
+// Empty pixels take the color of the statue up to this many pixels away,
+// so that filtering does not darken its outline
+const int IMPOSTOR_DILATION = 4;
+
+struct ImpostorAtlas {
+	int width = 0, height = 0;
+	std::vector<stbi_uc> albedo;		// RGBA, alpha is the coverage
+	std::vector<stbi_uc> normals;		// model space normals, * 0.5 + 0.5
+
+	void bake(const Model &M, const std::string &textureFile);
+	// False if the files are missing, or older than any of sources
+	bool load(const std::string &file, const std::vector<std::string> &sources);
+	void save(const std::string &file) const;
+};
+
+// Name of the atlases of a statue, without the extension
+inline std::string impostorFile(const std::string &meshFile, const std::string &textureName) {
+	return meshFile + "." + textureName + ".impostor";
+}
+
+// Model space square framed by all the views, as center and half size:
+// centered on the bounding box, large enough for the statue seen from
+// any horizontal direction
+inline glm::vec4 impostorFrame(const Model &M) {
+	glm::vec3 center = (M.aabbMin + M.aabbMax) * 0.5f;
+	float radius = 0.0f;
+	for (const Vertex &v : M.vertices) {
+		radius = std::max(radius, glm::length(glm::vec2(v.pos.x - center.x, v.pos.z - center.z)));
+	}
+	float halfHeight = (M.aabbMax.y - M.aabbMin.y) * 0.5f;
+	return glm::vec4(center, std::max(radius, halfHeight) * IMPOSTOR_MARGIN);
+}
+
+// Direction of view k, from the statue towards the camera, in model space
+inline glm::vec3 impostorViewDirection(int k) {
+	float angle = glm::two_pi<float>() * k / IMPOSTOR_VIEWS;
+	return glm::vec3(std::sin(angle), 0.0f, std::cos(angle));
+}
+
+// View closest to a model space direction, whose height is ignored
+inline int impostorNearestView(const glm::vec3 &direction) {
+	float angle = std::atan2(direction.x, direction.z);
+	int k = static_cast<int>(std::lround(angle * IMPOSTOR_VIEWS / glm::two_pi<float>()));
+	return (k % IMPOSTOR_VIEWS + IMPOSTOR_VIEWS) % IMPOSTOR_VIEWS;
+}
+
+inline int impostorRows() {
+	return (IMPOSTOR_VIEWS + IMPOSTOR_GRID - 1) / IMPOSTOR_GRID;
+}
+
+// Texture coordinates of view k in the atlas: u, v, width, height
+inline glm::vec4 impostorCell(int k) {
+	return glm::vec4(static_cast<float>(k % IMPOSTOR_GRID) / IMPOSTOR_GRID,
+					 static_cast<float>(k / IMPOSTOR_GRID) / impostorRows(),
+					 1.0f / IMPOSTOR_GRID, 1.0f / impostorRows());
+}
+
+// Spreads the color of the covered pixels into the empty ones around
+// them, without crossing the border of a view
+inline void impostorDilate(std::vector<stbi_uc> &rgba, int width, int height) {
+	std::vector<uint8_t> filled(static_cast<size_t>(width) * height), next;
+	for (size_t p = 0; p < filled.size(); p++) {
+		filled[p] = rgba[p * 4 + 3] > 0;
+	}
+	const int dx[4] = { -1, 1, 0, 0 }, dy[4] = { 0, 0, -1, 1 };
+	for (int pass = 0; pass < IMPOSTOR_DILATION; pass++) {
+		next = filled;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				size_t p = static_cast<size_t>(y) * width + x;
+				if (filled[p]) {
+					continue;
+				}
+				int sum[3] = { 0, 0, 0 }, count = 0;
+				for (int n = 0; n < 4; n++) {
+					int nx = x + dx[n], ny = y + dy[n];
+					if (nx < 0 || ny < 0 || nx >= width || ny >= height ||
+						nx / IMPOSTOR_CELL_SIZE != x / IMPOSTOR_CELL_SIZE ||
+						ny / IMPOSTOR_CELL_SIZE != y / IMPOSTOR_CELL_SIZE) {
+						continue;
+					}
+					size_t q = static_cast<size_t>(ny) * width + nx;
+					if (filled[q]) {
+						for (int c = 0; c < 3; c++) {
+							sum[c] += rgba[q * 4 + c];
+						}
+						count++;
+					}
+				}
+				if (count > 0) {
+					for (int c = 0; c < 3; c++) {
+						rgba[p * 4 + c] = static_cast<stbi_uc>(sum[c] / count);
+					}
+					next[p] = 1;
+				}
+			}
+		}
+		filled.swap(next);
+	}
+}
+
+// Rasterizes the full detail mesh once per view, with a depth buffer and
+// IMPOSTOR_SUPERSAMPLING^2 samples per pixel
+inline void ImpostorAtlas::bake(const Model &M, const std::string &textureFile) {
+	int texWidth, texHeight, texChannels;
+	stbi_uc *texture = stbi_load(textureFile.c_str(), &texWidth, &texHeight, &texChannels,
+								 STBI_rgb_alpha);
+	if (!texture) {
+		throw std::runtime_error("failed to load texture image " + textureFile + "!");
+	}
+
+	width = IMPOSTOR_GRID * IMPOSTOR_CELL_SIZE;
+	height = impostorRows() * IMPOSTOR_CELL_SIZE;
+	albedo.assign(static_cast<size_t>(width) * height * 4, 0);
+	normals.assign(static_cast<size_t>(width) * height * 4, 0);
+
+	const int S = IMPOSTOR_CELL_SIZE * IMPOSTOR_SUPERSAMPLING;
+	const glm::vec4 frame = impostorFrame(M);
+	const glm::vec3 center(frame);
+	const float toSamples = S / (2.0f * frame.w);
+	const Model::Lod &full = M.lods[0];
+	const float empty = -std::numeric_limits<float>::infinity();
+
+	std::vector<float> depth(static_cast<size_t>(S) * S);
+	std::vector<glm::vec3> color(depth.size()), normal(depth.size());
+	std::vector<glm::vec3> screen(M.vertices.size());
+
+	// Nearest texel, repeated like the sampler of the textures does
+	auto sample = [&](glm::vec2 uv) {
+		int x = static_cast<int>(std::floor(uv.x * texWidth)) % texWidth;
+		int y = static_cast<int>(std::floor(uv.y * texHeight)) % texHeight;
+		x += x < 0 ? texWidth : 0;
+		y += y < 0 ? texHeight : 0;
+		const stbi_uc *t = texture + (static_cast<size_t>(y) * texWidth + x) * 4;
+		return glm::vec3(t[0], t[1], t[2]);
+	};
+
+	for (int k = 0; k < IMPOSTOR_VIEWS; k++) {
+		// Larger depth is closer to the camera
+		const glm::vec3 view = impostorViewDirection(k);
+		const glm::vec3 right(view.z, 0.0f, -view.x);
+		for (size_t v = 0; v < M.vertices.size(); v++) {
+			glm::vec3 d = M.vertices[v].pos - center;
+			screen[v] = glm::vec3(S * 0.5f + glm::dot(d, right) * toSamples,
+								  S * 0.5f - d.y * toSamples, glm::dot(d, view));
+		}
+		std::fill(depth.begin(), depth.end(), empty);
+
+		// Both windings are drawn, the depth test keeps the front faces
+		for (uint32_t i = full.firstIndex; i < full.firstIndex + full.indexCount; i += 3) {
+			const Vertex &va = M.vertices[M.indices[i]];
+			const Vertex &vb = M.vertices[M.indices[i + 1]];
+			const Vertex &vc = M.vertices[M.indices[i + 2]];
+			const glm::vec3 &A = screen[M.indices[i]];
+			const glm::vec3 &B = screen[M.indices[i + 1]];
+			const glm::vec3 &C = screen[M.indices[i + 2]];
+			float area = (B.x - A.x) * (C.y - A.y) - (B.y - A.y) * (C.x - A.x);
+			if (area == 0.0f) {
+				continue;
+			}
+			int x0 = std::max(0, static_cast<int>(std::floor(std::min(A.x, std::min(B.x, C.x)))));
+			int x1 = std::min(S - 1, static_cast<int>(std::ceil(std::max(A.x, std::max(B.x, C.x)))));
+			int y0 = std::max(0, static_cast<int>(std::floor(std::min(A.y, std::min(B.y, C.y)))));
+			int y1 = std::min(S - 1, static_cast<int>(std::ceil(std::max(A.y, std::max(B.y, C.y)))));
+
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					float px = x + 0.5f, py = y + 0.5f;
+					float w0 = ((B.x - px) * (C.y - py) - (B.y - py) * (C.x - px)) / area;
+					float w1 = ((C.x - px) * (A.y - py) - (C.y - py) * (A.x - px)) / area;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+						continue;
+					}
+					size_t s = static_cast<size_t>(y) * S + x;
+					float z = w0 * A.z + w1 * B.z + w2 * C.z;
+					if (z <= depth[s]) {
+						continue;
+					}
+					depth[s] = z;
+					color[s] = sample(w0 * va.texCoord + w1 * vb.texCoord + w2 * vc.texCoord);
+					glm::vec3 n = w0 * va.norm + w1 * vb.norm + w2 * vc.norm;
+					normal[s] = glm::dot(n, n) > 0.0f ? glm::normalize(n) : view;
+				}
+			}
+		}
+
+		// Resolve the samples into the cell of the view
+		const int cellX = (k % IMPOSTOR_GRID) * IMPOSTOR_CELL_SIZE;
+		const int cellY = (k / IMPOSTOR_GRID) * IMPOSTOR_CELL_SIZE;
+		const int samples = IMPOSTOR_SUPERSAMPLING * IMPOSTOR_SUPERSAMPLING;
+		for (int y = 0; y < IMPOSTOR_CELL_SIZE; y++) {
+			for (int x = 0; x < IMPOSTOR_CELL_SIZE; x++) {
+				glm::vec3 c(0.0f), n(0.0f);
+				int covered = 0;
+				for (int sy = 0; sy < IMPOSTOR_SUPERSAMPLING; sy++) {
+					for (int sx = 0; sx < IMPOSTOR_SUPERSAMPLING; sx++) {
+						size_t s = static_cast<size_t>(y * IMPOSTOR_SUPERSAMPLING + sy) * S +
+								   x * IMPOSTOR_SUPERSAMPLING + sx;
+						if (depth[s] != empty) {
+							c += color[s];
+							n += normal[s];
+							covered++;
+						}
+					}
+				}
+				if (covered == 0) {
+					continue;
+				}
+				c /= static_cast<float>(covered);
+				n = glm::dot(n, n) > 0.0f ? glm::normalize(n) : view;
+				stbi_uc alpha = static_cast<stbi_uc>(255 * covered / samples);
+				size_t p = (static_cast<size_t>(cellY + y) * width + cellX + x) * 4;
+				for (int i = 0; i < 3; i++) {
+					albedo[p + i] = static_cast<stbi_uc>(glm::clamp(c[i] + 0.5f, 0.0f, 255.0f));
+					normals[p + i] = static_cast<stbi_uc>(glm::clamp((n[i] * 0.5f + 0.5f) * 255.0f + 0.5f,
+																	 0.0f, 255.0f));
+				}
+				albedo[p + 3] = alpha;
+				normals[p + 3] = alpha;
+			}
+		}
+	}
+	stbi_image_free(texture);
+
+	impostorDilate(albedo, width, height);
+	impostorDilate(normals, width, height);
+}
+
+inline bool ImpostorAtlas::load(const std::string &file, const std::vector<std::string> &sources) {
+	std::error_code error;
+	auto baked = std::filesystem::last_write_time(file + ".png", error);
+	for (const std::string &source : sources) {
+		if (error || std::filesystem::last_write_time(source, error) > baked) {
+			return false;
+		}
+	}
+	if (error) {
+		return false;
+	}
+
+	// Atlases of another size were baked with other settings
+	int w[2], h[2], channels;
+	stbi_uc *pixels[2] = {
+		stbi_load((file + ".png").c_str(), &w[0], &h[0], &channels, STBI_rgb_alpha),
+		stbi_load((file + "_normals.png").c_str(), &w[1], &h[1], &channels, STBI_rgb_alpha)
+	};
+	bool ok = pixels[0] && pixels[1] &&
+			  w[0] == IMPOSTOR_GRID * IMPOSTOR_CELL_SIZE && w[1] == w[0] &&
+			  h[0] == impostorRows() * IMPOSTOR_CELL_SIZE && h[1] == h[0];
+	if (ok) {
+		width = w[0];
+		height = h[0];
+		size_t size = static_cast<size_t>(width) * height * 4;
+		albedo.assign(pixels[0], pixels[0] + size);
+		normals.assign(pixels[1], pixels[1] + size);
+	}
+	stbi_image_free(pixels[0]);
+	stbi_image_free(pixels[1]);
+	return ok;
+}
+
+inline void ImpostorAtlas::save(const std::string &file) const {
+	if (!stbi_write_png((file + ".png").c_str(), width, height, 4, albedo.data(), width * 4) ||
+		!stbi_write_png((file + "_normals.png").c_str(), width, height, 4, normals.data(), width * 4)) {
+		throw std::runtime_error("failed to write impostor " + file + "!");
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+// Small persistent worker pool used to spread per-frame CPU work
+// (command buffer recording, culling, ...) over all the available cores.
+// The calling thread always takes part in the work as thread 0, so a
+// JobSystem initialized with a single thread runs everything inline.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <exception>
+
+struct JobSystem {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable allDone;
+
+	std::function<void(int, int)> job;
+	int jobCount = 0;
+	std::atomic<int> nextItem{0};
+	int busyWorkers = 0;
+	uint64_t generation = 0;
+	bool quit = false;
+	std::exception_ptr failure;
+
+	~JobSystem() { cleanup(); }
+
+	void init(int threads);
+	void parallelFor(int count, const std::function<void(int item, int thread)> &fn);
+	int threadCount() const { return static_cast<int>(workers.size()) + 1; }
+	void cleanup();
+
+	void workerLoop(int thread);
+	void runItems(int thread);
+};
+
+inline void JobSystem::init(int threads) {
+	quit = false;
+	for (int t = 1; t < threads; t++) {
+		workers.emplace_back(&JobSystem::workerLoop, this, t);
+	}
+}
+
+inline void JobSystem::runItems(int thread) {
+	try {
+		for (int i = nextItem.fetch_add(1); i < jobCount; i = nextItem.fetch_add(1)) {
+			job(i, thread);
+		}
+	} catch (...) {
+		// Stop handing out items and report the error on the calling thread
+		nextItem = jobCount;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!failure) {
+			failure = std::current_exception();
+		}
+	}
+}
+
+inline void JobSystem::workerLoop(int thread) {
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [&] { return quit || generation != seen; });
+			if (quit) {
+				return;
+			}
+			seen = generation;
+		}
+
+		runItems(thread);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) {
+			allDone.notify_one();
+		}
+	}
+}
+
+// Runs fn(item, thread) for every item in [0, count) and returns when all of
+// them are finished. Items are handed out dynamically, so a thread can
+// process any number of them; "thread" is stable within one call and can be
+// used to index per-thread resources.
+inline void JobSystem::parallelFor(int count,
+			const std::function<void(int item, int thread)> &fn) {
+	if (count <= 0) {
+		return;
+	}
+	if (workers.empty() || count == 1) {
+		for (int i = 0; i < count; i++) {
+			fn(i, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = fn;
+		jobCount = count;
+		nextItem = 0;
+		busyWorkers = static_cast<int>(workers.size());
+		generation++;
+	}
+	wakeUp.notify_all();
+
+	runItems(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	allDone.wait(lock, [&] { return busyWorkers == 0; });
+	job = nullptr;
+
+	if (failure) {
+		std::exception_ptr e = failure;
+		failure = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+inline void JobSystem::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeUp.notify_all();
+	for (auto &w : workers) {
+		w.join();
+	}
+	workers.clear();
+}
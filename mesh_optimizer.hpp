@@ -0,0 +1,262 @@
+#pragma once
+
+// Triangle and vertex reordering of the meshes, done once when they are
+// loaded (or cooked, see --cook):
+// - Tipsify (Sander et al., "Fast Triangle Reordering for Vertex Locality
+//   and Reduced Overdraw") orders the triangles for the post-transform
+//   vertex cache;
+// - its output is cut into clusters, sorted so that the ones facing out
+//   of the mesh are drawn first, which reduces overdraw from any view;
+// - vertices are renumbered in order of first use, for fetch locality.
+// Statistics are measured on a simulated FIFO cache: ACMR is the number
+// of cache misses per triangle, ATVR the misses per vertex (1 is ideal).
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+	float acmr = 0.0f;
+	float atvr = 0.0f;
+};
+
+// Simulates a FIFO cache of cacheSize entries on a triangle list.
+// If misses is not null, it receives the number of misses of every triangle.
+inline VertexCacheStats simulateVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount,
+											uint32_t cacheSize = VERTEX_CACHE_SIZE,
+											std::vector<uint8_t> *misses = nullptr) {
+	// A vertex is in the cache if it entered less than cacheSize misses ago
+	std::vector<uint32_t> entered(vertexCount, 0);
+	uint32_t time = cacheSize + 1, total = 0;
+	if (misses) {
+		misses->assign(indices.size() / 3, 0);
+	}
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		for (size_t k = 0; k < 3; k++) {
+			uint32_t v = indices[i + k];
+			if (time - entered[v] > cacheSize) {
+				entered[v] = time++;
+				total++;
+				if (misses) {
+					(*misses)[i / 3]++;
+				}
+			}
+		}
+	}
+
+	VertexCacheStats S;
+	size_t triangles = indices.size() / 3;
+	S.acmr = triangles ? static_cast<float>(total) / triangles : 0.0f;
+	S.atvr = vertexCount ? static_cast<float>(total) / vertexCount : 0.0f;
+	return S;
+}
+
+// Tipsify: fans around a vertex still in the cache as long as possible,
+// then jumps to the most recent dead end. Returns the new index list; the
+// triangles where the order had to jump (no neighbour with triangles left) are
+// marked in boundaries.
+inline std::vector<uint32_t> tipsify(const std::vector<uint32_t> &indices, size_t vertexCount,
+									 uint32_t cacheSize, std::vector<uint8_t> &boundaries) {
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+	boundaries.assign(triangleCount, 0);
+	if (triangleCount == 0) {
+		return output;
+	}
+
+	// Triangles around each vertex
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		liveTriangles[indices[i]]++;
+	}
+	std::vector<uint32_t> adjacencyFirst(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyFirst[v + 1] = adjacencyFirst[v] + liveTriangles[v];
+	}
+	std::vector<uint32_t> adjacency(adjacencyFirst[vertexCount]);
+	std::vector<uint32_t> fill(adjacencyFirst.begin(), adjacencyFirst.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnds, candidates;
+	uint32_t time = cacheSize + 1;
+	size_t cursor = 0;
+	bool jumped = true;
+	int64_t fan = indices[0];
+
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t a = adjacencyFirst[fan]; a < adjacencyFirst[fan + 1]; a++) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			if (jumped) {
+				boundaries[output.size() / 3] = 1;
+				jumped = false;
+			}
+			for (size_t k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		// Next fanning vertex: among the neighbours with triangles left,
+		// the one that entered the cache first and will still be in it
+		// after its own triangles
+		fan = -1;
+		int64_t best = -1;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = time - cacheTime[v];
+			}
+			if (priority > best) {
+				best = priority;
+				fan = v;
+			}
+		}
+		if (fan >= 0) {
+			continue;
+		}
+
+		jumped = true;
+		while (!deadEnds.empty()) {
+			uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[v] > 0) {
+				fan = v;
+				break;
+			}
+		}
+		while (fan < 0 && cursor < vertexCount) {
+			if (liveTriangles[cursor] > 0) {
+				fan = static_cast<int64_t>(cursor);
+			}
+			cursor++;
+		}
+	}
+	return output;
+}
+
+// Cuts the cache-ordered triangles into clusters and sorts them by how
+// much they face away from the center of the mesh: outer surfaces are
+// drawn first and hide the ones behind them from most views. Clusters
+// start where Tipsify jumped, or where the cluster so far is already
+// as cache friendly as threshold times the whole mesh.
+inline void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+							 const std::vector<uint8_t> &boundaries, uint32_t cacheSize,
+							 float threshold = 0.9f) {
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	std::vector<uint8_t> misses;
+	VertexCacheStats whole = simulateVertexCache(indices, positions.size(), cacheSize, &misses);
+
+	std::vector<uint32_t> clusterFirst;
+	uint32_t clusterMisses = 0;
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		bool soft = !clusterFirst.empty() && misses[t] >= 2 &&
+			clusterMisses <= threshold * whole.acmr * (t - clusterFirst.back());
+		if (t == 0 || boundaries[t] || soft) {
+			clusterFirst.push_back(t);
+			clusterMisses = 0;
+		}
+		clusterMisses += misses[t];
+	}
+	clusterFirst.push_back(static_cast<uint32_t>(triangleCount));
+	const size_t clusterCount = clusterFirst.size() - 1;
+	if (clusterCount < 2) {
+		return;
+	}
+
+	// Area weighted centroid and normal of the clusters and of the mesh
+	std::vector<glm::vec3> centroid(clusterCount, glm::vec3(0.0f)), normal(clusterCount, glm::vec3(0.0f));
+	std::vector<float> area(clusterCount, 0.0f);
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; c++) {
+		for (uint32_t t = clusterFirst[c]; t < clusterFirst[c + 1]; t++) {
+			const glm::vec3 &a = positions[indices[t * 3 + 0]];
+			const glm::vec3 &b = positions[indices[t * 3 + 1]];
+			const glm::vec3 &d = positions[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(b - a, d - a);
+			float A = glm::length(n) * 0.5f;
+			centroid[c] += (a + b + d) * (A / 3.0f);
+			normal[c] += n;
+			area[c] += A;
+		}
+		meshCentroid += centroid[c];
+		meshArea += area[c];
+	}
+	if (meshArea <= 0.0f) {
+		return;
+	}
+	meshCentroid /= meshArea;
+
+	std::vector<float> key(clusterCount, 0.0f);
+	for (size_t c = 0; c < clusterCount; c++) {
+		if (area[c] > 0.0f && glm::dot(normal[c], normal[c]) > 0.0f) {
+			key[c] = glm::dot(centroid[c] / area[c] - meshCentroid, glm::normalize(normal[c]));
+		}
+	}
+
+	std::vector<uint32_t> order(clusterCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return key[a] > key[b];
+	});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for (uint32_t c : order) {
+		sorted.insert(sorted.end(), indices.begin() + clusterFirst[c] * 3,
+					  indices.begin() + clusterFirst[c + 1] * 3);
+	}
+	indices.swap(sorted);
+}
+
+// Renumbers the vertices in order of first use. Returns, for every new
+// vertex, the old one it comes from; unused vertices are dropped.
+inline std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> &indices, size_t vertexCount) {
+	const uint32_t none = UINT32_MAX;
+	std::vector<uint32_t> remap(vertexCount, none);
+	std::vector<uint32_t> source;
+	source.reserve(vertexCount);
+	for (uint32_t &i : indices) {
+		if (remap[i] == none) {
+			remap[i] = static_cast<uint32_t>(source.size());
+			source.push_back(i);
+		}
+		i = remap[i];
+	}
+	return source;
+}
+
+// Both triangle orders, for the vertex cache then for overdraw
+inline void optimizeTriangleOrder(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions) {
+	std::vector<uint8_t> boundaries;
+	indices = tipsify(indices, positions.size(), VERTEX_CACHE_SIZE, boundaries);
+	optimizeOverdraw(indices, positions, boundaries, VERTEX_CACHE_SIZE);
+}
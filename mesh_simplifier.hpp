@@ -0,0 +1,294 @@
+#pragma once
+
+// Mesh simplification for the LOD chains of the models, with the quadric
+// error metric of Garland and Heckbert ("Surface Simplification Using
+// Quadric Error Metrics"). Edges are collapsed into one of their
+// endpoints, cheapest first, so the simplified mesh only uses vertices of
+// the original one and no attribute has to be interpolated.
+// Vertices sharing a position (UV seams, flat shading) are welded for the
+// collapses; afterwards every corner picks, among the vertices at its new
+// position, the one with the closest attributes.
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+// Open borders are kept in place by planes perpendicular to their
+// triangles, weighted this much more than the triangles themselves
+const double SIMPLIFY_BORDER_WEIGHT = 10.0;
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix
+struct Quadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+	void addPlane(const glm::dvec3 &n, double d, double w) {
+		a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+		b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+		c2 += w * n.z * n.z; cd += w * n.z * d;
+		d2 += w * d * d;
+	}
+
+	void add(const Quadric &Q) {
+		a2 += Q.a2; ab += Q.ab; ac += Q.ac; ad += Q.ad; b2 += Q.b2;
+		bc += Q.bc; bd += Q.bd; c2 += Q.c2; cd += Q.cd; d2 += Q.d2;
+	}
+
+	double error(const glm::dvec3 &p) const {
+		double e = a2 * p.x * p.x + b2 * p.y * p.y + c2 * p.z * p.z +
+				   2.0 * (ab * p.x * p.y + ac * p.x * p.z + bc * p.y * p.z) +
+				   2.0 * (ad * p.x + bd * p.y + cd * p.z) + d2;
+		return std::max(e, 0.0);
+	}
+};
+
+struct SimplifyPositionHash {
+	size_t operator()(const glm::vec3 &p) const {
+		uint32_t b[3];
+		std::memcpy(b, &p.x, sizeof(float));
+		std::memcpy(b + 1, &p.y, sizeof(float));
+		std::memcpy(b + 2, &p.z, sizeof(float));
+		return (b[0] * 73856093u) ^ (b[1] * 19349663u) ^ (b[2] * 83492791u);
+	}
+};
+
+// Simplifies the triangle list down to about targetTriangles triangles, or
+// as far as possible without flipping or folding triangles. error receives
+// the distance between the simplified and the original surface, as
+// estimated by the quadrics. distance(a, b) compares the attributes of
+// two vertices at the same position.
+template <typename AttributeDistance>
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t> &indices,
+								   const std::vector<glm::vec3> &positions,
+								   size_t targetTriangles, float &error,
+								   AttributeDistance distance) {
+	const size_t vertexCount = positions.size();
+	const size_t triangleCount = indices.size() / 3;
+
+	// Weld the vertices by position
+	std::unordered_map<glm::vec3, uint32_t, SimplifyPositionHash> welded;
+	std::vector<uint32_t> weld(vertexCount);
+	std::vector<glm::dvec3> points;
+	for (size_t v = 0; v < vertexCount; v++) {
+		auto it = welded.find(positions[v]);
+		if (it == welded.end()) {
+			it = welded.emplace(positions[v], static_cast<uint32_t>(points.size())).first;
+			points.push_back(glm::dvec3(positions[v]));
+		}
+		weld[v] = it->second;
+	}
+	const size_t pointCount = points.size();
+
+	std::vector<uint32_t> tri(triangleCount * 3);
+	std::vector<uint8_t> alive(triangleCount, 0);
+	std::vector<std::vector<uint32_t>> around(pointCount);
+	std::vector<Quadric> Q(pointCount);
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	auto edgeKey = [](uint32_t a, uint32_t b) {
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	};
+	auto normalOf = [&](uint32_t a, uint32_t b, uint32_t c) {
+		return glm::cross(points[b] - points[a], points[c] - points[a]);
+	};
+
+	size_t live = 0;
+	for (size_t t = 0; t < triangleCount; t++) {
+		uint32_t *p = &tri[t * 3];
+		for (size_t k = 0; k < 3; k++) {
+			p[k] = weld[indices[t * 3 + k]];
+		}
+		glm::dvec3 n = normalOf(p[0], p[1], p[2]);
+		double length = glm::length(n);
+		if (p[0] == p[1] || p[1] == p[2] || p[0] == p[2] || length == 0.0) {
+			continue;
+		}
+		alive[t] = 1;
+		live++;
+		n /= length;
+		for (size_t k = 0; k < 3; k++) {
+			Q[p[k]].addPlane(n, -glm::dot(n, points[p[k]]), 1.0);
+			around[p[k]].push_back(static_cast<uint32_t>(t));
+			edgeUses[edgeKey(p[k], p[(k + 1) % 3])]++;
+		}
+	}
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (!alive[t]) {
+			continue;
+		}
+		const uint32_t *p = &tri[t * 3];
+		glm::dvec3 n = glm::normalize(normalOf(p[0], p[1], p[2]));
+		for (size_t k = 0; k < 3; k++) {
+			uint32_t a = p[k], b = p[(k + 1) % 3];
+			if (edgeUses[edgeKey(a, b)] != 1) {
+				continue;
+			}
+			glm::dvec3 side = glm::cross(points[b] - points[a], n);
+			double length = glm::length(side);
+			if (length > 0.0) {
+				side /= length;
+				Q[a].addPlane(side, -glm::dot(side, points[a]), SIMPLIFY_BORDER_WEIGHT);
+				Q[b].addPlane(side, -glm::dot(side, points[a]), SIMPLIFY_BORDER_WEIGHT);
+			}
+		}
+	}
+
+	struct Collapse {
+		double cost;
+		uint32_t from, to;
+		uint32_t fromVersion, toVersion;
+		bool operator>(const Collapse &C) const { return cost > C.cost; }
+	};
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+	std::vector<uint32_t> version(pointCount, 0);
+	std::vector<uint8_t> removed(pointCount, 0);
+	auto push = [&](uint32_t from, uint32_t to) {
+		Quadric S = Q[from];
+		S.add(Q[to]);
+		heap.push({ S.error(points[to]), from, to, version[from], version[to] });
+	};
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (alive[t]) {
+			for (size_t k = 0; k < 3; k++) {
+				push(tri[t * 3 + k], tri[t * 3 + (k + 1) % 3]);
+				push(tri[t * 3 + (k + 1) % 3], tri[t * 3 + k]);
+			}
+		}
+	}
+
+	std::vector<uint32_t> neighboursFrom, neighboursTo;
+	auto neighbours = [&](uint32_t p, std::vector<uint32_t> &out) {
+		out.clear();
+		for (uint32_t t : around[p]) {
+			if (alive[t]) {
+				for (size_t k = 0; k < 3; k++) {
+					if (tri[t * 3 + k] != p) {
+						out.push_back(tri[t * 3 + k]);
+					}
+				}
+			}
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	};
+
+	double maxCost = 0.0;
+	while (live > targetTriangles && !heap.empty()) {
+		Collapse C = heap.top();
+		heap.pop();
+		if (removed[C.from] || removed[C.to] ||
+			version[C.from] != C.fromVersion || version[C.to] != C.toVersion) {
+			continue;
+		}
+
+		// Link condition: the endpoints may only share the neighbours
+		// opposite to the edge, otherwise the surface would fold
+		uint32_t shared = 0;
+		for (uint32_t t : around[C.from]) {
+			if (alive[t] && (tri[t * 3] == C.to || tri[t * 3 + 1] == C.to || tri[t * 3 + 2] == C.to)) {
+				shared++;
+			}
+		}
+		neighbours(C.from, neighboursFrom);
+		neighbours(C.to, neighboursTo);
+		size_t common = 0;
+		for (uint32_t n : neighboursFrom) {
+			common += std::binary_search(neighboursTo.begin(), neighboursTo.end(), n);
+		}
+		if (shared == 0 || common != shared) {
+			continue;
+		}
+
+		// No remaining triangle may flip or become degenerate
+		bool flips = false;
+		for (uint32_t t : around[C.from]) {
+			const uint32_t *p = &tri[t * 3];
+			if (!alive[t] || p[0] == C.to || p[1] == C.to || p[2] == C.to) {
+				continue;
+			}
+			uint32_t q[3] = { p[0], p[1], p[2] };
+			for (size_t k = 0; k < 3; k++) {
+				if (q[k] == C.from) {
+					q[k] = C.to;
+				}
+			}
+			glm::dvec3 before = normalOf(p[0], p[1], p[2]);
+			glm::dvec3 after = normalOf(q[0], q[1], q[2]);
+			if (glm::dot(before, after) <= 0.25 * glm::length(before) * glm::length(after)) {
+				flips = true;
+				break;
+			}
+		}
+		if (flips) {
+			continue;
+		}
+
+		for (uint32_t t : around[C.from]) {
+			uint32_t *p = &tri[t * 3];
+			if (!alive[t]) {
+				continue;
+			}
+			if (p[0] == C.to || p[1] == C.to || p[2] == C.to) {
+				alive[t] = 0;
+				live--;
+				continue;
+			}
+			for (size_t k = 0; k < 3; k++) {
+				if (p[k] == C.from) {
+					p[k] = C.to;
+				}
+			}
+			around[C.to].push_back(t);
+		}
+		removed[C.from] = 1;
+		around[C.from].clear();
+		Q[C.to].add(Q[C.from]);
+		version[C.to]++;
+		maxCost = std::max(maxCost, C.cost);
+
+		auto &list = around[C.to];
+		list.erase(std::remove_if(list.begin(), list.end(), [&](uint32_t t) { return !alive[t]; }),
+				   list.end());
+		neighbours(C.to, neighboursTo);
+		for (uint32_t n : neighboursTo) {
+			push(C.to, n);
+			push(n, C.to);
+		}
+	}
+	error = static_cast<float>(std::sqrt(maxCost));
+
+	// Back to vertices: corners whose position was collapsed take the
+	// vertex at the new position with the most similar attributes
+	std::vector<std::vector<uint32_t>> atPoint(pointCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		atPoint[weld[v]].push_back(static_cast<uint32_t>(v));
+	}
+	std::vector<uint32_t> output;
+	output.reserve(live * 3);
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (!alive[t]) {
+			continue;
+		}
+		for (size_t k = 0; k < 3; k++) {
+			uint32_t v = indices[t * 3 + k];
+			uint32_t p = tri[t * 3 + k];
+			if (weld[v] != p) {
+				uint32_t best = atPoint[p][0];
+				float bestDistance = distance(v, best);
+				for (uint32_t c : atPoint[p]) {
+					float d = distance(v, c);
+					if (d < bestDistance) {
+						bestDistance = d;
+						best = c;
+					}
+				}
+				v = best;
+			}
+			output.push_back(v);
+		}
+	}
+	return output;
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+// Meshlets: small clusters of consecutive triangles of a mesh, each with a
+// bounding sphere and a cone around the normals of its triangles. A
+// cluster can be skipped when its sphere is outside the view frustum, or
+// when the cone shows that all its triangles face away from the eye.
+// The triangles of every cluster are made contiguous in the index buffer,
+// so the clusters that survive are drawn with plain indexed draws.
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+struct Meshlet {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+	glm::vec3 center;		// bounding sphere, in model space
+	float radius;
+	glm::vec3 coneAxis;		// average normal of the triangles
+	float coneCutoff;		// sine of the cone half angle, 1 or more if it cannot be culled
+};
+
+// Bounding sphere and normal cone of the triangles [first, first + count)
+inline void computeMeshletBounds(Meshlet &M, const std::vector<uint32_t> &indices,
+								 const std::vector<glm::vec3> &positions) {
+	glm::vec3 lo(positions[indices[M.firstIndex]]), hi(lo);
+	glm::vec3 normalSum(0.0f);
+	const uint32_t last = M.firstIndex + M.indexCount;
+	for (uint32_t i = M.firstIndex; i < last; i += 3) {
+		const glm::vec3 &a = positions[indices[i]];
+		const glm::vec3 &b = positions[indices[i + 1]];
+		const glm::vec3 &c = positions[indices[i + 2]];
+		lo = glm::min(lo, glm::min(a, glm::min(b, c)));
+		hi = glm::max(hi, glm::max(a, glm::max(b, c)));
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float length = glm::length(n);
+		if (length > 0.0f) {
+			normalSum += n / length;
+		}
+	}
+
+	M.center = (lo + hi) * 0.5f;
+	float r2 = 0.0f;
+	for (uint32_t i = M.firstIndex; i < last; i++) {
+		glm::vec3 d = positions[indices[i]] - M.center;
+		r2 = std::max(r2, glm::dot(d, d));
+	}
+	M.radius = std::sqrt(r2);
+
+	M.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	M.coneCutoff = 2.0f;
+	float sumLength = glm::length(normalSum);
+	if (sumLength <= 0.0f) {
+		return;
+	}
+	M.coneAxis = normalSum / sumLength;
+	float minDot = 1.0f;
+	for (uint32_t i = M.firstIndex; i < last; i += 3) {
+		const glm::vec3 &a = positions[indices[i]];
+		glm::vec3 n = glm::cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+		float length = glm::length(n);
+		if (length > 0.0f) {
+			minDot = std::min(minDot, glm::dot(n / length, M.coneAxis));
+		}
+	}
+	// A cone wider than a half space never faces away as a whole
+	if (minDot > 0.0f) {
+		M.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+}
+
+// Groups the triangles [firstIndex, firstIndex + indexCount) into meshlets
+// of at most MESHLET_MAX_VERTICES distinct vertices and
+// MESHLET_MAX_TRIANGLES triangles, and rewrites that range of indices so
+// that every meshlet is contiguous. A meshlet starts from the first
+// triangle left in the current order and grows through its neighbours,
+// preferring the ones that add few vertices and bend its normal cone the
+// least. indices are absolute (into positions), vertexOffset is the one of
+// the submesh they belong to.
+inline void appendMeshlets(std::vector<uint32_t> &indices, const std::vector<glm::vec3> &positions,
+						   uint32_t firstIndex, uint32_t indexCount, int32_t vertexOffset,
+						   std::vector<Meshlet> &out) {
+	const uint32_t triangleCount = indexCount / 3;
+	const uint32_t *tri = &indices[firstIndex];
+
+	// Triangles around each position, so that flat shaded meshes (that
+	// share no vertex) still grow through their neighbours
+	std::unordered_map<glm::vec3, std::vector<uint32_t>, SimplifyPositionHash> around;
+	std::vector<glm::vec3> normals(triangleCount, glm::vec3(0.0f));
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			around[positions[tri[t * 3 + k]]].push_back(t);
+		}
+		const glm::vec3 &a = positions[tri[t * 3]];
+		glm::vec3 n = glm::cross(positions[tri[t * 3 + 1]] - a, positions[tri[t * 3 + 2]] - a);
+		float length = glm::length(n);
+		if (length > 0.0f) {
+			normals[t] = n / length;
+		}
+	}
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> order;
+	order.reserve(indexCount);
+	std::vector<uint32_t> used;
+	used.reserve(MESHLET_MAX_VERTICES);
+	auto newVertices = [&](uint32_t t) {
+		uint32_t added = 0;
+		for (uint32_t k = 0; k < 3; k++) {
+			added += std::find(used.begin(), used.end(), tri[t * 3 + k]) == used.end();
+		}
+		return added;
+	};
+
+	uint32_t seed = 0;
+	while (order.size() < indexCount) {
+		while (emitted[seed]) {
+			seed++;
+		}
+		Meshlet M{ firstIndex + static_cast<uint32_t>(order.size()), 0, vertexOffset,
+				   glm::vec3(0.0f), 0.0f, glm::vec3(0.0f), 2.0f };
+		used.clear();
+		glm::vec3 normalSum(0.0f);
+		int64_t next = seed;
+		while (next >= 0) {
+			uint32_t t = static_cast<uint32_t>(next);
+			for (uint32_t k = 0; k < 3; k++) {
+				uint32_t v = tri[t * 3 + k];
+				if (std::find(used.begin(), used.end(), v) == used.end()) {
+					used.push_back(v);
+				}
+				order.push_back(v);
+			}
+			emitted[t] = 1;
+			normalSum += normals[t];
+			M.indexCount += 3;
+			if (M.indexCount / 3 >= MESHLET_MAX_TRIANGLES) {
+				break;
+			}
+
+			float sumLength = glm::length(normalSum);
+			glm::vec3 axis = sumLength > 0.0f ? normalSum / sumLength : glm::vec3(0.0f);
+			next = -1;
+			float best = 0.0f;
+			for (uint32_t v : used) {
+				for (uint32_t c : around[positions[v]]) {
+					if (emitted[c]) {
+						continue;
+					}
+					uint32_t added = newVertices(c);
+					if (used.size() + added > MESHLET_MAX_VERTICES) {
+						continue;
+					}
+					float score = added + 2.0f * (1.0f - glm::dot(normals[c], axis));
+					if (next < 0 || score < best) {
+						best = score;
+						next = c;
+					}
+				}
+			}
+		}
+		out.push_back(M);
+	}
+
+	std::copy(order.begin(), order.end(), indices.begin() + firstIndex);
+
+	// Growing by normals scatters the vertex cache order: each meshlet
+	// gets its own Tipsify pass, on local vertex numbers
+	std::vector<uint32_t> local, localToVertex;
+	std::vector<uint8_t> boundaries;
+	for (size_t m = out.size(); m-- > 0 && out[m].firstIndex >= firstIndex;) {
+		Meshlet &M = out[m];
+		local.resize(M.indexCount);
+		localToVertex.clear();
+		for (uint32_t i = 0; i < M.indexCount; i++) {
+			uint32_t v = indices[M.firstIndex + i];
+			auto it = std::find(localToVertex.begin(), localToVertex.end(), v);
+			local[i] = static_cast<uint32_t>(it - localToVertex.begin());
+			if (it == localToVertex.end()) {
+				localToVertex.push_back(v);
+			}
+		}
+		local = tipsify(local, localToVertex.size(), VERTEX_CACHE_SIZE, boundaries);
+		for (uint32_t i = 0; i < M.indexCount; i++) {
+			indices[M.firstIndex + i] = localToVertex[local[i]];
+		}
+		computeMeshletBounds(M, indices, positions);
+	}
+}
+
+// True if all the triangles of the meshlet face away from eye. Both are in
+// model space: the test is affine invariant, so it also holds for
+// non-uniformly scaled instances.
+inline bool meshletBackfacing(const Meshlet &M, const glm::vec3 &eye) {
+	glm::vec3 d = M.center - eye;
+	return glm::dot(d, M.coneAxis) >= M.coneCutoff * glm::length(d) + M.radius;
+}
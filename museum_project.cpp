@@ -1,4 +1,9 @@
 #include "museum_project.hpp"
+#include "scene.hpp"
+#include "scene_generator.hpp"
+#include "streaming.hpp"
+#include "impostors.hpp"
+#include "simulation.hpp"
 
 // Define the uniform blocks that will be passed to the shaders. We splitted them because:
 // globalUniformBufferObject :	 changes per scene
@@ -11,12 +16,137 @@ struct globalUniformBufferObject {
 
 struct UniformBufferObject {
 	alignas(16) glm::mat4 model;
+	// Dithered cross-fade of a statue: 0 draws only its mesh, 1 only its impostor
+	float fade;
 } ubo;
 
-int GetRoom(float X, float Z);
+// GPU driven mode: the instances as read by shaders/cull.comp and
+// shaders/shader_indirect.vert (std430 layout)
+struct GpuInstance {
+	alignas(16) glm::mat4 model;
+	alignas(16) glm::vec4 center;
+	alignas(16) glm::vec4 extent;
+	uint32_t group;
+};
+
+// The instances of one mesh and texture, drawn by a single indirect draw:
+// the culling writes one command per submesh of the mesh for every
+// instance it keeps, from firstCommand on
+struct GpuDrawGroup {
+	uint32_t firstCommand;
+	uint32_t firstSubmesh;
+	uint32_t submeshCount;
+	uint32_t pad;
+};
+
+struct GpuSubmesh {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+	uint32_t pad;
+};
+
+struct CullConstants {
+	glm::vec4 planes[6];
+	uint32_t instanceCount;
+};
+
+// local_size_x of shaders/cull.comp
+const uint32_t CULL_WORKGROUP_SIZE = 64;
+
+// Scenes with at least this many draws are frustum culled through a BVH
+const size_t BVH_CULLING_MIN_ITEMS = 256;
+
+// Cards are moved this far up while they are hidden
+const float CARD_HIDDEN_OFFSET = 5.0f;
+
+// Rooms are grouped into at most this many draw buckets
+const int MAX_DRAW_BUCKETS = 64;
+
+// The level of detail of an object is the coarsest one whose error stays
+// under this many pixels on screen; it only changes once the projected
+// error is LOD_HYSTERESIS (as a fraction) past the threshold
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.25f;
+
+// Objects with at least this many meshlets at their level of detail are
+// culled cluster by cluster
+const uint32_t MESHLET_CULLING_MIN_MESHLETS = 4;
+
+// itemRangeCount of the objects drawn whole
+const uint32_t WHOLE_OBJECT = UINT32_MAX;
+
+// While streaming, at most this many textures are uploaded per frame
+const int MAX_TEXTURE_UPLOADS_PER_FRAME = 2;
+
+// Statues become impostors once they are smaller on screen than a view of
+// their atlas; the mesh fades into the impostor over this fraction of the
+// distance before that
+const float IMPOSTOR_BLEND_BAND = 0.2f;
+
+// The camera and the cards are simulated at this rate (per second) on
+// their own thread
+const double SIMULATION_TICK_RATE = 120.0;
+// Walking speed in units per second, turning speed in degrees per second
+// (0.015 and 1.2 per frame at 60 fps, as in the first versions)
+const float CAMERA_MOVE_SPEED = 0.9f;
+const float CAMERA_TURN_SPEED = 72.0f;
+// Vertical field of view, in degrees
+const float CAMERA_FOV_Y = 45.0f;
+// --late-latch moves the camera ahead of the last tick by at most this
+// many ticks (the simulation thread may be late)
+const int LATE_LATCH_MAX_TICKS = 2;
+
+// Keys held down, sampled on the main thread for the simulation one
+enum ControlKey : uint32_t {
+	CONTROL_FORWARD = 1, CONTROL_BACK = 2, CONTROL_LEFT = 4, CONTROL_RIGHT = 8,
+	CONTROL_LOOK_UP = 16, CONTROL_LOOK_DOWN = 32, CONTROL_TURN_LEFT = 64, CONTROL_TURN_RIGHT = 128
+};
+
+const std::pair<int, ControlKey> CONTROL_BINDINGS[] = {
+	{GLFW_KEY_W, CONTROL_FORWARD}, {GLFW_KEY_S, CONTROL_BACK},
+	{GLFW_KEY_A, CONTROL_LEFT}, {GLFW_KEY_D, CONTROL_RIGHT},
+	{GLFW_KEY_UP, CONTROL_LOOK_UP}, {GLFW_KEY_DOWN, CONTROL_LOOK_DOWN},
+	{GLFW_KEY_LEFT, CONTROL_TURN_LEFT}, {GLFW_KEY_RIGHT, CONTROL_TURN_RIGHT}
+};
+
+struct CameraState {
+	glm::vec3 position{-4.5f, -0.5f, 1.0f};		// opposite of the position of the camera
+	glm::vec3 angles{0.0f, -90.0f, 0.0f};		// in degrees
+};
+
+// Published by the simulation thread at every tick
+struct SimulationState {
+	CameraState previous, current;		// at the tick before and at this one
+	std::chrono::steady_clock::time_point time;	// of this tick
+	std::chrono::steady_clock::time_point inputTime;	// when the keys it read were sampled
+	std::vector<uint8_t> cardsHidden;	// per room
+	uint32_t cardPresses = 0;			// SPACE presses handled so far
+};
 
 
 class MuseumProject : public BaseProject {
+public:
+	// Scene description, can be changed with --scene <file>
+	std::string sceneFile = "scenes/museum.json";
+
+	// If rooms > 0 a museum is generated instead (see --generate)
+	struct {
+		int rooms = 0, paintingsPerWall = 0, statues = 0;
+	} generated;
+
+	// Only keep the textures of the rooms around the visitor (see --stream)
+	bool streaming = false;
+
+	// VERTEX_COMPACT quantizes the vertices (see --compact-vertices)
+	VertexFormat vertexFormat = VERTEX_FULL;
+
+	// Cull and draw the instances from the GPU (see --gpu-culling)
+	bool gpuCulling = false;
+
+	// Sample the input again right before the submit (see --late-latch)
+	bool lateLatch = false;
+
 protected:
 	// Here you list all the Vulkan objects you need:
 
@@ -24,33 +154,121 @@ protected:
 	DescriptorSetLayout DSLGlobal;
 	DescriptorSetLayout DSLObject;
 
+	DescriptorSetLayout DSLImpostor;
+
 	// We create the Pipelines [Shader couples]
 	Pipeline P1;
+	Pipeline PImpostor;
 
-	///////////////////// M O D E L S //////////////////////////////////////
+	////////////////////////// S C E N E ///////////////////////////////////
+	// Meshes, textures and object instances, as listed in the scene file.
+	// Instances are sorted by room: the instances of room r are the range
+	// [scene.roomFirst[r], scene.roomFirst[r + 1]), room 0 is the building
+	// itself (walls and floor).
 
-	Model M_Walls, M_Floor, M_Frame, M_Amogus, M_Suzanne;
+	Scene scene;
+	std::vector<Model> meshes;
+	std::vector<Texture> textures;
 
-	//////////////////// T E X T U R E S ///////////////////////////////////
+	// Bucket b draws the instances [bucketFirst[b], bucketFirst[b + 1]),
+	// whole rooms only
+	std::vector<uint32_t> bucketFirst;
 
-	Texture ART, manet, matisse, monet, munch, picasso, pisarro, seurat, vgstar, vgself, cezanne, volpedo;
-	Texture ART_card, manet_card, matisse_card, monet_card, munch_card, picasso_card, pisarro_card, seurat_card, vgstar_card, vgself_card, cezanne_card, volpedo_card;
-	Texture TX_Amogus, TX_Suzanne;
-	Texture TX_Amogus_card, TX_Suzanne_card;
-	Texture TX_Walls, TX_Floor;
+	std::chrono::high_resolution_clock::time_point startupBegin;
 
 	////////////////// D E S C R I P T O R   S E T S ///////////////////////
-	// Instance of the Descriptor Layouts, elements that will be passed
-	// to the shaders when drawing an object
+	// One set per texture: the world matrices of all the instances are in
+	// a single arena, selected with a dynamic offset when drawing
 
-	DescriptorSet DS_ART, DS_manet, DS_matisse, DS_monet, DS_munch, DS_picasso, DS_pisarro, DS_seurat, DS_vgstar, DS_vgself, DS_cezanne, DS_volpedo;
-	DescriptorSet DS_ART_card, DS_manet_card, DS_matisse_card, DS_monet_card, DS_munch_card, DS_picasso_card, DS_pisarro_card, DS_seurat_card, DS_vgstar_card, DS_vgself_card, DS_cezanne_card, DS_volpedo_card;
-	DescriptorSet DS_Amogus, DS_Suzanne;
-	DescriptorSet DS_Amogus_card, DS_Suzanne_card;
-	DescriptorSet DS_Walls, DS_Floor;
+	std::vector<DescriptorSet> textureSets;
+	UniformArena objectUniforms;
 
-	DescriptorSet DS_Global;
+	// World transforms of the instances, only the ones that move are
+	// recomputed and uploaded every frame
+	TransformStore transforms;
+	std::vector<uint32_t> changedTransforms;
 
+	DescriptorSet DS_Global;
+	// Its uniform buffers, one per frame in flight, kept mapped
+	std::vector<globalUniformBufferObject *> globalUniforms;
+
+	// 1 if the cards of the room are hidden, as last applied to the
+	// transforms (the simulation thread owns the current value)
+	std::vector<uint8_t> cardsHidden;
+
+	// Rooms and doorways of the museum
+	PortalGraph floorPlan;
+	std::vector<uint8_t> roomVisible;
+
+	// Simulation thread: reads the input through the atomics, owns the
+	// sim* members and publishes its state in simulation
+	TripleBuffer<SimulationState> simulation;
+	std::atomic<uint32_t> controlKeys{0};
+	std::atomic<int64_t> controlTime{0};		// when controlKeys was sampled (steady_clock ticks)
+	std::atomic<uint32_t> cardPresses{0};
+	bool spaceHeld = false;
+	CameraState simCamera;
+	std::vector<uint8_t> simCardsHidden;
+	uint32_t simCardPresses = 0;
+	// After all it reads, so that if an exception skips localCleanup() it
+	// is stopped before they are destroyed
+	FixedStepThread simulationThread;
+
+	// World space bounds of the instances and result of the culling
+	BoundsSoA itemBounds;
+	std::vector<uint8_t> itemVisible;
+	BVH itemBVH;
+	std::vector<uint32_t> itemsInFrustum;
+
+	// Level of detail drawn for every instance
+	std::vector<uint8_t> itemLod;
+
+	// Objects culled cluster by cluster are drawn as the ranges of indices
+	// [itemRangeFirst[i], + itemRangeCount[i]) of the list of their bucket
+	std::vector<std::vector<Model::Submesh>> bucketRanges;
+	std::vector<uint32_t> itemRangeFirst, itemRangeCount;
+	std::vector<uint32_t> bucketClustersCulled, bucketTrianglesCulled;
+
+	// The walls, rasterized on the CPU to find the objects behind them
+	OccluderMesh wallOccluder;
+	OcclusionBuffer occlusion;
+
+	// Streaming mode: textures are decoded in the background and uploaded
+	// when the visitor gets close to the rooms that use them
+	RoomStreamer streamer;
+	AssetLoader loader;
+	std::vector<uint32_t> texturesToLoad, texturesToDestroy, texturesUploading;
+
+	// One impostor per statue mesh and texture (impostorKeys), drawn with
+	// the view itemView[i] and the fade itemFade[i] for instance i, whose
+	// impostor is itemImpostor[i] (-1 if it is not a statue)
+	std::vector<std::pair<uint32_t, uint32_t>> impostorKeys;
+	std::vector<glm::vec4> impostorFrames;
+	std::vector<Texture> impostorAlbedo, impostorNormals;
+	std::vector<DescriptorSet> impostorSets;
+	std::vector<int32_t> itemImpostor;
+	std::vector<float> itemFade;
+	std::vector<uint8_t> itemView;
+
+	////////////////////// G P U   C U L L I N G ///////////////////////////
+	// shaders/cull.comp tests the instances against the view frustum and
+	// writes the draw commands of the ones it keeps, group by group; every
+	// group is then drawn with one vkCmdDrawIndexedIndirectCount, whose
+	// count is read from gpuCounts. The counts are read back once the
+	// frame is done and compared with the same test on the CPU.
+	DescriptorSetLayout DSLCull;
+	DescriptorSetLayout DSLInstances;
+	ComputePipeline PCull;
+	Pipeline PIndirect;
+	StorageBuffer gpuInstances, gpuGroups, gpuSubmeshes, gpuCommands, gpuCounts;
+	DescriptorSet DS_Cull, DS_Instances;
+	std::vector<GpuDrawGroup> drawGroups;
+	std::vector<uint32_t> groupMesh, groupTexture, groupMaxDraws, groupTriangles;
+	std::vector<uint32_t> itemGroup;
+	Frustum cullingFrustum;
+	// Instances in the frustum according to the CPU, per frame in flight
+	// (UINT32_MAX until its resources have been used once)
+	std::vector<uint32_t> expectedVisible;
 
 
 	// Here you set the main application parameters
@@ -61,10 +279,35 @@ protected:
 		windowTitle = "The Computer Graphics Museum";
 		initialBackgroundColor = { 1.0f, 1.0f, 1.0f, 1.0f };
 
+		startupBegin = std::chrono::high_resolution_clock::now();
+		if (generated.rooms > 0) {
+			generateMuseum(scene, generated.rooms, generated.paintingsPerWall, generated.statues);
+		} else {
+			scene.load(sceneFile);
+		}
+
+		findImpostors();
+
+		// The indirect draws use the full vertices, all the meshes with
+		// the same pipeline
+		if (gpuCulling) {
+			indirectDrawCount = true;
+			computePassEnabled = true;
+			vertexFormat = VERTEX_FULL;
+		}
+
 		// Descriptor pool sizes
-		uniformBlocksInPool = 31;
-		texturesInPool = 30;
-		setsInPool = 31;
+		int textureCount = static_cast<int>(scene.textureNames.size());
+		int impostorCount = static_cast<int>(impostorKeys.size());
+		uniformBlocksInPool = 1;
+		dynamicUniformBlocksInPool = textureCount + impostorCount;
+		texturesInPool = textureCount + 2 * impostorCount;
+		setsInPool = textureCount + impostorCount + 1;
+		if (gpuCulling) {
+			storageBuffersInPool = 6;
+			setsInPool += 2;
+		}
+		freeableDescriptorSets = streaming;
 	}
 
 	// Here you load and setup all your Vulkan objects
@@ -76,7 +319,7 @@ protected:
 			// first  element : the binding number
 			// second element : the time of element (buffer or texture)
 			// third  element : the pipeline stage where it will be used
-			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT},
+			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT},
 			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
 			});
 
@@ -84,1305 +327,1273 @@ protected:
 			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},
 			});
 
+		// Impostors: the albedo and the normals atlases
+		DSLImpostor.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT},
+			{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},
+			{2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}
+			});
+
 		// Initialize the Pipelines [Shader couples]
 		// The last array, is a vector of pointer to the layouts of the sets that will
 		// be used in this pipeline. The first element will be set 0, and so on..
-		P1.init(this, "shaders/vert.spv", "shaders/frag.spv", { &DSLGlobal, &DSLObject });
+		P1.init(this, vertexFormat == VERTEX_COMPACT ? "shaders/compact_vert.spv" : "shaders/vert.spv",
+				"shaders/frag.spv", { &DSLGlobal, &DSLObject }, vertexFormat);
+		PImpostor.init(this, "shaders/impostor_vert.spv", "shaders/impostor_frag.spv",
+					   { &DSLGlobal, &DSLImpostor }, VERTEX_IMPOSTOR);
 
 
 		// Initialize the Models, textures and Descriptors (values assigned to the uniforms)
 
-		// W A L L S //
-
 		// ".obj" files contains: vertex position, normal vector direction and UV coordinates
-		M_Walls.init(this, "models/Walls.obj");
-		TX_Walls.init(this, "textures/wall.png");
-		// The real Descriptor Set, it assigns values to the uniforms
-		// application side that will be passed to the shaders
-		// second parameter :  a pointer to the Uniform Set Layout of this set
-		// last parameter : an array, with one element per binding of the set
-		DS_Walls.init(this, &DSLObject, {
-			// first  elmenet : the binding number
-			// second element : UNIFORM or TEXTURE (an enum) depending on the type
-			// third  element : only for UNIFORMs, the size of the corresponding C++ object
-			// fourth element : only for TEXTUREs, the pointer to the corresponding texture object
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &TX_Walls}
-			});
-
-		// F L O O R //
-
-		M_Floor.init(this, "models/Floor.obj");
-		TX_Floor.init(this, "textures/parquet.png");
-		DS_Floor.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &TX_Floor}
-			});
-
-		////////////////////////////////////// F R A M E S //////////////////////////////////////
+		meshes.resize(scene.meshFiles.size());
+		for (size_t m = 0; m < meshes.size(); m++) {
+			meshes[m].init(this, scene.meshFiles[m], vertexFormat);
+		}
 
-		M_Frame.init(this, "models/Rectangle.obj");
+		objectUniforms.init(this, sizeof(UniformBufferObject),
+							static_cast<uint32_t>(scene.instances.size()));
+
+		createImpostors();
+
+		textures.resize(scene.textureFiles.size());
+		textureSets.resize(textures.size());
+		if (streaming) {
+			// The building and the rooms at its entrance are loaded before
+			// the first frame, everything else while walking
+			streamer.init(scene);
+			loader.init();
+			streamer.setRoom(0, frameNumber, texturesToLoad);
+			for (uint32_t t : texturesToLoad) {
+				textures[t].init(this, scene.textureFiles[t]);
+				createTextureSet(t);
+				streamer.loaded(t);
+				texturesUploading.push_back(t);
+			}
+		} else {
+			for (uint32_t t = 0; t < textures.size(); t++) {
+				textures[t].init(this, scene.textureFiles[t]);
+				createTextureSet(t);
+			}
+		}
 
 
-		// A R T //
+		// G L O B A L //
 
-		ART.init(this, "textures/ART.png");
-		DS_ART.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &ART}
-			});
 
-		ART_card.init(this, "textures/ART_card.png");
-		DS_ART_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &ART_card}
+		DS_Global.init(this, &DSLGlobal, {
+						{0, UNIFORM, sizeof(globalUniformBufferObject), nullptr},
 			});
+		// Written every frame, as late as latchFrame()
+		globalUniforms.resize(framesInFlight());
+		for (size_t i = 0; i < framesInFlight(); i++) {
+			void *data;
+			VkResult result = vkMapMemory(device, DS_Global.uniformBuffersMemory[0][i], 0,
+										  sizeof(globalUniformBufferObject), 0, &data);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to map the global uniform buffer!");
+			}
+			globalUniforms[i] = static_cast<globalUniformBufferObject *>(data);
+		}
 
-		// M A N E T //
+		scene.buildPortalGraph(floorPlan);
+		cardsHidden.assign(scene.roomCount(), 1);
+		startSimulation();
+
+		itemBounds.resize(scene.instances.size());
+		itemVisible.assign(scene.instances.size(), 1);
+		itemLod.assign(scene.instances.size(), 0);
+		itemFade.assign(scene.instances.size(), 0.0f);
+		itemView.assign(scene.instances.size(), 0);
+		initTransforms();
+		createOccluders();
+		createDrawBuckets();
+		itemRangeFirst.assign(scene.instances.size(), 0);
+		itemRangeCount.assign(scene.instances.size(), WHOLE_OBJECT);
+		if (gpuCulling) {
+			createGpuCulling();
+		}
+		bucketRanges.resize(getDrawBucketCount());
+		bucketClustersCulled.assign(getDrawBucketCount(), 0);
+		bucketTrianglesCulled.assign(getDrawBucketCount(), 0);
+
+		float startup = std::chrono::duration<float, std::milli>
+			(std::chrono::high_resolution_clock::now() - startupBegin).count();
+		std::cout << "scene: " << scene.instances.size() << " instances in "
+				  << scene.rooms.size() << " rooms, " << meshes.size() << " meshes, "
+				  << textures.size() << " textures, loaded in " << startup << " ms, "
+				  << deviceMemoryInUse / (1024 * 1024) << " MB of device memory\n";
+	}
 
-		manet.init(this, "textures/Manet_Dejeuner.png");
-		DS_manet.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &manet}
-			});
 
-		manet_card.init(this, "textures/Manet_Dejeuner_card.png");
-		DS_manet_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &manet_card}
-			});
+	// Here you destroy all the objects you created!
+	void localCleanup() {
+		simulationThread.stop();
 
-		// M A T I S S E //
+		if (streaming) {
+			loader.cleanup();
+		}
+		for (uint32_t t = 0; t < textures.size(); t++) {
+			if (!streaming || streamer.allocated(t)) {
+				textureSets[t].cleanup();
+				textures[t].cleanup();
+			}
+		}
+		for (size_t a = 0; a < impostorKeys.size(); a++) {
+			impostorSets[a].cleanup();
+			impostorAlbedo[a].cleanup();
+			impostorNormals[a].cleanup();
+		}
+		if (gpuCulling) {
+			DS_Cull.cleanup();
+			DS_Instances.cleanup();
+			gpuInstances.cleanup();
+			gpuGroups.cleanup();
+			gpuSubmeshes.cleanup();
+			gpuCommands.cleanup();
+			gpuCounts.cleanup();
+			PCull.cleanup();
+			PIndirect.cleanup();
+			DSLCull.cleanup();
+			DSLInstances.cleanup();
+		}
+		for (size_t i = 0; i < globalUniforms.size(); i++) {
+			vkUnmapMemory(device, DS_Global.uniformBuffersMemory[0][i]);
+		}
+		DS_Global.cleanup();
+		objectUniforms.cleanup();
+		for (Model &M : meshes) {
+			M.cleanup();
+		}
 
-		matisse.init(this, "textures/Matisse_theDance.png");
-		DS_matisse.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &matisse}
-			});
+		P1.cleanup();
+		PImpostor.cleanup();
+		DSLGlobal.cleanup();
+		DSLObject.cleanup();
+		DSLImpostor.cleanup();
 
-		matisse_card.init(this, "textures/Matisse_theDance_card.png");
-		DS_matisse_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &matisse_card}
-			});
+	}
 
-		// M O N E T //
 
-		monet.init(this, "textures/Monet-Sunrise.png");
-		DS_monet.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &monet}
-			});
 
-		monet_card.init(this, "textures/Monet-Sunrise_card.png");
-		DS_monet_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &monet_card}
+	// The real Descriptor Set, it assigns values to the uniforms
+	// application side that will be passed to the shaders
+	// second parameter :  a pointer to the Uniform Set Layout of this set
+	// last parameter : an array, with one element per binding of the set
+	void createTextureSet(uint32_t t) {
+		textureSets[t].init(this, &DSLObject, {
+			// first  elmenet : the binding number
+			// second element : UNIFORM, DYNAMIC_UNIFORM or TEXTURE (an enum) depending on the type
+			// third  element : only for UNIFORMs, the size of the corresponding C++ object
+			// fourth element : only for TEXTUREs, the pointer to the corresponding texture object
+			// fifth  element : only for DYNAMIC_UNIFORMs, the arena holding the objects
+					{0, DYNAMIC_UNIFORM, sizeof(UniformBufferObject), nullptr, &objectUniforms},
+					{1, TEXTURE, 0, &textures[t]}
 			});
+	}
 
-		// M U N C H //
-
-		munch.init(this, "textures/Munch_Scream.png");
-		DS_munch.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &munch}
-			});
+	// Requests the textures of the rooms around the visitor, starts the
+	// upload of a few of the ones decoded so far, lets the frame draw the
+	// ones whose upload is done and destroys the released ones whose last
+	// frames the frame timeline shows as complete
+	void streamTextures(int room) {
+		texturesToLoad.clear();
+		streamer.setRoom(room, frameNumber, texturesToLoad);
+		for (uint32_t t : texturesToLoad) {
+			loader.request(t, scene.textureFiles[t]);
+		}
 
-		munch_card.init(this, "textures/Munch_Scream_card.png");
-		DS_munch_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &munch_card}
-			});
+		DecodedImage image;
+		for (int n = 0; n < MAX_TEXTURE_UPLOADS_PER_FRAME && loader.poll(image); n++) {
+			if (!image.pixels) {
+				throw std::runtime_error("failed to load texture image " + image.file + "!");
+			}
+			// The visitor may have left while the image was being decoded
+			if (streamer.loaded(image.id)) {
+				textures[image.id].init(this, image.pixels, image.width, image.height);
+				createTextureSet(image.id);
+				texturesUploading.push_back(image.id);
+			}
+			stbi_image_free(image.pixels);
+		}
 
-		// P I C A S S O // 
+		// The uploads run on the transfer queue, the textures are drawn
+		// from the first frame submitted after they are acquired
+		auto uploaded = [&](uint32_t t) {
+			if (!uploads.ready(textures[t].upload)) {
+				return false;
+			}
+			// Its acquire completes with this frame
+			streamer.uploaded(t, frameNumber + 1);
+			return true;
+		};
+		texturesUploading.erase(std::remove_if(texturesUploading.begin(), texturesUploading.end(),
+											   uploaded), texturesUploading.end());
+
+		texturesToDestroy.clear();
+		streamer.collect(framesCompleted(), texturesToDestroy);
+		for (uint32_t t : texturesToDestroy) {
+			textureSets[t].cleanup();
+			textures[t].cleanup();
+		}
 
-		picasso.init(this, "textures/Picasso_Guernica.png");
-		DS_picasso.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &picasso}
-			});
+		stats.texturesResident = streamer.residentCount();
+	}
 
-		picasso_card.init(this, "textures/Picasso_Guernica_card.png");
-		DS_picasso_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &picasso_card}
-			});
+	// Every statue mesh and texture pair gets an impostor
+	void findImpostors() {
+		const SceneInstances &I = scene.instances;
+		impostorKeys.clear();
+		itemImpostor.assign(I.size(), -1);
+		for (size_t i = 0; i < I.size(); i++) {
+			if (!I.statue[i]) {
+				continue;
+			}
+			std::pair<uint32_t, uint32_t> key(I.mesh[i], I.texture[i]);
+			auto it = std::find(impostorKeys.begin(), impostorKeys.end(), key);
+			itemImpostor[i] = static_cast<int32_t>(it - impostorKeys.begin());
+			if (it == impostorKeys.end()) {
+				impostorKeys.push_back(key);
+			}
+		}
+	}
 
-		// P I S A R R O //
+	// Loads the atlases baked by --cook, or bakes them now. Impostors stay
+	// resident even while streaming, they are what is drawn of the statues
+	// of the rooms far away
+	void createImpostors() {
+		const size_t count = impostorKeys.size();
+		impostorFrames.resize(count);
+		impostorAlbedo.resize(count);
+		impostorNormals.resize(count);
+		impostorSets.resize(count);
+		for (size_t a = 0; a < count; a++) {
+			uint32_t m = impostorKeys[a].first, t = impostorKeys[a].second;
+			std::string file = impostorFile(scene.meshFiles[m], scene.textureNames[t]);
+			ImpostorAtlas atlas;
+			if (!atlas.load(file, { scene.meshFiles[m], scene.textureFiles[t] })) {
+				std::cout << "impostor: baking " << file << " (saved by --cook)\n";
+				atlas.bake(meshes[m], scene.textureFiles[t]);
+			}
+			impostorFrames[a] = impostorFrame(meshes[m]);
+			impostorAlbedo[a].init(this, atlas.albedo.data(), atlas.width, atlas.height);
+			impostorNormals[a].init(this, atlas.normals.data(), atlas.width, atlas.height,
+									VK_FORMAT_R8G8B8A8_UNORM);
+			impostorSets[a].init(this, &DSLImpostor, {
+						{0, DYNAMIC_UNIFORM, sizeof(UniformBufferObject), nullptr, &objectUniforms},
+						{1, TEXTURE, 0, &impostorAlbedo[a]},
+						{2, TEXTURE, 0, &impostorNormals[a]}
+				});
+		}
+	}
 
-		pisarro.init(this, "textures/pisarro_boulevard_monmarte.png");
-		DS_pisarro.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &pisarro}
-			});
+	// Here it is the creation of the command buffer:
+	// You send to the GPU all the objects you want to draw,
+	// with their buffers and textures.
+	// Objects are grouped in draw buckets of whole rooms: every bucket is
+	// recorded in its own secondary command buffer, in parallel with the others.
+	int getDrawBucketCount() {
+		// The GPU driven draws are a handful of commands
+		if (gpuCulling) {
+			return 1;
+		}
+		return static_cast<int>(bucketFirst.size()) - 1;
+	}
 
-		pisarro_card.init(this, "textures/pisarro_boulevard_monmarte_card.png");
-		DS_pisarro_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &pisarro_card}
-			});
+	// Consecutive rooms are merged until a bucket holds about its share of
+	// the instances, so that large museums do not need thousands of
+	// secondary command buffers per frame
+	void createDrawBuckets() {
+		const uint32_t total = static_cast<uint32_t>(scene.instances.size());
+		const uint32_t share = std::max(1u, total / MAX_DRAW_BUCKETS);
+		bucketFirst.assign(1, 0);
+		for (int r = 1; r <= scene.roomCount(); r++) {
+			if (scene.roomFirst[r] - bucketFirst.back() >= share || r == scene.roomCount()) {
+				bucketFirst.push_back(scene.roomFirst[r]);
+			}
+		}
+	}
 
-		// S E U R A T //
+	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage, int bucket) {
 
-		seurat.init(this, "textures/Seurat_a_sunday.png");
-		DS_seurat.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &seurat}
-			});
+		if (gpuCulling) {
+			populateIndirectDraws(commandBuffer, currentImage);
+			return;
+		}
 
-		seurat_card.init(this, "textures/Seurat_a_sunday_card.png");
-		DS_seurat_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &seurat_card}
-			});
+		// Binding the Pipeline to the command buffer
 
-		// V A N  G O G H  S T A R R Y //
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, P1.graphicsPipeline);
 
-		vgstar.init(this, "textures/starringNight.png");
-		DS_vgstar.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &vgstar}
-			});
+		// Binding the Global Descriptor Set to the pipeline
 
-		vgstar_card.init(this, "textures/starringNight_card.png");
-		DS_vgstar_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &vgstar_card}
-			});
+		vkCmdBindDescriptorSets(commandBuffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS,
+			P1.pipelineLayout, 0, 1, &DS_Global.descriptorSets[currentImage],
+			0, nullptr);
 
-		// V A N  G O G H  S E L F //
+		const SceneInstances &I = scene.instances;
+		const Model *boundModel = nullptr;
+
+		for (uint32_t i = bucketFirst[bucket]; i < bucketFirst[bucket + 1]; i++) {
+			// Skip the objects that have been culled, and the statues
+			// drawn only as impostors
+			if (!itemVisible[i] || itemFade[i] >= 1.0f) {
+				continue;
+			}
+			const Model &model = meshes[I.mesh[i]];
+
+			// Objects in a room are sorted by mesh, so vertex and index
+			// buffers are bound only when the mesh changes
+			if (&model != boundModel) {
+				// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
+				VkBuffer vertexBuffers[] = { model.vertexBuffer };
+				VkDeviceSize offsets[] = { 0 };
+
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+				// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
+				// property .indexType of models, contains the type of the indices in its index buffer
+				vkCmdBindIndexBuffer(commandBuffer, model.indexBuffer, 0,
+					model.indexType);
+
+				// Compact vertices are decoded with the bounds of their mesh
+				if (model.format == VERTEX_COMPACT) {
+					vkCmdPushConstants(commandBuffer, P1.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+						0, sizeof(CompactVertexDecode), &model.decode);
+				}
+
+				boundModel = &model;
+			}
+
+			// The dynamic offset selects the world matrix of the instance
+			uint32_t dynamicOffset = objectUniforms.offset(i);
+			vkCmdBindDescriptorSets(commandBuffer,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				// property .pipelineLayout of a pipeline contains its layout.
+				// property .descriptorSets of a descriptor set contains its elements.
+				P1.pipelineLayout, 1, 1, &textureSets[I.texture[i]].descriptorSets[currentImage],
+				1, &dynamicOffset);
+
+			// property .lods of models, contains the submeshes of each level of detail:
+			// ranges of indices with their vertex offset, one per level for all the
+			// meshes that fit in 16-bit indices
+			const Model::Lod &lod = model.lods[itemLod[i]];
+			const Model::Submesh *ranges = &model.submeshes[lod.firstSubmesh];
+			uint32_t rangeCount = lod.submeshCount;
+			// or only its clusters that passed the cluster culling
+			if (itemRangeCount[i] != WHOLE_OBJECT) {
+				ranges = &bucketRanges[bucket][itemRangeFirst[i]];
+				rangeCount = itemRangeCount[i];
+			}
+			for (uint32_t r = 0; r < rangeCount; r++) {
+				vkCmdDrawIndexed(commandBuffer, ranges[r].indexCount, 1, ranges[r].firstIndex,
+					ranges[r].vertexOffset, 0);
+			}
+		}
 
-		vgself.init(this, "textures/VanGogh_self.png");
-		DS_vgself.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &vgself}
-			});
+		// The statues far away, as a quad with the view of their atlas
+		// closest to the direction of the camera
+		bool impostorsBound = false;
+		for (uint32_t i = bucketFirst[bucket]; i < bucketFirst[bucket + 1]; i++) {
+			if (!itemVisible[i] || itemFade[i] <= 0.0f) {
+				continue;
+			}
+			if (!impostorsBound) {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+					PImpostor.graphicsPipeline);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+					PImpostor.pipelineLayout, 0, 1, &DS_Global.descriptorSets[currentImage],
+					0, nullptr);
+				impostorsBound = true;
+			}
+			const int32_t a = itemImpostor[i];
+			ImpostorDraw draw{ impostorFrames[a], impostorCell(itemView[i]) };
+			vkCmdPushConstants(commandBuffer, PImpostor.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+				0, sizeof(ImpostorDraw), &draw);
+			uint32_t dynamicOffset = objectUniforms.offset(i);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+				PImpostor.pipelineLayout, 1, 1, &impostorSets[a].descriptorSets[currentImage],
+				1, &dynamicOffset);
+			vkCmdDraw(commandBuffer, 6, 1, 0, 0);
+		}
+	}
 
-		vgself_card.init(this, "textures/VanGogh_self_card.png");
-		DS_vgself_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &vgself_card}
+	// Groups the instances by mesh and texture, and creates the buffers
+	// read and written by the culling shader. Every mesh is drawn at its
+	// full level of detail.
+	void createGpuCulling() {
+		DSLCull.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+			{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+			{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+			{3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+			{4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT}
 			});
-
-		// C E Z A N N E //
-
-		cezanne.init(this, "textures/theBathers_Cezanne.png");
-		DS_cezanne.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &cezanne}
+		DSLInstances.init(this, {
+			{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT}
 			});
+		PCull.init(this, "shaders/cull_comp.spv", { &DSLCull }, sizeof(CullConstants));
+		PIndirect.init(this, "shaders/indirect_vert.spv", "shaders/frag.spv",
+					   { &DSLGlobal, &DSLObject, &DSLInstances });
+
+		// The submeshes of the full detail of every mesh
+		std::vector<GpuSubmesh> submeshes;
+		std::vector<uint32_t> meshFirstSubmesh(meshes.size());
+		for (size_t m = 0; m < meshes.size(); m++) {
+			meshFirstSubmesh[m] = static_cast<uint32_t>(submeshes.size());
+			const Model::Lod &full = meshes[m].lods[0];
+			for (uint32_t k = 0; k < full.submeshCount; k++) {
+				const Model::Submesh &S = meshes[m].submeshes[full.firstSubmesh + k];
+				submeshes.push_back({ S.firstIndex, S.indexCount, S.vertexOffset, 0 });
+			}
+		}
 
-		cezanne_card.init(this, "textures/theBathers_Cezanne_card.png");
-		DS_cezanne_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &cezanne_card}
-			});
+		// Groups sorted by mesh, so the buffers are bound once per mesh
+		const SceneInstances &I = scene.instances;
+		std::vector<std::pair<uint32_t, uint32_t>> keys;
+		for (size_t i = 0; i < I.size(); i++) {
+			keys.emplace_back(I.mesh[i], I.texture[i]);
+		}
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		std::vector<uint32_t> groupInstances(keys.size(), 0);
+		itemGroup.resize(I.size());
+		for (size_t i = 0; i < I.size(); i++) {
+			std::pair<uint32_t, uint32_t> key(I.mesh[i], I.texture[i]);
+			itemGroup[i] = static_cast<uint32_t>(
+				std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+			groupInstances[itemGroup[i]]++;
+		}
 
-		// V O L P E D O //
+		drawGroups.resize(keys.size());
+		groupMesh.resize(keys.size());
+		groupTexture.resize(keys.size());
+		groupMaxDraws.resize(keys.size());
+		groupTriangles.resize(keys.size());
+		uint32_t commandCount = 0;
+		for (size_t g = 0; g < keys.size(); g++) {
+			const Model::Lod &full = meshes[keys[g].first].lods[0];
+			groupMesh[g] = keys[g].first;
+			groupTexture[g] = keys[g].second;
+			drawGroups[g] = { commandCount, meshFirstSubmesh[keys[g].first], full.submeshCount, 0 };
+			groupMaxDraws[g] = groupInstances[g] * full.submeshCount;
+			groupTriangles[g] = full.indexCount / 3;
+			commandCount += groupMaxDraws[g];
+		}
 
-		volpedo.init(this, "textures/Volpedo_FourthEstate.png");
-		DS_volpedo.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &volpedo}
-			});
+		gpuInstances.init(this, sizeof(GpuInstance) * I.size(), 0, true);
+		gpuGroups.init(this, sizeof(GpuDrawGroup) * drawGroups.size(), 0, true);
+		gpuSubmeshes.init(this, sizeof(GpuSubmesh) * submeshes.size(), 0, true);
+		gpuCommands.init(this, sizeof(VkDrawIndexedIndirectCommand) * commandCount,
+						 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, false);
+		gpuCounts.init(this, sizeof(uint32_t) * drawGroups.size(),
+					   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, true);
+		for (size_t i = 0; i < framesInFlight(); i++) {
+			std::memcpy(gpuGroups.mapped[i], drawGroups.data(), sizeof(GpuDrawGroup) * drawGroups.size());
+			std::memcpy(gpuSubmeshes.mapped[i], submeshes.data(), sizeof(GpuSubmesh) * submeshes.size());
+		}
 
-		volpedo_card.init(this, "textures/Volpedo_FourthEstate_card.png");
-		DS_volpedo_card.init(this, &DSLObject, {
-						{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-						{1, TEXTURE, 0, &volpedo_card}
+		DS_Cull.init(this, &DSLCull, {
+					{0, STORAGE, 0, nullptr, nullptr, &gpuInstances},
+					{1, STORAGE, 0, nullptr, nullptr, &gpuGroups},
+					{2, STORAGE, 0, nullptr, nullptr, &gpuSubmeshes},
+					{3, STORAGE, 0, nullptr, nullptr, &gpuCommands},
+					{4, STORAGE, 0, nullptr, nullptr, &gpuCounts}
 			});
-
-		////////////////////////////////////// S T A T U E S //////////////////////////////////////
-
-
-		// A M O N G  U S //
-
-		// Statue
-
-		M_Amogus.init(this, "models/Amogus.obj");
-		TX_Amogus.init(this, "textures/marble.png");
-		DS_Amogus.init(this, &DSLObject, {
-					{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-					{1, TEXTURE, 0, &TX_Amogus}
+		DS_Instances.init(this, &DSLInstances, {
+					{0, STORAGE, 0, nullptr, nullptr, &gpuInstances}
 			});
 
-		// Card
-
-		M_Frame.init(this, "models/Rectangle.obj");
-		TX_Amogus_card.init(this, "textures/Amogus_card.PNG");
-		DS_Amogus_card.init(this, &DSLObject, {
-					{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-					{1, TEXTURE, 0, &TX_Amogus_card}
-			});
+		expectedVisible.assign(framesInFlight(), UINT32_MAX);
+		std::cout << "gpu culling: " << drawGroups.size() << " indirect draws, on the "
+				  << (asyncCompute ? "async compute" : "graphics") << " queue\n";
+	}
 
-		// S U Z A N N E //
+	// On the async compute queue: clears the counts and runs the culling.
+	// The draws of the frame wait for it before reading the commands.
+	void populateComputePass(int currentImage) {
+		if (!gpuCulling) {
+			return;
+		}
 
-		// Statue
+		computePass.fillBuffer(gpuCounts.buffers[currentImage], 0);
+		computePass.bufferBarrier({ gpuCounts.buffers[currentImage] }, VK_ACCESS_TRANSFER_WRITE_BIT,
+								  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+								  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-		M_Suzanne.init(this, "models/Suzanne.obj");
-		TX_Suzanne.init(this, "textures/Suzanne_texture.png");
-		DS_Suzanne.init(this, &DSLObject, {
-					{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-					{1, TEXTURE, 0, &TX_Suzanne}
-			});
+		CullConstants constants{};
+		for (int k = 0; k < 6; k++) {
+			constants.planes[k] = cullingFrustum.planes[k];
+		}
+		constants.instanceCount = static_cast<uint32_t>(scene.instances.size());
+		computePass.dispatch(PCull, DS_Cull, currentImage, &constants, sizeof(CullConstants),
+			(constants.instanceCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE);
+
+		// The counts are also read by the CPU once the frame is done
+		computePass.bufferBarrier({ gpuCounts.buffers[currentImage] }, VK_ACCESS_SHADER_WRITE_BIT,
+								  VK_ACCESS_HOST_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+								  VK_PIPELINE_STAGE_HOST_BIT);
+	}
 
-		// Card
+	// One indirect draw per group, skipping the textures not streamed in yet
+	void populateIndirectDraws(VkCommandBuffer commandBuffer, int currentImage) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, PIndirect.graphicsPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			PIndirect.pipelineLayout, 0, 1, &DS_Global.descriptorSets[currentImage], 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			PIndirect.pipelineLayout, 2, 1, &DS_Instances.descriptorSets[currentImage], 0, nullptr);
+
+		const Model *boundModel = nullptr;
+		for (size_t g = 0; g < drawGroups.size(); g++) {
+			if (streaming && !streamer.ready(groupTexture[g])) {
+				continue;
+			}
+			const Model &model = meshes[groupMesh[g]];
+			if (&model != boundModel) {
+				VkBuffer vertexBuffers[] = { model.vertexBuffer };
+				VkDeviceSize offsets[] = { 0 };
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+				vkCmdBindIndexBuffer(commandBuffer, model.indexBuffer, 0, model.indexType);
+				boundModel = &model;
+			}
+
+			// The world matrices come from the instances buffer, the
+			// uniform of the set is not used
+			uint32_t dynamicOffset = 0;
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+				PIndirect.pipelineLayout, 1, 1, &textureSets[groupTexture[g]].descriptorSets[currentImage],
+				1, &dynamicOffset);
+
+			cmdDrawIndexedIndirectCount(commandBuffer, gpuCommands.buffers[currentImage],
+				drawGroups[g].firstCommand * sizeof(VkDrawIndexedIndirectCommand),
+				gpuCounts.buffers[currentImage], g * sizeof(uint32_t), groupMaxDraws[g],
+				sizeof(VkDrawIndexedIndirectCommand));
+		}
+	}
 
-		M_Frame.init(this, "models/Rectangle.obj");
-		TX_Suzanne_card.init(this, "textures/Suzanne_card.PNG");
-		DS_Suzanne_card.init(this, &DSLObject, {
-					{0, UNIFORM, sizeof(UniformBufferObject), nullptr},
-					{1, TEXTURE, 0, &TX_Suzanne_card}
-			});
+	// Reads back the counts of the last frame drawn with this frame in
+	// flight (drawFrame() waited for the frame timeline to reach it),
+	// checks them against the CPU, then culls the new frame on the CPU too
+	void checkGpuCulling(uint32_t currentImage, const glm::mat4 &viewProj) {
+		const uint32_t itemCount = static_cast<uint32_t>(scene.instances.size());
+		if (expectedVisible[currentImage] != UINT32_MAX) {
+			const uint32_t *counts = reinterpret_cast<const uint32_t *>(gpuCounts.mapped[currentImage]);
+			uint32_t visible = 0, triangles = 0;
+			for (size_t g = 0; g < drawGroups.size(); g++) {
+				uint32_t kept = counts[g] / std::max(drawGroups[g].submeshCount, 1u);
+				visible += kept;
+				triangles += kept * groupTriangles[g];
+			}
+			stats.drawsVisible = visible;
+			stats.drawsCulled = itemCount - visible;
+			stats.trianglesDrawn = triangles;
+			if (visible != expectedVisible[currentImage]) {
+				stats.gpuCullingMismatches++;
+			}
+		}
 
+		cullingFrustum = extractFrustum(viewProj);
+		expectedVisible[currentImage] = cullAABBs(cullingFrustum, itemBounds, 0, itemCount,
+												  itemVisible.data());
+	}
 
-		// G L O B A L //
+	// The instances marked as occluders in the scene, transformed to world space
+	void createOccluders() {
+		const SceneInstances &I = scene.instances;
+		wallOccluder.positions.clear();
+		wallOccluder.indices.clear();
+		for (size_t i = 0; i < I.size(); i++) {
+			if (!I.occluder[i]) {
+				continue;
+			}
+			const glm::mat4 &M = transforms.world[i];
+			const Model &model = meshes[I.mesh[i]];
+			uint32_t base = static_cast<uint32_t>(wallOccluder.positions.size());
+			for (const Vertex &v : model.vertices) {
+				wallOccluder.positions.push_back(glm::vec3(M * glm::vec4(v.pos, 1.0f)));
+			}
+			const Model::Lod &full = model.lods[0];
+			for (uint32_t k = full.firstIndex; k < full.firstIndex + full.indexCount; k++) {
+				wallOccluder.indices.push_back(base + model.indices[k]);
+			}
+		}
+	}
 
+	// Cards are moved out of sight while the cards of their room are hidden
+	glm::vec3 instancePosition(uint32_t i) const {
+		const SceneInstances &I = scene.instances;
+		glm::vec3 position = I.position[i];
+		if (I.card[i] && cardsHidden[I.room[i]]) {
+			position.y += CARD_HIDDEN_OFFSET;
+		}
+		return position;
+	}
 
-		DS_Global.init(this, &DSLGlobal, {
-						{0, UNIFORM, sizeof(globalUniformBufferObject), nullptr},
-			});
+	void initTransforms() {
+		const SceneInstances &I = scene.instances;
+		transforms.resize(static_cast<uint32_t>(I.size()),
+						  static_cast<uint32_t>(framesInFlight()));
+		for (uint32_t i = 0; i < I.size(); i++) {
+			transforms.set(i, instancePosition(i), I.rotation[i], I.scale[i]);
+		}
+		updateTransforms();
+	}
 
+	// Recomputes the world matrices of the instances that moved, and
+	// their world space bounds for the culling
+	void updateTransforms() {
+		changedTransforms.clear();
+		stats.transformsUpdated = transforms.update(changedTransforms);
+		for (uint32_t i : changedTransforms) {
+			const Model &model = meshes[scene.instances.mesh[i]];
+			glm::vec3 center, extent;
+			transformAABB(transforms.world[i], model.aabbMin, model.aabbMax, center, extent);
+			itemBounds.set(i, center, extent);
+		}
 	}
 
+	// Copies the world matrices not yet in the uniform buffer of this
+	// image directly into the mapped arena
+	void uploadTransforms(uint32_t currentImage) {
+		stats.transformsUploaded = transforms.flush(currentImage, [&](uint32_t i) {
+			UniformBufferObject *ubo =
+				static_cast<UniformBufferObject *>(objectUniforms.element(currentImage, i));
+			ubo->model = transforms.world[i];
+			ubo->fade = itemFade[i];
+			if (gpuCulling) {
+				GpuInstance *instance =
+					reinterpret_cast<GpuInstance *>(gpuInstances.mapped[currentImage]) + i;
+				instance->model = transforms.world[i];
+				instance->center = glm::vec4(itemBounds.cx[i], itemBounds.cy[i], itemBounds.cz[i], 0.0f);
+				instance->extent = glm::vec4(itemBounds.ex[i], itemBounds.ey[i], itemBounds.ez[i], 0.0f);
+				instance->group = itemGroup[i];
+			}
+		});
+	}
 
-	// Here you destroy all the objects you created!		
-	void localCleanup() {
+	// Tests all the instances against the view frustum, then hides the
+	// rooms that cannot be seen through the doorways from the camera and
+	// the objects behind the walls: only the remaining items will be
+	// recorded in the command buffers
+	void cullDrawItems(const glm::mat4 &viewProj, const glm::vec3 &eye) {
+		const size_t itemCount = scene.instances.size();
+		Frustum F = extractFrustum(viewProj);
+		uint32_t visible;
+		if (itemCount >= BVH_CULLING_MIN_ITEMS) {
+			// Objects only move a little (the cards), so the tree built on
+			// the first frame is refitted instead of being rebuilt, and only
+			// when something moved
+			if (itemBVH.empty()) {
+				itemBVH.build(itemBounds);
+			} else if (!changedTransforms.empty()) {
+				itemBVH.refit(itemBounds);
+			}
+			itemBVH.queryFrustum(F, itemsInFrustum);
+			std::fill(itemVisible.begin(), itemVisible.end(), 0);
+			for (uint32_t i : itemsInFrustum) {
+				itemVisible[i] = 1;
+			}
+			visible = static_cast<uint32_t>(itemsInFrustum.size());
+		} else {
+			visible = cullAABBs(F, itemBounds, 0, itemCount, itemVisible.data());
+		}
 
-		DS_ART.cleanup();
-		DS_cezanne.cleanup();
-		DS_manet.cleanup();
-		DS_matisse.cleanup();
-		DS_monet.cleanup();
-		DS_munch.cleanup();
-		DS_picasso.cleanup();
-		DS_pisarro.cleanup();
-		DS_seurat.cleanup();
-		DS_vgself.cleanup();
-		DS_vgstar.cleanup();
-		DS_volpedo.cleanup();
-
-		DS_Amogus.cleanup();
-		DS_Suzanne.cleanup();
-
-		DS_Amogus_card.cleanup();
-		DS_Suzanne_card.cleanup();
-
-		DS_ART_card.cleanup();
-		DS_cezanne_card.cleanup();
-		DS_manet_card.cleanup();
-		DS_matisse_card.cleanup();
-		DS_monet_card.cleanup();
-		DS_munch_card.cleanup();
-		DS_picasso_card.cleanup();
-		DS_pisarro_card.cleanup();
-		DS_seurat_card.cleanup();
-		DS_vgself_card.cleanup();
-		DS_vgstar_card.cleanup();
-		DS_volpedo_card.cleanup();
-
-		DS_Floor.cleanup();
-		DS_Walls.cleanup();
-		DS_Global.cleanup();
+		stats.roomsVisible = floorPlan.findVisibleRooms(viewProj, eye, roomVisible);
+
+		// The building itself (room 0) is always drawn
+		uint32_t hidden = 0;
+		for (int r = 1; r < floorPlan.roomCount(); r++) {
+			if (roomVisible[r]) {
+				continue;
+			}
+			for (uint32_t i = scene.roomFirst[r]; i < scene.roomFirst[r + 1]; i++) {
+				hidden += itemVisible[i];
+				itemVisible[i] = 0;
+			}
+		}
 
-		ART.cleanup();
-		cezanne.cleanup();
-		manet.cleanup();
-		matisse.cleanup();
-		monet.cleanup();
-		munch.cleanup();
-		picasso.cleanup();
-		pisarro.cleanup();
-		seurat.cleanup();
-		vgself.cleanup();
-		vgstar.cleanup();
-		volpedo.cleanup();
-
-		TX_Amogus.cleanup();
-		TX_Suzanne.cleanup();
-
-		TX_Amogus_card.cleanup();
-		TX_Suzanne_card.cleanup();
-
-
-		ART_card.cleanup();
-		cezanne_card.cleanup();
-		manet_card.cleanup();
-		matisse_card.cleanup();
-		monet_card.cleanup();
-		munch_card.cleanup();
-		picasso_card.cleanup();
-		pisarro_card.cleanup();
-		seurat_card.cleanup();
-		vgself_card.cleanup();
-		vgstar_card.cleanup();
-		volpedo_card.cleanup();
-
-		TX_Walls.cleanup();
-		TX_Floor.cleanup();
-
-
-		M_Walls.cleanup();
-		M_Floor.cleanup();
-		M_Frame.cleanup();
-		M_Amogus.cleanup();
-		M_Suzanne.cleanup();
+		occlusion.begin();
+		occlusion.addOccluder(wallOccluder, viewProj);
+		occlusion.rasterize(frameJobs);
+
+		// The occluders themselves are not tested
+		uint32_t occluded = 0;
+		for (size_t i = scene.roomFirst[1]; i < itemCount; i++) {
+			if (!itemVisible[i] || scene.instances.occluder[i]) {
+				continue;
+			}
+			glm::vec3 center(itemBounds.cx[i], itemBounds.cy[i], itemBounds.cz[i]);
+			glm::vec3 extent(itemBounds.ex[i], itemBounds.ey[i], itemBounds.ez[i]);
+			if (!occlusion.isVisible(viewProj, center, extent)) {
+				itemVisible[i] = 0;
+				occluded++;
+			}
+		}
 
-		P1.cleanup();
-		DSLGlobal.cleanup();
-		DSLObject.cleanup();
+		// Objects whose texture has not been streamed in yet
+		uint32_t notLoaded = 0;
+		if (streaming) {
+			for (size_t i = 0; i < itemCount; i++) {
+				if (itemVisible[i] && itemFade[i] < 1.0f && !streamer.ready(scene.instances.texture[i])) {
+					itemVisible[i] = 0;
+					notLoaded++;
+				}
+			}
+		}
 
+		stats.drawsVisible = visible - hidden - occluded - notLoaded;
+		stats.drawsCulled = static_cast<uint32_t>(itemCount) - visible;
+		stats.drawsHidden = hidden;
+		stats.drawsOccluded = occluded;
+		stats.drawsNotLoaded = notLoaded;
 	}
 
+	// Statues smaller on screen than IMPOSTOR_CELL_SIZE pixels are drawn as
+	// impostors; over the last IMPOSTOR_BLEND_BAND of the distance before
+	// the switch both are drawn, with complementary dither patterns. The
+	// fade of the statues is written to the uniforms of this image every
+	// frame, the view is picked in model space.
+	void selectImpostors(uint32_t currentImage, const glm::vec3 &eye, float pixelsPerUnit) {
+		const SceneInstances &I = scene.instances;
+		for (size_t i = 0; i < I.size(); i++) {
+			if (itemImpostor[i] < 0) {
+				continue;
+			}
+			const glm::vec4 &frame = impostorFrames[itemImpostor[i]];
+			const glm::mat4 &M = transforms.world[i];
+			glm::vec3 center(M * glm::vec4(glm::vec3(frame), 1.0f));
+			const glm::vec3 &S = I.scale[i];
+			float size = 2.0f * frame.w * std::max(S.x, std::max(S.y, S.z));
+			float switchDistance = size * pixelsPerUnit / IMPOSTOR_CELL_SIZE;
+			float bandStart = switchDistance * (1.0f - IMPOSTOR_BLEND_BAND);
+			float fade = glm::clamp((glm::length(eye - center) - bandStart) /
+									(switchDistance - bandStart), 0.0f, 1.0f);
+
+			// Until its texture is streamed in, a statue can only be an impostor
+			if (streaming && fade > 0.0f && !streamer.ready(I.texture[i])) {
+				fade = 1.0f;
+			}
+			itemFade[i] = fade;
+			static_cast<UniformBufferObject *>(objectUniforms.element(currentImage, i))->fade = fade;
+
+			if (fade > 0.0f) {
+				glm::vec3 localEye(glm::inverse(M) * glm::vec4(eye, 1.0f));
+				itemView[i] = static_cast<uint8_t>(impostorNearestView(localEye - glm::vec3(frame)));
+			}
+		}
+	}
 
+	// Picks for every visible object the coarsest level of detail whose
+	// error, projected at the distance of the object, stays under
+	// LOD_PIXEL_ERROR pixels. Going coarser needs the error to be below the
+	// threshold by the hysteresis margin, going finer above it by the same
+	// margin, so LODs do not pop back and forth near the threshold.
+	// The building (the occluders) is always drawn at full detail.
+	void selectLods(const glm::vec3 &eye, float pixelsPerUnit) {
+		const SceneInstances &I = scene.instances;
+		const float coarser = LOD_PIXEL_ERROR * (1.0f - LOD_HYSTERESIS);
+		const float finer = LOD_PIXEL_ERROR * (1.0f + LOD_HYSTERESIS);
+		uint32_t triangles = 0, impostors = 0;
+		for (size_t i = 0; i < I.size(); i++) {
+			if (!itemVisible[i]) {
+				continue;
+			}
+			if (itemFade[i] > 0.0f) {
+				impostors++;
+				triangles += 2;
+				if (itemFade[i] >= 1.0f) {
+					continue;
+				}
+			}
+			const Model &model = meshes[I.mesh[i]];
+			uint32_t lod = itemLod[i];
+			if (!I.occluder[i] && model.lods.size() > 1) {
+				glm::vec3 center(itemBounds.cx[i], itemBounds.cy[i], itemBounds.cz[i]);
+				glm::vec3 extent(itemBounds.ex[i], itemBounds.ey[i], itemBounds.ez[i]);
+				glm::vec3 outside = glm::max(glm::abs(eye - center) - extent, glm::vec3(0.0f));
+				float distance = std::max(glm::length(outside), 0.1f);
+				const glm::vec3 &S = I.scale[i];
+				float pixelsPerError = std::max(S.x, std::max(S.y, S.z)) * pixelsPerUnit / distance;
+
+				while (lod + 1 < model.lods.size() && model.lods[lod + 1].error * pixelsPerError < coarser) {
+					lod++;
+				}
+				while (lod > 0 && model.lods[lod].error * pixelsPerError > finer) {
+					lod--;
+				}
+				itemLod[i] = static_cast<uint8_t>(lod);
+			}
+			triangles += model.lods[lod].indexCount / 3;
+		}
+		stats.trianglesDrawn = triangles;
+		stats.impostorsDrawn = impostors;
+	}
 
-	// Here it is the creation of the command buffer:
-	// You send to the GPU all the objects you want to draw,
-	// with their buffers and textures
-	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+	// Culls the meshlets of the visible objects that have enough of them at
+	// their level of detail: the ones outside the frustum or facing away
+	// from the eye are dropped, consecutive survivors are merged into one
+	// range of indices. Buckets are processed in parallel, each one into
+	// its own list of ranges.
+	void cullClusters(const glm::mat4 &viewProj, const glm::vec3 &eye) {
+		const Frustum F = extractFrustum(viewProj);
+		const SceneInstances &I = scene.instances;
+		std::vector<uint32_t> emptied(getDrawBucketCount(), 0);
+
+		frameJobs.parallelFor(getDrawBucketCount(), [&](int bucket, int) {
+			std::vector<Model::Submesh> &ranges = bucketRanges[bucket];
+			ranges.clear();
+			uint32_t clusters = 0, triangles = 0;
+			for (uint32_t i = bucketFirst[bucket]; i < bucketFirst[bucket + 1]; i++) {
+				itemRangeCount[i] = WHOLE_OBJECT;
+				if (!itemVisible[i] || I.occluder[i] || itemFade[i] >= 1.0f) {
+					continue;
+				}
+				const Model &model = meshes[I.mesh[i]];
+				const Model::Lod &lod = model.lods[itemLod[i]];
+				if (lod.meshletCount < MESHLET_CULLING_MIN_MESHLETS) {
+					continue;
+				}
+
+				// The cones are tested in model space
+				const glm::mat4 &M = transforms.world[i];
+				glm::vec3 localEye(glm::inverse(M) * glm::vec4(eye, 1.0f));
+				const glm::vec3 &S = I.scale[i];
+				float maxScale = std::max(S.x, std::max(S.y, S.z));
+
+				const uint32_t first = static_cast<uint32_t>(ranges.size());
+				for (uint32_t m = lod.firstMeshlet; m < lod.firstMeshlet + lod.meshletCount; m++) {
+					const Meshlet &C = model.meshlets[m];
+					glm::vec3 center(M * glm::vec4(C.center, 1.0f));
+					if (meshletBackfacing(C, localEye) || !sphereInFrustum(F, center, C.radius * maxScale)) {
+						clusters++;
+						triangles += C.indexCount / 3;
+						continue;
+					}
+					if (ranges.size() > first && ranges.back().vertexOffset == C.vertexOffset &&
+						ranges.back().firstIndex + ranges.back().indexCount == C.firstIndex) {
+						ranges.back().indexCount += C.indexCount;
+					} else {
+						ranges.push_back({ C.firstIndex, C.indexCount, C.vertexOffset });
+					}
+				}
+				itemRangeFirst[i] = first;
+				itemRangeCount[i] = static_cast<uint32_t>(ranges.size()) - first;
+				if (itemRangeCount[i] == 0) {
+					itemVisible[i] = 0;
+					emptied[bucket]++;
+				}
+			}
+			bucketClustersCulled[bucket] = clusters;
+			bucketTrianglesCulled[bucket] = triangles;
+		});
+
+		stats.clustersCulled = 0;
+		for (int b = 0; b < getDrawBucketCount(); b++) {
+			stats.clustersCulled += bucketClustersCulled[b];
+			stats.trianglesDrawn -= bucketTrianglesCulled[b];
+			stats.drawsVisible -= emptied[b];
+		}
+	}
 
-		// Binding the Pipeline to the command buffer
+	// Here is where you update the uniforms. Useful to move objects or change the camera.
+	// Very likely this will be where you will be writing the logic of your application.
+	// Here we put all the code that interacts with the user
+	// The camera only moves while its keys are held (SPACE is caught by the
+	// key events, but waits for the next tick), and the image changes when
+	// a streamed texture becomes resident
+	bool sceneActive() override {
+		simulation.update();
+		const SimulationState &S = simulation.readSlot();
+		if ((controlKeys.load(std::memory_order_relaxed) != 0) ||
+			S.previous.position != S.current.position || S.previous.angles != S.current.angles ||
+			S.cardPresses != cardPresses.load(std::memory_order_relaxed)) {
+			return true;
+		}
+		return streaming && !streamer.settled();
+	}
 
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, P1.graphicsPipeline);
+	// GLFW can only be queried on the main thread
+	void pollInput() override {
+		uint32_t keys = 0;
+		for (const auto &binding : CONTROL_BINDINGS) {
+			if (glfwGetKey(window, binding.first) == GLFW_PRESS) {
+				keys |= binding.second;
+			}
+		}
+		controlTime.store(frameInputTime.time_since_epoch().count(), std::memory_order_relaxed);
+		controlKeys.store(keys, std::memory_order_relaxed);
 
-		// Binding the Global Descriptor Set to the pipeline
+		// One toggle of the cards per press, however long SPACE is held
+		bool space = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+		if (space && !spaceHeld) {
+			cardPresses.fetch_add(1, std::memory_order_relaxed);
+		}
+		spaceHeld = space;
+	}
 
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 0, 1, &DS_Global.descriptorSets[currentImage],
-			0, nullptr);
+	void startSimulation() {
+		simCamera = CameraState();
+		simCardsHidden = cardsHidden;
+		simCardPresses = 0;
+		for (SimulationState &S : simulation.slots) {
+			S.previous = S.current = simCamera;
+			S.time = S.inputTime = std::chrono::steady_clock::now();
+			S.cardsHidden = cardsHidden;
+			S.cardPresses = 0;
+		}
+		simulationThread.start(SIMULATION_TICK_RATE, [this](std::chrono::steady_clock::time_point time) {
+			simulationTick(time);
+		});
+	}
 
-		//////////////////////////////////// W A L L S ///////////////////////////////////////////
-		// Draw commands for the walls
+	// On the simulation thread: only touches the sim* members, the input
+	// atomics and the floor plan, which does not change after localInit()
+	void simulationTick(std::chrono::steady_clock::time_point time) {
+		std::chrono::steady_clock::time_point inputTime(
+			std::chrono::steady_clock::duration(controlTime.load(std::memory_order_relaxed)));
+		uint32_t keys = controlKeys.load(std::memory_order_relaxed);
+		CameraState next = simCamera;
+		moveCamera(next, keys, static_cast<float>(1.0 / SIMULATION_TICK_RATE));
+
+		// State of the Frame Cards: every press of SPACE toggles the ones
+		// of the room the camera is in
+		uint32_t presses = cardPresses.load(std::memory_order_relaxed);
+		if (presses != simCardPresses) {
+			// (CamPos is the opposite of the position of the camera)
+			int room = floorPlan.roomAt(-next.position.x, -next.position.z);
+			if (room > 0 && ((presses - simCardPresses) & 1)) {
+				simCardsHidden[room] = !simCardsHidden[room];
+			}
+			simCardPresses = presses;
+		}
 
-		// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
-		VkBuffer vertexBuffers_Walls[] = { M_Walls.vertexBuffer };
-		VkDeviceSize offsets_Walls[] = { 0 };
+		SimulationState &S = simulation.writeSlot();
+		S.previous = simCamera;
+		S.current = next;
+		S.time = time;
+		S.inputTime = inputTime;
+		S.cardsHidden = simCardsHidden;
+		S.cardPresses = simCardPresses;
+		simulation.publish();
+		simCamera = next;
+	}
 
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers_Walls, offsets_Walls); // bind to command buffer
+	// The camera after dt seconds with the keys held down
+	static void moveCamera(CameraState &camera, uint32_t keys, float dt) {
+		const float move = CAMERA_MOVE_SPEED * dt, turn = CAMERA_TURN_SPEED * dt;
+		glm::vec3 &CamPos = camera.position;
+		glm::vec3 &CamAngle = camera.angles;
 
-		// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
-		vkCmdBindIndexBuffer(commandBuffer, M_Walls.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
+		////////////////////////// C O N T R O L S //////////////////////////
 
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			// property .pipelineLayout of a pipeline contains its layout.
-			// property .descriptorSets of a descriptor set contains its elements.
-			P1.pipelineLayout, 1, 1, &DS_Walls.descriptorSets[currentImage],
-			0, nullptr);
+		// Movement controls depend on the Camera angle
 
-		// property .indices.size() of models, contains the number of triangles * 3 of the mesh.
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Walls.indices.size()), 1, 0, 0, 0);
+		if (keys & CONTROL_FORWARD) {
+			CamPos.x -= move * sin(glm::radians(CamAngle.y));
+			CamPos.z += move * cos(glm::radians(CamAngle.y));
+		}
+		if (keys & CONTROL_LEFT) {
+			CamPos.z += move * sin(glm::radians(CamAngle.y));
+			CamPos.x += move * cos(glm::radians(CamAngle.y));
+		}
+		if (keys & CONTROL_RIGHT) {
+			CamPos.z -= move * sin(glm::radians(CamAngle.y));
+			CamPos.x -= move * cos(glm::radians(CamAngle.y));
+		}
+		if (keys & CONTROL_BACK) {
+			CamPos.x += move * sin(glm::radians(CamAngle.y));
+			CamPos.z -= move * cos(glm::radians(CamAngle.y));
+		}
 
+		if ((keys & CONTROL_LOOK_UP) && CamAngle.x > -45.0f) {
+			CamAngle.x -= turn;
+		}
+		if (keys & CONTROL_TURN_LEFT) {
+			CamAngle.y -= turn;
+		}
+		if (keys & CONTROL_TURN_RIGHT) {
+			CamAngle.y += turn;
+		}
+		if ((keys & CONTROL_LOOK_DOWN) && CamAngle.x < 45.0f) {
+			CamAngle.x += turn;
+		}
+	}
 
-		//////////////////////////////////////// F L O O R ///////////////////////////////////////////
-		// Draw commands for the floor
+	// Interpolated from the tick before: drawn one tick late, but moving
+	// smoothly at any frame rate
+	CameraState interpolatedCamera(const SimulationState &S) const {
+		float alpha = std::chrono::duration<float>(std::chrono::steady_clock::now() - S.time).count() *
+					  static_cast<float>(SIMULATION_TICK_RATE);
+		alpha = glm::clamp(alpha, 0.0f, 1.0f);
+		CameraState camera;
+		camera.position = glm::mix(S.previous.position, S.current.position, alpha);
+		camera.angles = glm::mix(S.previous.angles, S.current.angles, alpha);
+		return camera;
+	}
 
-		VkBuffer vertexBuffers_Floor[] = { M_Floor.vertexBuffer };
-		VkDeviceSize offsets_Floor[] = { 0 };
+	// --late-latch: moved on from the last tick with the keys held now, as
+	// the next tick will do
+	CameraState latestCamera(const SimulationState &S) const {
+		float ahead = std::chrono::duration<float>(std::chrono::steady_clock::now() - S.time).count();
+		ahead = glm::clamp(ahead, 0.0f, static_cast<float>(LATE_LATCH_MAX_TICKS / SIMULATION_TICK_RATE));
+		CameraState camera = S.current;
+		moveCamera(camera, controlKeys.load(std::memory_order_relaxed), ahead);
+		return camera;
+	}
 
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers_Floor, offsets_Floor);
+	globalUniformBufferObject cameraUniforms(const CameraState &camera) const {
+		const glm::vec3 &CamPos = camera.position;
+		const glm::vec3 &CamAngle = camera.angles;
+		globalUniformBufferObject gubo{};
 
-		vkCmdBindIndexBuffer(commandBuffer, M_Floor.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
+		// look-in-direction matrix, first person model, to implement what is seen by the camera
 
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Floor.descriptorSets[currentImage],
-			0, nullptr);
+		gubo.view = glm::rotate(glm::mat4(1.0f), glm::radians(CamAngle.x), glm::vec3(1, 0, 0)) *
+			glm::rotate(glm::mat4(1.0f), glm::radians(CamAngle.y), glm::vec3(0, 1, 0)) *
+			glm::rotate(glm::mat4(1.0f), glm::radians(CamAngle.z), glm::vec3(0, 0, 1)) *
+			glm::translate(glm::mat4(1), glm::vec3(CamPos.x, CamPos.y, CamPos.z));
 
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Floor.indices.size()), 1, 0, 0, 0);
+		gubo.proj = glm::perspective(glm::radians(CAMERA_FOV_Y),
+			swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
 
+		gubo.proj[1][1] *= -1;
+		return gubo;
+	}
 
-		//////////////////////////////////////// F R A M E S ///////////////////////////////////////////
+	// --late-latch: the command buffers are recorded, only the camera is
+	// left. The input is sampled again and the view written over the one of
+	// updateUniformBuffer(), which the culling used: the two are a fraction
+	// of a frame apart, so at worst an object at the edge of the view
+	// appears one frame late.
+	void latchFrame(uint32_t currentImage) override {
+		if (!lateLatch) {
+			return;
+		}
+		glfwPollEvents();
+		frameInputTime = std::chrono::steady_clock::now();
+		pollInput();
+		simulation.update();
+		*globalUniforms[currentImage] = cameraUniforms(latestCamera(simulation.readSlot()));
+	}
 
-		VkBuffer vertexBuffers_Frames[] = { M_Frame.vertexBuffer };
-		VkDeviceSize offsets_Frames[] = { 0 };
+	// Cards pop up or hide when the simulation toggled their room
+	void applyCards(const std::vector<uint8_t> &hidden) {
+		for (int room = 1; room < static_cast<int>(hidden.size()); room++) {
+			if (hidden[room] == cardsHidden[room]) {
+				continue;
+			}
+			cardsHidden[room] = hidden[room];
+			for (uint32_t i = scene.roomFirst[room]; i < scene.roomFirst[room + 1]; i++) {
+				if (scene.instances.card[i]) {
+					transforms.setPosition(i, instancePosition(i));
+				}
+			}
+		}
+	}
 
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers_Frames, offsets_Frames);
+	void updateUniformBuffer(uint32_t currentImage) {
 
-		vkCmdBindIndexBuffer(commandBuffer, M_Frame.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
+		// The camera and the cards as of the last tick of the simulation.
+		// The camera is interpolated, or with --late-latch extrapolated and
+		// written again by latchFrame()
+		simulation.update();
+		const SimulationState &S = simulation.readSlot();
+		applyCards(S.cardsHidden);
+		const CameraState camera = lateLatch ? latestCamera(S) : interpolatedCamera(S);
+		if (!lateLatch) {
+			frameInputTime = S.inputTime;
+		}
+		const glm::vec3 CamPos = camera.position;
 
+		globalUniformBufferObject gubo = cameraUniforms(camera);
 
-		// A R T //
+		// GLOBAL DESCRIPTOR SET
+		// Here is where you actually update your uniforms, copy the uniform buffer in the GPU memory.
+		// It's the only operation needed to update the values the Shaders will receive!
+		// The buffer stays mapped, and is coherent: no flush is needed
+		*globalUniforms[currentImage] = gubo;
 
-		// Frame
+		// Only the objects that moved, or that have not reached the
+		// uniform buffer of this image yet
+		updateTransforms();
+		uploadTransforms(currentImage);
 
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_ART.descriptorSets[currentImage],
-			0, nullptr);
 
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
+		////////////////////////// S T R E A M I N G //////////////////////////
 
-		// Card
+		if (streaming) {
+			streamTextures(floorPlan.roomAt(-CamPos.x, -CamPos.z));
+		}
 
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_ART_card.descriptorSets[currentImage],
-			0, nullptr);
 
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
+		////////////////////////// C U L L I N G //////////////////////////
 
+		// Pixels covered by one unit of length at distance one
+		const float pixelsPerUnit = swapChainExtent.height /
+									(2.0f * std::tan(glm::radians(CAMERA_FOV_Y) / 2.0f));
 
+		glm::vec3 eye(-CamPos.x, -CamPos.y, -CamPos.z);
+		if (gpuCulling) {
+			checkGpuCulling(currentImage, gubo.proj * gubo.view);
+			return;
+		}
+		selectImpostors(currentImage, eye, pixelsPerUnit);
+		cullDrawItems(gubo.proj * gubo.view, eye);
+		selectLods(eye, pixelsPerUnit);
+		cullClusters(gubo.proj * gubo.view, eye);
+	}
+};
 
-		// M A N E T //
+// This is the main: probably you do not need to touch this!
+// --check-occlusion and --check-transforms run the checks of the software
+// occlusion culling and of the transform kernels, --bench-bvh [objects] and
+// --bench-transforms [objects] measure them on random data; they all exit
+// without opening any window.
+// --scene <file> loads another scene description, --generate <rooms>
+// <paintings per wall> <statues> builds a museum of that size instead, and
+// --save-scene <file> writes the scene as JSON and exits.
+// --stream keeps only the textures of the rooms around the visitor resident.
+// --compact-vertices draws with 16-byte quantized vertices (shaders/compact_vert.spv).
+// --gpu-culling culls the instances in a compute shader (shaders/cull_comp.spv)
+// and draws them with vkCmdDrawIndexedIndirectCount; needs VK_KHR_draw_indirect_count.
+// --pacing latency|balanced|throughput picks the frames in flight and the
+// swapchain image count (see FramePacing), --frames-in-flight <1-3> and
+// --buffering <2|3> override them.
+// --present fifo|fifo-relaxed|mailbox|immediate picks the present mode
+// (mailbox by default) and --fps-limit <fps> caps the frame rate on the CPU.
+// --always-draw keeps drawing frames while nothing changes.
+// --late-latch samples the input again and writes the camera right before
+// the frame is submitted, instead of interpolating the simulation ticks.
+// --cook optimizes the meshes of the scene, saves them next to the .obj
+// files (<file>.obj.cooked, used from then on) with the impostor atlases
+// of the statues, and exits.
+int main(int argc, char *argv[]) {
+	if (argc > 1 && std::string(argv[1]) == "--check-occlusion") {
+		JobSystem jobs;
+		jobs.init(std::max(1u, std::thread::hardware_concurrency()));
+		bool ok = occlusionSelfCheck(jobs);
+		jobs.cleanup();
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-bvh") {
+		uint32_t objects = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 100000;
+		return bvhBenchmark(objects) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--check-transforms") {
+		return transformSelfCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench-transforms") {
+		uint32_t objects = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 100000;
+		return transformBenchmark(objects) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
-		// Frame
+	MuseumProject app;
+	std::string saveFile;
+	bool cook = false;
+	std::string pacingProfile, presentMode;
+	int framesInFlight = 0, buffering = 0;
+	float fpsLimit = 0.0f;
+	bool alwaysDraw = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--scene" && i + 1 < argc) {
+			app.sceneFile = argv[++i];
+		} else if (arg == "--generate" && i + 3 < argc) {
+			app.generated.rooms = std::atoi(argv[++i]);
+			app.generated.paintingsPerWall = std::atoi(argv[++i]);
+			app.generated.statues = std::atoi(argv[++i]);
+		} else if (arg == "--save-scene" && i + 1 < argc) {
+			saveFile = argv[++i];
+		} else if (arg == "--stream") {
+			app.streaming = true;
+		} else if (arg == "--compact-vertices") {
+			app.vertexFormat = VERTEX_COMPACT;
+		} else if (arg == "--gpu-culling") {
+			app.gpuCulling = true;
+		} else if (arg == "--pacing" && i + 1 < argc) {
+			pacingProfile = argv[++i];
+		} else if (arg == "--frames-in-flight" && i + 1 < argc) {
+			framesInFlight = std::atoi(argv[++i]);
+		} else if (arg == "--buffering" && i + 1 < argc) {
+			buffering = std::atoi(argv[++i]);
+		} else if (arg == "--present" && i + 1 < argc) {
+			presentMode = argv[++i];
+		} else if (arg == "--fps-limit" && i + 1 < argc) {
+			fpsLimit = static_cast<float>(std::atof(argv[++i]));
+		} else if (arg == "--always-draw") {
+			alwaysDraw = true;
+		} else if (arg == "--late-latch") {
+			app.lateLatch = true;
+		} else if (arg == "--cook") {
+			cook = true;
+		}
+	}
 
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_manet.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_manet_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// M A T I S S E //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_matisse.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_matisse_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// M O N E T //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_monet.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_monet_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// M U N C H //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_munch.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_munch_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// P I C A S S O //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_picasso.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_picasso_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// P I S A R R O //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_pisarro.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_pisarro_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// S E U R A T //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_seurat.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_seurat_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// V A N  G O G H   S T A R //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_vgstar.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_vgstar_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// V A N  G O G H   S E L F //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_vgself.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_vgself_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-
-		// C E Z A N N E //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_cezanne.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_cezanne_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// V O L P E D O //
-
-		// Frame
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_volpedo.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_volpedo_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// A M O N G  U S //
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Amogus_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		// S U Z A N N E //
-
-		// Card
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Suzanne_card.descriptorSets[currentImage],
-			0, nullptr);
-
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Frame.indices.size()), 1, 0, 0, 0);
-
-		//////////////////////////////////////// S T A T U E S ///////////////////////////////////////////
-
-		// A M O N G  U S //
-
-		VkBuffer vertexBuffers_Amogus[] = { M_Amogus.vertexBuffer };
-		VkDeviceSize offsets_Amogus[] = { 0 };
-
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers_Amogus, offsets_Amogus);
-
-		vkCmdBindIndexBuffer(commandBuffer, M_Amogus.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Amogus.descriptorSets[currentImage],
-			0, nullptr);
-
-		// property .indices.size() of models, contains the number of triangles * 3 of the mesh.
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Amogus.indices.size()), 1, 0, 0, 0);
-
-		// S U Z A N N E //
-
-		VkBuffer vertexBuffers_Suzanne[] = { M_Suzanne.vertexBuffer };
-		VkDeviceSize offsets_Suzanne[] = { 0 };
-
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers_Suzanne, offsets_Suzanne);
-
-		vkCmdBindIndexBuffer(commandBuffer, M_Suzanne.indexBuffer, 0,
-			VK_INDEX_TYPE_UINT32);
-
-		vkCmdBindDescriptorSets(commandBuffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			P1.pipelineLayout, 1, 1, &DS_Suzanne.descriptorSets[currentImage],
-			0, nullptr);
-
-		// property .indices.size() of models, contains the number of triangles * 3 of the mesh.
-		vkCmdDrawIndexed(commandBuffer,
-			static_cast<uint32_t>(M_Suzanne.indices.size()), 1, 0, 0, 0);
-	}
-
-	// Here is where you update the uniforms. Useful to move objects or change the camera.
-	// Very likely this will be where you will be writing the logic of your application.
-	// Here we put all the code that interacts with the user
-	void updateUniformBuffer(uint32_t currentImage) {
-
-		// start up timing inside the program
-		static auto startTime = std::chrono::high_resolution_clock::now();
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float time = std::chrono::duration<float, std::chrono::seconds::period>
-			(currentTime - startTime).count();
-
-		static struct CameraAngle {
-			float x = 0.0f;
-			float y = -90.0f;
-			float z = 0.0f;
-		} CamAngle;
-
-		static struct CameraPosition {
-			float x = -4.5f;
-			float y = -0.5f;
-			float z = 1.0f;
-		} CamPos;
-
-		static bool show_cards = 1;
-		static bool pressed = 0;
-
-		static bool card_1 = 1;
-		static bool card_2 = 1;
-		static bool card_3 = 1;
-		static bool card_4 = 1;
-		static bool card_5 = 1;
-		static bool card_6 = 1;
-		static bool card_7 = 1;
-		static bool card_8 = 1;
-
-		/*
-		const float W_speed = 0.003;
-		const float S_speed = 0.0009;
-
-		const float A_speed = 0.0014;
-		const float D_speed = 0.0014;
-
-		const float rot_speed_v = 0.05; // vertical rotation
-		const float rot_speed_h = 0.09; // horizontal rotation
-		*/
-
-		
-		const float W_speed = 0.015, S_speed = 0.015, A_speed = 0.015, D_speed = 0.015;
-		// vertical rotation and horizontal rotation
-		const float rot_speed_v = 1.2, rot_speed_h = 1.2;
-		
-
-		glm::mat4 one_mat = glm::mat4(1.0f);
-
-		static glm::vec3 Translation = glm::vec3(0.0f, 0.0f, 0.0f);
-
-		////////////////////////// C O N T R O L S //////////////////////////
-
-		// Movement controls depend on the Camera angle
-
-		if (glfwGetKey(window, GLFW_KEY_W)) {
-			CamPos.x -= W_speed * sin(glm::radians(CamAngle.y));
-			CamPos.z += W_speed * cos(glm::radians(CamAngle.y));
-		}
-		if (glfwGetKey(window, GLFW_KEY_A)) {
-			CamPos.z += A_speed * sin(glm::radians(CamAngle.y));
-			CamPos.x += A_speed * cos(glm::radians(CamAngle.y));
-		}
-		if (glfwGetKey(window, GLFW_KEY_D)) {
-			CamPos.z -= D_speed * sin(glm::radians(CamAngle.y));
-			CamPos.x -= D_speed * cos(glm::radians(CamAngle.y));
-		}
-		if (glfwGetKey(window, GLFW_KEY_S)) {
-			CamPos.x += S_speed * sin(glm::radians(CamAngle.y));
-			CamPos.z -= S_speed * cos(glm::radians(CamAngle.y));
-		}
-
-		if (glfwGetKey(window, GLFW_KEY_UP) && CamAngle.x > -45.0f) {
-			CamAngle.x -= rot_speed_v;
-		}
-		if (glfwGetKey(window, GLFW_KEY_LEFT)) {
-			CamAngle.y -= rot_speed_h;
-		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT)) {
-			CamAngle.y += rot_speed_h;
-		}
-		if (glfwGetKey(window, GLFW_KEY_DOWN) && CamAngle.x < 45.0f) {
-			CamAngle.x += rot_speed_v;
-		}
-
-		// State of the Frame Cards 
-		if (glfwGetKey(window, GLFW_KEY_SPACE) && pressed == 0) {
-
-			// Cards will pop up, depending on the room
-
-			if (GetRoom(CamPos.x, CamPos.z) == 1)
-				card_1 = !card_1;
-			else if (GetRoom(CamPos.x, CamPos.z) == 2)
-				card_2 = !card_2;
-			else if (GetRoom(CamPos.x, CamPos.z) == 3)
-				card_3 = !card_3;
-			else if (GetRoom(CamPos.x, CamPos.z) == 4)
-				card_4 = !card_4;
-			else if (GetRoom(CamPos.x, CamPos.z) == 5)
-				card_5 = !card_5;
-			else if (GetRoom(CamPos.x, CamPos.z) == 6)
-				card_6 = !card_6;
-			else if (GetRoom(CamPos.x, CamPos.z) == 7)
-				card_7 = !card_7;
-			else if (GetRoom(CamPos.x, CamPos.z) == 8)
-				card_8 = !card_8;
-
-			pressed = 1;
-
-			// Check so that it will not change state all thee time while keeping SPACE pressed
-		}
-		else if (!glfwGetKey(window, GLFW_KEY_SPACE) && pressed == 1) {
-			pressed = 0;
-		}
-
-		globalUniformBufferObject gubo{};
-		UniformBufferObject ubo{};
-		void* data;
-
-		// look-in-direction matrix, first person model, to implement what is seen by the camera
-
-		gubo.view = glm::rotate(glm::mat4(1.0f), glm::radians(CamAngle.x), glm::vec3(1, 0, 0)) *
-			glm::rotate(glm::mat4(1.0f), glm::radians(CamAngle.y), glm::vec3(0, 1, 0)) *
-			glm::rotate(glm::mat4(1.0f), glm::radians(CamAngle.z), glm::vec3(0, 0, 1)) *
-			glm::translate(glm::mat4(1), glm::vec3(CamPos.x, CamPos.y, CamPos.z));
-
-		gubo.proj = glm::perspective(glm::radians(45.0f),
-			swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
-
-		gubo.proj[1][1] *= -1;
-
-		// GLOBAL DESCRIPTOR SET
-		// Here is where you actually update your uniforms, copy the uniform buffer in the GPU memory.
-		// It's the only operation needed to update the values the Shaders will receive!
-		// 
-		// Acquiring a pointer to a memory area where the CPU can write data
-		vkMapMemory(device, DS_Global.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(gubo), 0, &data);
-		// Filling that memory area with the new values
-		memcpy(data, &gubo, sizeof(gubo));
-		// Trigger the update of the video memory
-		vkUnmapMemory(device, DS_Global.uniformBuffersMemory[0][currentImage]);
-
-		// Placing Floor
-
-		ubo.model = one_mat;
-
-		vkMapMemory(device, DS_Floor.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_Floor.uniformBuffersMemory[0][currentImage]);
-
-		// Placing Walls
-
-		ubo.model = one_mat;
-
-		vkMapMemory(device, DS_Walls.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_Walls.uniformBuffersMemory[0][currentImage]);
-
-
-		////////////////////////// S T A T U E S //////////////////////////
-
-		// A M O N G  U S //
-
-		// Statue
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(2.6f, 0.03f, -0.3f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_Amogus.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_Amogus.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(2.6f, (1.05 + 5 * card_8), -0.01f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_Amogus_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_Amogus_card.uniformBuffersMemory[0][currentImage]);
-
-		// S U Z A N N E //
-
-		// Statue
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-2.6f, 0.3f, -0.25f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.3, 0.3, 0.3));
-
-		vkMapMemory(device, DS_Suzanne.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_Suzanne.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-2.6f, (1.0 + 5 * card_5), -0.01f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_Suzanne_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_Suzanne_card.uniformBuffersMemory[0][currentImage]);
-
-		////////////////////////// P I C T U R E S //////////////////////////
-
-		// A R T //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 1.0f, 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_ART.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_ART.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		// For the card positions, the Y coordinate is given by "0.35 + 5 * show_cards", so that if show_cards is 0 they teleport to 0.35, if it is 1 they are translated much further away
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, (0.35 + 5 * card_1), 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_ART_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_ART_card.uniformBuffersMemory[0][currentImage]);
-
-
-
-		// M A N E T //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, 1.0f, -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_manet.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_manet.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f, (0.35 + 5 * card_5), -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_manet_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_manet_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// M A T I S S E // 
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 1.0f, 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_matisse.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_matisse.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, (0.35 + 5 * card_2), 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_matisse_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_matisse_card.uniformBuffersMemory[0][currentImage]);
-
-		// M O N E T //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 1.0f, -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_monet.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_monet.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, (0.35 + 5 * card_6), -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_monet_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_monet_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// M U N C H //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.18, 0.4, 0.4));
-
-		vkMapMemory(device, DS_munch.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_munch.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, (0.35 + 5 * card_3), 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_munch_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_munch_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// P I C A S S O //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_picasso.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_picasso.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, (0.35 + 5 * card_7), -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_picasso_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_picasso_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// P I S A R R O //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(3.2f, 1.0f, 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_pisarro.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_pisarro.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, (0.35 + 5 * card_4), 1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_pisarro_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_pisarro_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// S E U R A T //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 1.0f, -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_seurat.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_seurat.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, (0.35 + 5 * card_8), -1.99f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_seurat_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_seurat_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// V A N  G O G H  S T A R R Y //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 1.0f, -0.02f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_vgstar.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_vgstar.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, (0.35 + 5 * card_6), -0.02f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_vgstar_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_vgstar_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// V A N  G O G H  S E L F //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -0.02f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.18, 0.4, 0.2));
-
-		vkMapMemory(device, DS_vgself.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_vgself.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, (0.35 + 5 * card_7), -0.02f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_vgself_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_vgself_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// C E Z A N N E //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 1.0f, 0.1f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_cezanne.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_cezanne.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, (0.35 + 5 * card_2), 0.1f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_cezanne_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_cezanne_card.uniformBuffersMemory[0][currentImage]);
-
-
-		// V O L P E D O //
-
-		// Frame
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, 0.1f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.4, 0.4, 0.4));
-
-		vkMapMemory(device, DS_volpedo.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_volpedo.uniformBuffersMemory[0][currentImage]);
-
-		// Card
-
-		ubo.model = one_mat * glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, (0.35 + 5 * card_3), 0.1f));
-		ubo.model = ubo.model * glm::rotate(glm::mat4(1.0), glm::radians(0.0f), glm::vec3(0, 1, 0)) * glm::scale(one_mat, glm::vec3(0.1, 0.1, 0.1));
-
-		vkMapMemory(device, DS_volpedo_card.uniformBuffersMemory[0][currentImage], 0,
-			sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(device, DS_volpedo_card.uniformBuffersMemory[0][currentImage]);
-
-	}
-};
-
-int GetRoom(float X, float Z) {
-
-	X = -X;
-
-	if (Z < 0.0f) {
-
-		if ((-4.0f < X) && (X < -2.0f)) {
-			return 1;
-		}
-		else if ((-2.0f < X) && (X < 0.0f)) {
-			return 2;
-		}
-		else if ((0.0f < X) && (X < 2.0f)) {
-			return 3;
-		}
-		else if ((2.0f < X) && (X < 4.0f)) {
-			return 4;
-		}
-	}
-
-	else if (Z > 0.0f) {
-
-		if ((-4.0f < X) && (X < -2.0f)) {
-			return 5;
-		}
-		else if ((-2.0f < X) && (X < 0.0f)) {
-			return 6;
-		}
-		else if ((0.0f < X) && (X < 2.0f)) {
-			return 7;
-		}
-		else if ((2.0f < X) && (X < 4.0f)) {
-			return 8;
-		}
-	}
-}
-
-// This is the main: probably you do not need to touch this!
-int main() {
-	MuseumProject app;
-
-	try {
-		app.run();
-	}
-	catch (const std::exception& e) {
-		std::cerr << e.what() << std::endl;
-		return EXIT_FAILURE;
-	}
+	try {
+		if (!pacingProfile.empty()) {
+			app.pacing = framePacingProfile(pacingProfile);
+		}
+		if (framesInFlight > 0) {
+			app.pacing.framesInFlight = framesInFlight;
+		}
+		if (buffering > 0) {
+			app.pacing.swapchainImages = static_cast<uint32_t>(buffering);
+		}
+		if (!presentMode.empty()) {
+			app.pacing.presentMode = presentModeFromName(presentMode);
+		}
+		app.pacing.fpsLimit = std::max(fpsLimit, 0.0f);
+		if (alwaysDraw) {
+			app.pacing.skipIdleFrames = false;
+		}
+		if (cook) {
+			Scene scene;
+			scene.load(app.sceneFile);
+			for (const std::string &file : scene.meshFiles) {
+				Model M;
+				M.loadObj(file);
+				M.optimize(file);
+				M.saveCooked(file + ".cooked");
+			}
+			const SceneInstances &I = scene.instances;
+			std::vector<std::pair<uint32_t, uint32_t>> baked;
+			for (size_t i = 0; i < I.size(); i++) {
+				std::pair<uint32_t, uint32_t> key(I.mesh[i], I.texture[i]);
+				if (!I.statue[i] || std::find(baked.begin(), baked.end(), key) != baked.end()) {
+					continue;
+				}
+				baked.push_back(key);
+				Model M;
+				M.loadModel(scene.meshFiles[key.first]);
+				ImpostorAtlas atlas;
+				atlas.bake(M, scene.textureFiles[key.second]);
+				atlas.save(impostorFile(scene.meshFiles[key.first], scene.textureNames[key.second]));
+			}
+			return EXIT_SUCCESS;
+		}
+		if (!saveFile.empty()) {
+			Scene scene;
+			if (app.generated.rooms > 0) {
+				generateMuseum(scene, app.generated.rooms, app.generated.paintingsPerWall,
+							   app.generated.statues);
+			} else {
+				scene.load(app.sceneFile);
+			}
+			scene.save(saveFile);
+			std::cout << "scene: " << scene.instances.size() << " instances in "
+					  << scene.rooms.size() << " rooms saved to " << saveFile << "\n";
+			return EXIT_SUCCESS;
+		}
+		app.run();
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
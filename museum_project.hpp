@@ -14,25 +14,113 @@
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <unordered_map>
+#include <deque>
+#include <filesystem>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <chrono>
 
+#include "job_system.hpp"
+#include "culling.hpp"
+#include "portals.hpp"
+#include "occlusion.hpp"
+#include "bvh.hpp"
+#include "transforms.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+#include "meshlets.hpp"
+#include "frame_pacing.hpp"
+
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
 // New in Lesson 23 - to load images
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+// to save the impostor atlases baked by --cook
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 
 //
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+// Upper bound for FramePacing::framesInFlight
+const int MAX_FRAMES_IN_FLIGHT = 3;
+
+// Waits on the GPU longer than this (in ns) are treated as a device hang
+const uint64_t GPU_WAIT_TIMEOUT = 5000000000ull;
+// The latency probe thread checks for quit at least this often (in ns)
+const uint64_t LATENCY_PROBE_POLL = 100000000ull;
+
+// While idle, mainLoop sleeps in glfwWaitEventsTimeout() for at most this
+// long (in seconds) before checking the scene again; input wakes it at once
+const double IDLE_WAIT_TIMEOUT = 0.25;
+// Frames still drawn after the last change, for the state carried over
+// from the previous frames (level of detail hysteresis, GPU culling check)
+const int IDLE_SETTLE_FRAMES = 2;
+
+// Upper bound for the threads recording secondary command buffers
+const int MAX_RECORDING_THREADS = 8;
+
+// Latency / throughput trade-off of the frame loop. Each frame in flight
+// has its own command buffers, uniform and storage buffers and descriptor
+// sets: with more of them the CPU records further ahead of the GPU, which
+// smooths out hitches at the cost of input latency. The swapchain image
+// count is a request, clamped to what the surface supports. FIFO is used
+// if the surface does not support presentMode. With skipIdleFrames, no
+// frame is drawn while the image would not change (see sceneActive()).
+struct FramePacing {
+	int framesInFlight = 2;
+	uint32_t swapchainImages = 3;	// 2 for double buffering, 3 for triple
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+	float fpsLimit = 0.0f;			// 0 for no limit
+	bool skipIdleFrames = true;
+};
+
+// latency: the input is at most one frame old when it is drawn (touch
+// kiosks); throughput: the GPU never starves (video capture)
+inline FramePacing framePacingProfile(const std::string &name) {
+	if (name == "latency") {
+		return { 1, 2 };
+	} else if (name == "balanced") {
+		return { 2, 3 };
+	} else if (name == "throughput") {
+		return { 3, 3 };
+	}
+	throw std::runtime_error("unknown frame pacing profile " + name + "!");
+}
+
+// fifo waits for the vertical blank, fifo-relaxed tears when a frame is
+// late, mailbox replaces the queued image (no tearing, the GPU runs
+// unthrottled), immediate tears
+inline VkPresentModeKHR presentModeFromName(const std::string &name) {
+	if (name == "fifo") {
+		return VK_PRESENT_MODE_FIFO_KHR;
+	} else if (name == "fifo-relaxed") {
+		return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+	} else if (name == "mailbox") {
+		return VK_PRESENT_MODE_MAILBOX_KHR;
+	} else if (name == "immediate") {
+		return VK_PRESENT_MODE_IMMEDIATE_KHR;
+	}
+	throw std::runtime_error("unknown present mode " + name + "!");
+}
+
+inline const char *presentModeName(VkPresentModeKHR mode) {
+	switch (mode) {
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		default: return "other";
+	}
+}
 
 // Lesson 22.0
 const std::vector<const char*> validationLayers = {
@@ -83,11 +171,111 @@ struct Vertex {
 	}
 };
 
+// Used to merge the identical corners of the faces of a mesh
+inline bool operator==(const Vertex &a, const Vertex &b) {
+	return a.pos == b.pos && a.norm == b.norm && a.texCoord == b.texCoord;
+}
+
+struct VertexHash {
+	size_t operator()(const Vertex &v) const {
+		const float f[8] = { v.pos.x, v.pos.y, v.pos.z, v.norm.x, v.norm.y, v.norm.z,
+							 v.texCoord.x, v.texCoord.y };
+		size_t h = 0;
+		for (float x : f) {
+			h ^= std::hash<float>()(x) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		}
+		return h;
+	}
+};
+
+// Compact vertex format, 16 bytes instead of 32 (see shaders/shader_compact.vert):
+// the position quantized to 16 bits inside the AABB of the mesh, the normal
+// octahedral-encoded in 2 x 16 bits and the texture coordinates as half floats
+struct CompactVertex {
+	uint16_t pos[4];		// w is padding
+	int16_t norm[2];
+	uint16_t texCoord[2];
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(CompactVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 3>
+						getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 3>
+						attributeDescriptions{};
+
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attributeDescriptions[0].offset = offsetof(CompactVertex, pos);
+
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[1].offset = offsetof(CompactVertex, norm);
+
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(CompactVertex, texCoord);
+
+		return attributeDescriptions;
+	}
+};
+
+// Pushed once per mesh: position = offset + UNORM position * scale
+struct CompactVertexDecode {
+	alignas(16) glm::vec4 scale;
+	alignas(16) glm::vec4 offset;
+};
+
+// Pushed once per impostor draw: the model space square the views were
+// baked in (center, half size) and the atlas cell of the chosen view
+struct ImpostorDraw {
+	alignas(16) glm::vec4 frame;
+	alignas(16) glm::vec4 cell;		// u, v, width, height
+};
+
+// VERTEX_IMPOSTOR has no vertex buffer: the shader builds a quad from
+// gl_VertexIndex and ImpostorDraw
+enum VertexFormat { VERTEX_FULL, VERTEX_COMPACT, VERTEX_IMPOSTOR };
+
+// Unit vector to a point of the [-1, 1] square, folding the lower
+// hemisphere of the octahedron over the upper one
+inline glm::vec2 octahedralEncode(glm::vec3 n) {
+	n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	glm::vec2 e(n.x, n.y);
+	if (n.z < 0.0f) {
+		e = (1.0f - glm::abs(glm::vec2(n.y, n.x))) *
+			glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+inline glm::vec3 octahedralDecode(glm::vec2 e) {
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+
 
 // Lesson 13
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// A family with transfers only (the DMA engines), if the device has one
+	std::optional<uint32_t> transferFamily;
+	// A compute family without graphics, running next to the graphics queue
+	std::optional<uint32_t> computeFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() &&
@@ -178,19 +366,64 @@ void PrintVkError( VkResult result ) {
 class BaseProject;
 
 struct Model {
+	// A range of indices drawn with its own vertex offset, so that every
+	// index fits in 16 bits
+	struct Submesh {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		int32_t vertexOffset;
+	};
+	static constexpr size_t MAX_SUBMESH_VERTICES = 65536;
+
+	// Level of detail: a simplified copy of the triangles, with the
+	// distance from the full detail surface in model units
+	struct Lod {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t firstSubmesh;
+		uint32_t submeshCount;
+		float error;
+		uint32_t firstMeshlet = 0;
+		uint32_t meshletCount = 0;
+	};
+	// Each level has about half the triangles of the previous one
+	static constexpr size_t MAX_LOD_COUNT = 6;
+	static constexpr size_t MIN_LOD_TRIANGLES = 64;
+
 	BaseProject *BP;
 	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	std::vector<uint32_t> indices;		// into vertices, whatever the submesh
+	std::vector<Lod> lods;				// lods[0] is the full detail mesh
+	std::vector<Submesh> submeshes;
+	std::vector<Meshlet> meshlets;		// of every LOD, see meshlets.hpp
+	VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+	VertexFormat format = VERTEX_FULL;
+	CompactVertexDecode decode;		// only for VERTEX_COMPACT
 	VkBuffer vertexBuffer;
 	VkDeviceMemory vertexBufferMemory;
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
+
+	// Bounding volumes in model space, computed at load time
+	glm::vec3 aabbMin, aabbMax;
+	glm::vec3 sphereCenter;
+	float sphereRadius;
 	
 	void loadModel(std::string file);
+	void loadObj(const std::string &file);
+	void optimize(const std::string &name);
+	void generateLods(const std::vector<glm::vec3> &positions);
+	// Meshes cooked with --cook: already deduplicated and optimized
+	bool loadCooked(const std::string &file);
+	void saveCooked(const std::string &file) const;
+	void computeBounds();
+	void buildSubmeshes();
+	void buildMeshlets();
+	void compactVertices(std::vector<CompactVertex> &out);
 	void createIndexBuffer();
 	void createVertexBuffer();
 
-	void init(BaseProject *bp, std::string file);
+	void init(BaseProject *bp, std::string file, VertexFormat vertexFormat = VERTEX_FULL);
 	void cleanup();
 };
 
@@ -201,12 +434,20 @@ struct Texture {
 	VkDeviceMemory textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;	// UNORM for data that is not a color
+	// The pixels are copied in the background: the texture can be drawn
+	// once BP->uploads.ready(upload)
+	uint64_t upload = 0;
 	
 	void createTextureImage(std::string file);
+	void createTextureImage(const stbi_uc *pixels, int texWidth, int texHeight);
 	void createTextureImageView();
 	void createTextureSampler();
 
 	void init(BaseProject *bp, std::string file);
+	// From RGBA pixels already decoded (e.g. on another thread)
+	void init(BaseProject *bp, const stbi_uc *pixels, int width, int height,
+			  VkFormat imageFormat = VK_FORMAT_R8G8B8A8_SRGB);
 	void cleanup();
 };
 
@@ -231,19 +472,68 @@ struct Pipeline {
   	VkPipelineLayout pipelineLayout;
   	
   	void init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
-  			  std::vector<DescriptorSetLayout *> D);
+  			  std::vector<DescriptorSetLayout *> D, VertexFormat format = VERTEX_FULL);
   	VkShaderModule createShaderModule(const std::vector<char>& code);
   	static std::vector<char> readFile(const std::string& filename);  	
 	void cleanup();
 };
 
-enum DescriptorSetElementType {UNIFORM, TEXTURE};
+// Compute shader with its layout; push constants, if any, are visible to
+// the compute stage only
+struct ComputePipeline {
+	BaseProject *BP;
+	VkPipeline computePipeline;
+	VkPipelineLayout pipelineLayout;
+
+	void init(BaseProject *bp, const std::string& Shader,
+			  std::vector<DescriptorSetLayout *> D, uint32_t pushConstantSize = 0);
+	void cleanup();
+};
+
+// DYNAMIC_UNIFORM elements point to a UniformArena: the object to use is
+// selected with a dynamic offset when the set is bound.
+// STORAGE elements point to a StorageBuffer, bound as a whole.
+enum DescriptorSetElementType {UNIFORM, TEXTURE, DYNAMIC_UNIFORM, STORAGE};
+
+struct UniformArena;
+struct StorageBuffer;
 
 struct DescriptorSetElement {
 	int binding;
 	DescriptorSetElementType type;
 	int size;
 	Texture *tex;
+	UniformArena *arena = nullptr;
+	StorageBuffer *storage = nullptr;
+};
+
+// Per-thread command pool of a frame in flight, used to record secondary
+// command buffers. Pools are reset as a whole once per frame, and the
+// buffers allocated from them are recycled through the "used" counter.
+struct RecordingContext {
+	VkCommandPool pool;
+	std::vector<VkCommandBuffer> buffers;
+	size_t used;
+};
+
+// Counters of the last rendered frame, filled by the application.
+// They are printed on the console once per second, toggled with F1.
+struct RenderStats {
+	uint32_t drawsVisible = 0;
+	uint32_t drawsCulled = 0;		// outside the view frustum
+	uint32_t drawsHidden = 0;		// in rooms not visible through the doorways
+	uint32_t drawsOccluded = 0;		// behind the walls
+	uint32_t roomsVisible = 0;
+	uint32_t transformsUpdated = 0;	// world matrices recomputed
+	uint32_t transformsUploaded = 0;	// world matrices copied to the uniform buffers
+	uint32_t drawsNotLoaded = 0;	// texture still streaming in
+	uint32_t trianglesDrawn = 0;	// at the selected levels of detail
+	uint32_t clustersCulled = 0;	// meshlets off screen or facing away
+	uint32_t impostorsDrawn = 0;	// statues drawn as a quad, or fading into one
+	uint32_t texturesResident = 0;
+	// Frames whose culling on the GPU, read back once the frame is done,
+	// kept other instances than the same test on the CPU
+	uint32_t gpuCullingMismatches = 0;
 };
 
 struct DescriptorSet {
@@ -260,6 +550,165 @@ struct DescriptorSet {
 	void cleanup();
 };
 
+// Uniform blocks of all the objects, one buffer per frame in flight kept
+// mapped for the whole run. Elements are aligned to the device's
+// minUniformBufferOffsetAlignment, so they can be used as dynamic offsets.
+struct UniformArena {
+	BaseProject *BP;
+	VkDeviceSize stride;
+	uint32_t capacity;
+	std::vector<VkBuffer> buffers;
+	std::vector<VkDeviceMemory> buffersMemory;
+	std::vector<char *> mapped;
+
+	void init(BaseProject *bp, VkDeviceSize elementSize, uint32_t count);
+	void *element(uint32_t currentImage, uint32_t index) {
+		return mapped[currentImage] + stride * index;
+	}
+	uint32_t offset(uint32_t index) const {
+		return static_cast<uint32_t>(stride * index);
+	}
+	void cleanup();
+};
+
+// Buffer for shader storage, one copy per frame in flight. Host visible
+// copies stay mapped (written by the CPU, or read back once the frame
+// that used them is done), the others are only touched by the GPU.
+struct StorageBuffer {
+	BaseProject *BP;
+	VkDeviceSize size;
+	std::vector<VkBuffer> buffers;
+	std::vector<VkDeviceMemory> buffersMemory;
+	std::vector<char *> mapped;
+
+	void init(BaseProject *bp, VkDeviceSize bufferSize, VkBufferUsageFlags usage,
+			  bool hostVisible);
+	void cleanup();
+};
+
+// Copies data to device local buffers and images through staging buffers,
+// on the transfer-only queue family when the device has one. The copies
+// run while the frames are drawn: the resources are then released by the
+// transfer family and acquired by the graphics one (which also generates
+// the mipmaps, blits need a graphics queue). Every copy sets the copied
+// timeline semaphore to its ticket, and the acquire waits on that value.
+// Nothing blocks the CPU: poll(), once per frame, submits the acquires of
+// the copies that are done. The staging buffers are freed when the frame
+// timeline shows that the frame submitted after the acquire is complete.
+// Without a transfer family everything is recorded on the graphics queue,
+// with no ownership transfer.
+struct UploadQueue {
+	BaseProject *BP;
+	VkQueue queue;
+	VkCommandPool pool;
+	uint32_t family;
+	bool separateFamily;
+	uint32_t graphicsFamily;
+	uint64_t nextTicket = 1;
+	VkSemaphore copied = VK_NULL_HANDLE;
+
+	struct Upload {
+		uint64_t ticket;
+		VkBuffer staging;
+		VkDeviceMemory stagingMemory;
+		VkCommandBuffer copyCommands;
+		VkCommandBuffer acquireCommands = VK_NULL_HANDLE;
+		// Visible to the command buffers submitted to the graphics queue from now on
+		bool ready = false;
+		// Value of the frame timeline after which the GPU is done with it
+		uint64_t doneFrame = 0;
+
+		// Destination: a buffer, read at dstStage with dstAccess...
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkAccessFlags dstAccess = 0;
+		VkPipelineStageFlags dstStage = 0;
+		// ...or the image of a texture
+		Texture *texture = nullptr;
+		int width = 0, height = 0;
+	};
+	std::vector<Upload> pending;
+
+	void init(BaseProject *bp);
+	// Both return a ticket, see ready()
+	uint64_t uploadBuffer(VkBuffer buffer, const void *data, VkDeviceSize size,
+						  VkAccessFlags dstAccess, VkPipelineStageFlags dstStage);
+	uint64_t uploadTexture(Texture &T, const void *pixels, int width, int height);
+	bool ready(uint64_t ticket) const;
+	void poll();
+	// Waits for the copies and submits all the acquires, e.g. before the first frame
+	void finish();
+	// Once the device is idle
+	void cleanup();
+
+	Upload &stage(const void *data, VkDeviceSize size);
+	void submit(Upload &U);
+	void retire(Upload &U);
+	void recordRelease(VkCommandBuffer commandBuffer, const Upload &U);
+	void recordAcquire(VkCommandBuffer commandBuffer, const Upload &U);
+};
+
+// Compute work of a frame, recorded in its own command buffer (one per
+// frame in flight) between begin() and submit(), and submitted to the
+// async compute queue, so it can overlap with the rasterization of the
+// previous frame. Without a compute-only family it goes to the graphics
+// queue. The draws of the frame wait for it on finished[frame], at the
+// consumerStages; the buffers shared with the draws are created with
+// createBuffer(..., shared = true), so no ownership transfer is needed.
+struct ComputePass {
+	BaseProject *BP;
+	VkQueue queue;
+	VkCommandPool pool;
+	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<VkSemaphore> finished;
+	VkPipelineStageFlags consumerStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+	VkCommandBuffer current = VK_NULL_HANDLE;
+
+	void init(BaseProject *bp);
+	void begin(int currentImage);
+	void dispatch(ComputePipeline &P, DescriptorSet &DS, int currentImage,
+				  const void *pushConstants, uint32_t pushConstantSize,
+				  uint32_t groupsX, uint32_t groupsY = 1, uint32_t groupsZ = 1);
+	void fillBuffer(VkBuffer buffer, uint32_t value);
+	void bufferBarrier(const std::vector<VkBuffer> &buffers,
+					   VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+					   VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
+	void imageBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+					  uint32_t mipLevels, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+					  VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
+	void submit(int currentImage);
+	void cleanup();
+};
+
+// Input to GPU latency: for every frame submitted, the time its input was
+// sampled, stamped again by a thread waiting on the frame timeline when
+// the GPU completes the frame. The scanout that follows is not included
+// (present timing is not queried), so on FIFO up to one refresh more
+// reaches the screen.
+struct FrameLatencyProbe {
+	using Clock = std::chrono::steady_clock;
+
+	BaseProject *BP;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::deque<std::pair<uint64_t, Clock::time_point>> frames;	// timeline value, input time
+	FrameTimes latencies;
+	bool quit = false;
+
+	~FrameLatencyProbe() { cleanup(); }
+
+	void init(BaseProject *bp);
+	// Called after the frame that sets the frame timeline to value is submitted
+	void frameSubmitted(uint64_t value, Clock::time_point inputTime);
+	// Latencies of the frames completed since the last call, which are cleared
+	FrameTimes::Summary summarize();
+	void reset();
+	// Once the device is idle
+	void cleanup();
+
+	void workerLoop();
+};
+
 
 // MAIN ! 
 class BaseProject {
@@ -268,10 +717,23 @@ class BaseProject {
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend class UniformArena;
+	friend class StorageBuffer;
+	friend class ComputePipeline;
+	friend class UploadQueue;
+	friend class ComputePass;
+	friend class FrameLatencyProbe;
 public:
+	// Set before run()
+	FramePacing pacing;
+
 	virtual void setWindowParameters() = 0;
     void run() {
     	setWindowParameters();
+		if (pacing.framesInFlight < 1 || pacing.framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+			throw std::runtime_error("frames in flight must be between 1 and " +
+									 std::to_string(MAX_FRAMES_IN_FLIGHT) + "!");
+		}
         initWindow();
         initVulkan();
         mainLoop();
@@ -286,6 +748,23 @@ protected:
 	int uniformBlocksInPool;
 	int texturesInPool;
 	int setsInPool;
+	int dynamicUniformBlocksInPool = 0;
+	int storageBuffersInPool = 0;
+	// Lets DescriptorSet::cleanup() return its sets to the pool, for
+	// applications that create and destroy sets while running
+	bool freeableDescriptorSets = false;
+
+	// Frames submitted so far
+	uint64_t frameNumber = 0;
+
+	// Requires VK_KHR_draw_indirect_count, multiDrawIndirect and
+	// drawIndirectFirstInstance, for draws generated on the GPU
+	bool indirectDrawCount = false;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+	// Set to record populateComputePass() every frame
+	bool computePassEnabled = false;
+	ComputePass computePass;
 
 	// Lesson 12
     GLFWwindow* window;
@@ -298,8 +777,44 @@ protected:
     VkQueue graphicsQueue;
     VkQueue presentQueue;
 	VkCommandPool commandPool;
+	UploadQueue uploads;
+	VkQueue computeQueue;
+	// True if computeQueue has its own family (see ComputePass)
+	bool asyncCompute = false;
+	std::vector<uint32_t> sharedQueueFamilies;
 	std::vector<VkCommandBuffer> commandBuffers;
 
+	// Worker threads for the per-frame CPU work (culling, recording)
+	JobSystem frameJobs;
+	// Multithreaded recording: [frame in flight][thread]
+	std::vector<std::vector<RecordingContext>> recordingContexts;
+
+	// Frame statistics
+	RenderStats stats;
+	bool showStats = false;
+	bool statsKeyPressed = false;
+	int statsFrames = 0;
+	int statsFrameWaits = 0;		// frames that found their resources still in use
+	FrameLimiter frameLimiter;
+	FrameTimes frameTimes;
+	FrameLatencyProbe latencyProbe;
+	// When the input drawn by the current frame was sampled: set when the
+	// events are polled, moved by the application if it draws older input
+	// (or later, see latchFrame())
+	std::chrono::steady_clock::time_point frameInputTime;
+
+	// Idle detection: set by the GLFW callbacks on input, or when the
+	// window must be repainted
+	bool windowEvent = true;
+	int settleFrames = 0;
+	bool idle = false;
+	std::chrono::high_resolution_clock::time_point statsLastReport;
+
+	// Device memory allocated through createBuffer() / createImage() and
+	// not yet released with freeDeviceMemory()
+	std::unordered_map<VkDeviceMemory, VkDeviceSize> memoryAllocations;
+	VkDeviceSize deviceMemoryInUse = 0;
+
     // Lesson 14
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
@@ -326,10 +841,20 @@ protected:
 	size_t currentFrame = 0;
 
 	// L22.3 --- Synchronization objects
+	// Binary semaphores for the swapchain, per frame in flight
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
+	// Frame n sets frameTimeline to n + 1 once the GPU is done with it: its
+	// value is the number of frames completed, and anything last used by
+	// frame n can be reused or destroyed once it reaches n + 1
+	VkSemaphore frameTimeline;
+	PFN_vkWaitSemaphoresKHR vkWaitSemaphoresKHR = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR vkGetSemaphoreCounterValueKHR = nullptr;
+	// VK_KHR_get_physical_device_properties2, for the timeline semaphore feature
+	PFN_vkGetPhysicalDeviceFeatures2KHR vkGetPhysicalDeviceFeatures2KHR = nullptr;
+	// Version of the instance, at most 1.2: timeline semaphores are core
+	// from 1.2 on, and need VK_KHR_timeline_semaphore before
+	uint32_t apiVersion = VK_API_VERSION_1_0;
 	
 	// Lesson 12
     void initWindow() {
@@ -339,6 +864,17 @@ protected:
         glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
         window = glfwCreateWindow(windowWidth, windowHeight, windowTitle.c_str(), nullptr, nullptr);
+
+		glfwSetWindowUserPointer(window, this);
+		glfwSetKeyCallback(window, [](GLFWwindow *w, int, int, int, int) {
+			static_cast<BaseProject *>(glfwGetWindowUserPointer(w))->windowEvent = true;
+		});
+		glfwSetMouseButtonCallback(window, [](GLFWwindow *w, int, int, int) {
+			static_cast<BaseProject *>(glfwGetWindowUserPointer(w))->windowEvent = true;
+		});
+		glfwSetWindowRefreshCallback(window, [](GLFWwindow *w) {
+			static_cast<BaseProject *>(glfwGetWindowUserPointer(w))->windowEvent = true;
+		});
     }
 
 	virtual void localInit() = 0;
@@ -354,14 +890,21 @@ protected:
 		createImageViews();				// L15
 		createRenderPass();				// L19
 		createCommandPool();			// L13
+		createSyncObjects();			// L22.3, the uploads use the frame timeline
+		uploads.init(this);
+		latencyProbe.init(this);
+		if (computePassEnabled) {
+			computePass.init(this);
+		}
 		createDepthResources();			// L22.1
 		createFramebuffers();			// L22.2
 		createDescriptorPool();			// L21
 
 		localInit();
+		// The meshes and textures created so far are needed by the first frame
+		uploads.finish();
 
 		createCommandBuffers();			// L22.5 (13)
-		createSyncObjects();			// L22.3 
     }
 
 	// Lesson 12 and 22.0
@@ -372,7 +915,15 @@ protected:
     	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     	appInfo.pEngineName = "No Engine";
     	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion = VK_API_VERSION_1_0;
+		// 1.0 loaders have no vkEnumerateInstanceVersion
+		auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+				vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+		apiVersion = VK_API_VERSION_1_0;
+		if (enumerateInstanceVersion) {
+			enumerateInstanceVersion(&apiVersion);
+		}
+		apiVersion = std::min(apiVersion, VK_API_VERSION_1_2);
+		appInfo.apiVersion = apiVersion;
 		
 		VkInstanceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -413,6 +964,12 @@ protected:
 		 	PrintVkError(result);
 			throw std::runtime_error("failed to create instance!");
 		}
+
+		vkGetPhysicalDeviceFeatures2KHR = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+				vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+		if (!vkGetPhysicalDeviceFeatures2KHR) {
+			throw std::runtime_error("failed to load vkGetPhysicalDeviceFeatures2KHR!");
+		}
     }
     
     // Lesson 12 and L22.0
@@ -425,6 +982,8 @@ protected:
 		std::vector<const char*> extensions(glfwExtensions,
 			glfwExtensions + glfwExtensionCount);
 			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		// Needed by VK_KHR_timeline_semaphore, and for its feature query
+		extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 		
 		return extensions;
 	}
@@ -544,9 +1103,22 @@ protected:
 		
 		VkPhysicalDeviceFeatures supportedFeatures;
 		vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
+		bool indirectSupported = !indirectDrawCount ||
+				(supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance);
+
+		// Core or an extension, the feature may be missing
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		if (extensionsSupported) {
+			VkPhysicalDeviceFeatures2KHR features2{};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features2.pNext = &timelineFeatures;
+			vkGetPhysicalDeviceFeatures2KHR(device, &features2);
+		}
 		
 		return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-						supportedFeatures.samplerAnisotropy;
+						supportedFeatures.samplerAnisotropy && indirectSupported &&
+						timelineFeatures.timelineSemaphore;
 	}
     
     // Lesson 13
@@ -563,20 +1135,30 @@ protected:
 								
 		int i=0;
 		for (const auto& queueFamily : queueFamilies) {
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+				!indices.graphicsFamily.has_value()) {
 				indices.graphicsFamily = i;
 			}
 				
 			VkBool32 presentSupport = false;
 			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
 												 &presentSupport);
-			if (presentSupport) {
+			if (presentSupport && !indices.presentFamily.has_value()) {
 			 	indices.presentFamily = i;
 			}
 
-			if (indices.isComplete()) {
-				break;
-			}			
+			// Graphics and compute families can transfer too, but the
+			// dedicated one runs alongside them
+			if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+				!(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+				!indices.transferFamily.has_value()) {
+				indices.transferFamily = i;
+			}
+			if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+				!(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+				!indices.computeFamily.has_value()) {
+				indices.computeFamily = i;
+			}
 			i++;
 		}
 
@@ -593,8 +1175,9 @@ protected:
 		vkEnumerateDeviceExtensionProperties(device, nullptr,
 					&extensionCount, availableExtensions.data());
 					
-		std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-					deviceExtensions.end());
+		std::vector<const char*> extensions = requiredDeviceExtensions(device);
+		std::set<std::string> requiredExtensions(extensions.begin(),
+					extensions.end());
 					
 		for (const auto& extension : availableExtensions){
 			requiredExtensions.erase(extension.extensionName);
@@ -603,6 +1186,25 @@ protected:
 		return requiredExtensions.empty();
 	}
 
+	// Timeline semaphores are core when both the instance and the device
+	// are on Vulkan 1.2
+	bool timelineSemaphoreCore(VkPhysicalDevice device) const {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+		return std::min(properties.apiVersion, apiVersion) >= VK_API_VERSION_1_2;
+	}
+
+	std::vector<const char*> requiredDeviceExtensions(VkPhysicalDevice device) const {
+		std::vector<const char*> extensions = deviceExtensions;
+		if (!timelineSemaphoreCore(device)) {
+			extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		}
+		if (indirectDrawCount) {
+			extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+		return extensions;
+	}
+
 	// Lesson 14
 	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
 		SwapChainSupportDetails details;
@@ -640,6 +1242,12 @@ protected:
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies =
 				{indices.graphicsFamily.value(), indices.presentFamily.value()};
+		if (indices.transferFamily.has_value()) {
+			uniqueQueueFamilies.insert(indices.transferFamily.value());
+		}
+		if (indices.computeFamily.has_value()) {
+			uniqueQueueFamilies.insert(indices.computeFamily.value());
+		}
 		
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -653,9 +1261,17 @@ protected:
 		
 		VkPhysicalDeviceFeatures deviceFeatures{};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
+		// Checked by isDeviceSuitable()
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		timelineFeatures.timelineSemaphore = VK_TRUE;
+		deviceFeatures.multiDrawIndirect = indirectDrawCount ? VK_TRUE : VK_FALSE;
+		deviceFeatures.drawIndirectFirstInstance = indirectDrawCount ? VK_TRUE : VK_FALSE;
+		std::vector<const char*> extensions = requiredDeviceExtensions(physicalDevice);
 		
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		createInfo.pNext = &timelineFeatures;
 		
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.queueCreateInfoCount = 
@@ -663,8 +1279,8 @@ protected:
 		
 		createInfo.pEnabledFeatures = &deviceFeatures;
 		createInfo.enabledExtensionCount =
-				static_cast<uint32_t>(deviceExtensions.size());
-		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+				static_cast<uint32_t>(extensions.size());
+		createInfo.ppEnabledExtensionNames = extensions.data();
 
 			createInfo.enabledLayerCount = 
 					static_cast<uint32_t>(validationLayers.size());
@@ -679,6 +1295,33 @@ protected:
 		
 		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+		asyncCompute = indices.computeFamily.has_value();
+		if (asyncCompute) {
+			vkGetDeviceQueue(device, indices.computeFamily.value(), 0, &computeQueue);
+			sharedQueueFamilies = { indices.graphicsFamily.value(), indices.computeFamily.value() };
+		} else {
+			computeQueue = graphicsQueue;
+		}
+
+		// Without the extension only the core names are exposed
+		bool timelineCore = timelineSemaphoreCore(physicalDevice);
+		vkWaitSemaphoresKHR = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(
+				device, timelineCore ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+		vkGetSemaphoreCounterValueKHR = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+				vkGetDeviceProcAddr(device, timelineCore ? "vkGetSemaphoreCounterValue" :
+														   "vkGetSemaphoreCounterValueKHR"));
+		if (!vkWaitSemaphoresKHR || !vkGetSemaphoreCounterValueKHR) {
+			throw std::runtime_error("failed to load the timeline semaphore functions!");
+		}
+
+		if (indirectDrawCount) {
+			cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+					vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+			if (!cmdDrawIndexedIndirectCount) {
+				throw std::runtime_error("failed to load vkCmdDrawIndexedIndirectCountKHR!");
+			}
+		}
 	}
 	
 	// Lesson 14
@@ -691,7 +1334,8 @@ protected:
 				chooseSwapPresentMode(swapChainSupport.presentModes);
 		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 		
-		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		uint32_t imageCount = std::max(pacing.swapchainImages,
+									   swapChainSupport.capabilities.minImageCount);
 		
 		if (swapChainSupport.capabilities.maxImageCount > 0 &&
 				imageCount > swapChainSupport.capabilities.maxImageCount) {
@@ -740,6 +1384,12 @@ protected:
 				
 		swapChainImageFormat = surfaceFormat.format;
 		swapChainExtent = extent;
+		std::cout << "swapchain: " << imageCount << " images, " << pacing.framesInFlight
+				  << " frames in flight, " << presentModeName(presentMode) << " present mode";
+		if (pacing.fpsLimit > 0.0f) {
+			std::cout << ", limited to " << pacing.fpsLimit << " fps";
+		}
+		std::cout << "\n";
 	}
 
 	// Lesson 14
@@ -760,10 +1410,11 @@ protected:
 	VkPresentModeKHR chooseSwapPresentMode(
 			const std::vector<VkPresentModeKHR>& availablePresentModes) {
 		for (const auto& availablePresentMode : availablePresentModes) {
-			if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+			if (availablePresentMode == pacing.presentMode) {
 				return availablePresentMode;
 			}
 		}
+		// Always supported
 		return VK_PRESENT_MODE_FIFO_KHR;
 	}
 	
@@ -928,7 +1579,8 @@ protected:
 		VkCommandPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
+		// Primary command buffers are re-recorded every frame
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 		
 		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
 		if (result != VK_SUCCESS) {
@@ -991,12 +1643,14 @@ protected:
 								VK_SUCCESS) {
 			throw std::runtime_error("failed to allocate image memory!");
 		}
+		trackDeviceMemory(imageMemory, allocInfo.allocationSize);
 
 		vkBindImageMemory(device, image, imageMemory, 0);
 	}
 
 	// New - Lesson 23
-	void generateMipmaps(VkImage image, VkFormat imageFormat,
+	// Recorded in commandBuffer, which must go to a graphics queue
+	void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat,
 						 int32_t texWidth, int32_t texHeight,
 						 uint32_t mipLevels) {
 		VkFormatProperties formatProperties;
@@ -1008,8 +1662,6 @@ protected:
 			throw std::runtime_error("texture image format does not support linear blitting!");
 		}
 
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-		
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		barrier.image = image;
@@ -1080,16 +1732,12 @@ protected:
 							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
 							 0, nullptr, 0, nullptr,
 							 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
 	
 	// New - Lesson 23
-	void transitionImageLayout(VkImage image, VkFormat format,
+	void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
 					VkImageLayout oldLayout, VkImageLayout newLayout,
 					uint32_t mipLevels) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		barrier.oldLayout = oldLayout;
@@ -1109,17 +1757,13 @@ protected:
 
 		vkCmdPipelineBarrier(commandBuffer,
 								VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-								VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+								VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
 								0, nullptr, 0, nullptr, 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
 	
 	// New - Lesson 23
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t
-						   width, uint32_t height) {
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-		
+	void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image,
+						   uint32_t width, uint32_t height) {
 		VkBufferImageCopy region{};
 		region.bufferOffset = 0;
 		region.bufferRowLength = 0;
@@ -1133,42 +1777,6 @@ protected:
 		
 		vkCmdCopyBufferToImage(commandBuffer, buffer, image,
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-		endSingleTimeCommands(commandBuffer);
-	}
-	
-	// New - Lesson 23
-	VkCommandBuffer beginSingleTimeCommands() { 
-		VkCommandBufferAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = commandPool;
-		allocInfo.commandBufferCount = 1;
-		
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-		
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
-		
-		return commandBuffer;
-	}
-	
-	// New - Lesson 23
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-		vkEndCommandBuffer(commandBuffer);
-		
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
-		
-		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 	}
 	
 
@@ -1176,14 +1784,21 @@ protected:
 	// Lesson 22.4
 	
 	// Lesson 21
+	// shared buffers are used by both the graphics and the async compute queue
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 					  VkMemoryPropertyFlags properties,
-					  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+					  VkBuffer& buffer, VkDeviceMemory& bufferMemory,
+					  bool shared = false) {
 		VkBufferCreateInfo bufferInfo{};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.size = size;
 		bufferInfo.usage = usage;
 		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (shared && asyncCompute) {
+			bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharedQueueFamilies.size());
+			bufferInfo.pQueueFamilyIndices = sharedQueueFamilies.data();
+		}
 		
 		VkResult result =
 				vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
@@ -1207,6 +1822,7 @@ protected:
 		 	PrintVkError(result);
 			throw std::runtime_error("failed to allocate vertex buffer memory!");
 		}
+		trackDeviceMemory(bufferMemory, allocInfo.allocationSize);
 		
 		vkBindBufferMemory(device, buffer, bufferMemory, 0);	
 	}
@@ -1230,21 +1846,38 @@ protected:
     
     // Lesson 21
 	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
+		std::vector<VkDescriptorPoolSize> poolSizes(2);
 		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
-															 swapChainImages.size());
+															 framesInFlight());
 		// New - Lesson 23
 		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
-															 swapChainImages.size());
+															 framesInFlight());
 		//
+		if (dynamicUniformBlocksInPool > 0) {
+			VkDescriptorPoolSize dynamicSize{};
+			dynamicSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			dynamicSize.descriptorCount = static_cast<uint32_t>(dynamicUniformBlocksInPool *
+																framesInFlight());
+			poolSizes.push_back(dynamicSize);
+		}
+		if (storageBuffersInPool > 0) {
+			VkDescriptorPoolSize storageSize{};
+			storageSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			storageSize.descriptorCount = static_cast<uint32_t>(storageBuffersInPool *
+																framesInFlight());
+			poolSizes.push_back(storageSize);
+		}
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
 		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
+		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * framesInFlight());
+		if (freeableDescriptorSets) {
+			poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		}
 		
 		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
 									&descriptorPool);
@@ -1254,12 +1887,23 @@ protected:
 		}
 	}
 	
-	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+	// Draws are split in buckets (e.g. one per room): every bucket is
+	// recorded in its own secondary command buffer, possibly on another thread,
+	// so populateCommandBuffer() must bind all the state it needs.
+	// In these hooks and in updateUniformBuffer(), currentImage is the frame
+	// in flight (0 to pacing.framesInFlight - 1) whose resources are used,
+	// not the swapchain image drawn into
+	virtual int getDrawBucketCount() = 0;
+	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage,
+									   int bucket) = 0;
+	// Compute work of the frame, recorded with computePass (see
+	// computePassEnabled); the draws of the frame wait for it
+	virtual void populateComputePass(int) {}
 
 	// Lesson 22.5 (and 13)
     void createCommandBuffers() {
     	// Lesson 13
-    	commandBuffers.resize(swapChainFramebuffers.size());
+    	commandBuffers.resize(framesInFlight());
     	
     	VkCommandBufferAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1273,130 +1917,338 @@ protected:
 		 	PrintVkError(result);
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
-		
-		// Lesson 22.5 --- Draw calls
-		// This is where the commands that actually draw something on screen are!
+
+		int threads = std::clamp(static_cast<int>(std::thread::hardware_concurrency()),
+								 1, MAX_RECORDING_THREADS);
+		frameJobs.init(threads);
+
+		QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+		recordingContexts.resize(commandBuffers.size());
 		for (size_t i = 0; i < commandBuffers.size(); i++) {
+			recordingContexts[i].resize(threads);
+			for (int t = 0; t < threads; t++) {
+				VkCommandPoolCreateInfo poolInfo{};
+				poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+				poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+				poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+				result = vkCreateCommandPool(device, &poolInfo, nullptr,
+											 &recordingContexts[i][t].pool);
+				if (result != VK_SUCCESS) {
+				 	PrintVkError(result);
+					throw std::runtime_error("failed to create recording command pool!");
+				}
+				recordingContexts[i][t].used = 0;
+			}
+		}
+	}
+
+	// Takes a secondary command buffer from the pool of the given thread,
+	// allocating a new one only when all the recycled ones are in use.
+	VkCommandBuffer getSecondaryCommandBuffer(RecordingContext &ctx) {
+		if (ctx.used == ctx.buffers.size()) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = ctx.pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+
+			VkCommandBuffer commandBuffer;
+			VkResult result = vkAllocateCommandBuffers(device, &allocInfo,
+					&commandBuffer);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+			ctx.buffers.push_back(commandBuffer);
+		}
+		return ctx.buffers[ctx.used++];
+	}
+
+	// Lesson 22.5 --- Draw calls
+	// This is where the commands that actually draw something on screen are!
+	// Called every frame: the draw buckets are recorded in parallel into
+	// secondary command buffers, then executed in order by the primary one.
+	void recordCommandBuffer(uint32_t frame, uint32_t imageIndex) {
+		std::vector<RecordingContext> &contexts = recordingContexts[frame];
+		for (auto &ctx : contexts) {
+			vkResetCommandPool(device, ctx.pool, 0);
+			ctx.used = 0;
+		}
+
+		int bucketCount = getDrawBucketCount();
+		std::vector<VkCommandBuffer> bucketBuffers(bucketCount);
+
+		frameJobs.parallelFor(bucketCount, [&](int bucket, int thread) {
+			VkCommandBuffer commandBuffer = getSecondaryCommandBuffer(contexts[thread]);
+
+			VkCommandBufferInheritanceInfo inheritanceInfo{};
+			inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			inheritanceInfo.renderPass = renderPass;
+			inheritanceInfo.subpass = 0;
+			inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+
 			VkCommandBufferBeginInfo beginInfo{};
 			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+							  VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-						VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
+			if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+				throw std::runtime_error("failed to begin recording secondary command buffer!");
 			}
-			
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass; 
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = {0, 0};
-			renderPassInfo.renderArea.extent = swapChainExtent;
-	
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = {1.0f, 0};
-	
-			renderPassInfo.clearValueCount =
-							static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-			
-			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-					VK_SUBPASS_CONTENTS_INLINE);			
-	
-
-			populateCommandBuffer(commandBuffers[i], i);
-			
 
-			vkCmdEndRenderPass(commandBuffers[i]);
+			populateCommandBuffer(commandBuffer, frame, bucket);
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
+			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to record secondary command buffer!");
 			}
+			bucketBuffers[bucket] = commandBuffer;
+		});
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		if (vkBeginCommandBuffer(commandBuffers[frame], &beginInfo) !=
+					VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+		
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass; 
+		renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+		renderPassInfo.renderArea.offset = {0, 0};
+		renderPassInfo.renderArea.extent = swapChainExtent;
+
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = initialBackgroundColor;
+		clearValues[1].depthStencil = {1.0f, 0};
+
+		renderPassInfo.clearValueCount =
+						static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+		
+		vkCmdBeginRenderPass(commandBuffers[frame], &renderPassInfo,
+				VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		if (bucketCount > 0) {
+			vkCmdExecuteCommands(commandBuffers[frame],
+					static_cast<uint32_t>(bucketBuffers.size()), bucketBuffers.data());
+		}
+
+		vkCmdEndRenderPass(commandBuffers[frame]);
+
+		if (vkEndCommandBuffer(commandBuffers[frame]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
 		}
 	}
     
     // Lesson 22.5
     void createSyncObjects() {
-    	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-    	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+    	imageAvailableSemaphores.resize(framesInFlight());
+    	renderFinishedSemaphores.resize(framesInFlight());
     	    	
     	VkSemaphoreCreateInfo semaphoreInfo{};
 		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 		
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-		
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		for (size_t i = 0; i < framesInFlight(); i++) {
 			VkResult result1 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
 								&imageAvailableSemaphores[i]);
 			VkResult result2 = vkCreateSemaphore(device, &semaphoreInfo, nullptr,
 								&renderFinishedSemaphores[i]);
-			VkResult result3 = vkCreateFence(device, &fenceInfo, nullptr,
-								&inFlightFences[i]);
 			if (result1 != VK_SUCCESS ||
-				result2 != VK_SUCCESS ||
-				result3 != VK_SUCCESS) {
+				result2 != VK_SUCCESS) {
 			 	PrintVkError(result1);
 			 	PrintVkError(result2);
-			 	PrintVkError(result3);
 				throw std::runtime_error("failed to create synchronization objects for a frame!!");
 			}
 		}
+
+		frameTimeline = createTimelineSemaphore();
+	}
+
+	VkSemaphore createTimelineSemaphore() {
+		VkSemaphoreTypeCreateInfoKHR typeInfo{};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+
+		VkSemaphore semaphore;
+		VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create timeline semaphore!");
+		}
+		return semaphore;
+	}
+
+	uint64_t timelineValue(VkSemaphore semaphore) {
+		uint64_t value = 0;
+		VkResult result = vkGetSemaphoreCounterValueKHR(device, semaphore, &value);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to read timeline semaphore!");
+		}
+		return value;
+	}
+
+	// Blocks until semaphore reaches value; returns false at once if it
+	// already has, without a call to the driver wait
+	bool waitTimeline(VkSemaphore semaphore, uint64_t value) {
+		if (timelineValue(semaphore) >= value) {
+			return false;
+		}
+		VkSemaphoreWaitInfoKHR waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &semaphore;
+		waitInfo.pValues = &value;
+		VkResult result = vkWaitSemaphoresKHR(device, &waitInfo, GPU_WAIT_TIMEOUT);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("timed out waiting for the GPU!");
+		}
+		return true;
+	}
+
+	size_t framesInFlight() const {
+		return static_cast<size_t>(pacing.framesInFlight);
+	}
+
+	uint64_t framesCompleted() {
+		return timelineValue(frameTimeline);
+	}
+
+	// Waits for the frames before frame, i.e. until frameTimeline reaches it
+	void waitForFrames(uint64_t frame) {
+		if (waitTimeline(frameTimeline, frame)) {
+			statsFrameWaits++;
+		}
 	}
     
     // Lesson 22.6 --- Main Rendering Loop
     void mainLoop() {
+		frameLimiter.init(pacing.fpsLimit);
         while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+			if (idle) {
+				glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+			} else {
+				// Before the input is read, so that it is as recent as possible
+				frameLimiter.wait();
+				glfwPollEvents();
+			}
+			frameInputTime = std::chrono::steady_clock::now();
+			pollInput();
+			idle = pacing.skipIdleFrames && !frameNeeded();
+			if (idle) {
+				// The wait is not a frame time
+				frameTimes.pause();
+				continue;
+			}
+			frameTimes.tick();
             drawFrame();
         }
         
         vkDeviceWaitIdle(device);
     }
     
+	// Called on the main thread after the events are polled, for input
+	// read by other threads
+	virtual void pollInput() {}
+
+	// Called once the command buffers of the frame are recorded, right
+	// before they are submitted: the last chance to write host visible
+	// memory they read (e.g. the camera, from input sampled again)
+	virtual void latchFrame(uint32_t) {}
+
+	// True while the image keeps changing without any input: keys held
+	// down, animations, assets streaming in. The default never lets the
+	// main loop idle.
+	virtual bool sceneActive() {
+		return true;
+	}
+
+	// The last image presented stays on screen while nothing changes
+	bool frameNeeded() {
+		bool changed = windowEvent || sceneActive();
+		windowEvent = false;
+		if (changed) {
+			settleFrames = IDLE_SETTLE_FRAMES;
+			return true;
+		}
+		if (settleFrames > 0) {
+			settleFrames--;
+			return true;
+		}
+		return false;
+	}
+
     // Lesson 22.6
     void drawFrame() {
-		vkWaitForFences(device, 1, &inFlightFences[currentFrame],
-						VK_TRUE, UINT64_MAX);
+		// The resources of this frame in flight were last used
+		// pacing.framesInFlight frames ago
+		if (frameNumber >= framesInFlight()) {
+			waitForFrames(frameNumber + 1 - framesInFlight());
+		}
 		
 		uint32_t imageIndex;
 		
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+		VkResult result = vkAcquireNextImageKHR(device, swapChain, GPU_WAIT_TIMEOUT,
 				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-			vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
-							VK_TRUE, UINT64_MAX);
+		if (result == VK_TIMEOUT || result == VK_NOT_READY) {
+			throw std::runtime_error("timed out acquiring a swapchain image!");
 		}
-		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 		
-		updateUniformBuffer(imageIndex);
+		uploads.poll();
+		updateUniformBuffer(currentFrame);
+		if (computePassEnabled) {
+			computePass.begin(currentFrame);
+			populateComputePass(currentFrame);
+			computePass.submit(currentFrame);
+		}
+		recordCommandBuffer(currentFrame, imageIndex);
+		latchFrame(currentFrame);
 		
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+		VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame],
+										computePassEnabled ? computePass.finished[currentFrame] :
+															 VK_NULL_HANDLE};
 		VkPipelineStageFlags waitStages[] =
-			{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-		submitInfo.waitSemaphoreCount = 1;
+			{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, computePass.consumerStages};
+		submitInfo.waitSemaphoreCount = computePassEnabled ? 2 : 1;
 		submitInfo.pWaitSemaphores = waitSemaphores;
 		submitInfo.pWaitDstStageMask = waitStages;
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame], frameTimeline};
+		submitInfo.signalSemaphoreCount = 2;
 		submitInfo.pSignalSemaphores = signalSemaphores;
-		
-		vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-				inFlightFences[currentFrame]) != VK_SUCCESS) {
+		// The values of the binary semaphores are ignored
+		uint64_t waitValues[] = {0, 0};
+		uint64_t signalValues[] = {0, frameNumber + 1};
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+		timelineInfo.pWaitSemaphoreValues = waitValues;
+		timelineInfo.signalSemaphoreValueCount = 2;
+		timelineInfo.pSignalSemaphoreValues = signalValues;
+		submitInfo.pNext = &timelineInfo;
+
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
 			throw std::runtime_error("failed to submit draw command buffer!");
 		}
+		if (showStats) {
+			latencyProbe.frameSubmitted(frameNumber + 1, frameInputTime);
+		}
 		
 		VkPresentInfoKHR presentInfo{};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1411,27 +2263,102 @@ protected:
 		
 		result = vkQueuePresentKHR(presentQueue, &presentInfo);
 
-		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-    }
+		currentFrame = (currentFrame + 1) % framesInFlight();
+		frameNumber++;
 
-	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
+		reportStats();
+    }
 
-	virtual void localCleanup() = 0;
-	
-	// All lessons
-	
-    void cleanup() {
-		vkDestroyImageView(device, depthImageView, nullptr);
-		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+	void reportStats() {
+		bool key = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+		if (key && !statsKeyPressed) {
+			showStats = !showStats;
+			statsFrames = 0;
+			statsFrameWaits = 0;
+			frameTimes.reset();
+			latencyProbe.reset();
+			statsLastReport = std::chrono::high_resolution_clock::now();
+		}
+		statsKeyPressed = key;
 
-		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+		if (!showStats) {
+			return;
+		}
+
+		statsFrames++;
+		auto now = std::chrono::high_resolution_clock::now();
+		float elapsed = std::chrono::duration<float, std::chrono::seconds::period>
+			(now - statsLastReport).count();
+		if (elapsed >= 1.0f) {
+			std::cout << "fps: " << statsFrames / elapsed
+					  << "  draws visible: " << stats.drawsVisible
+					  << "  culled: " << stats.drawsCulled
+					  << "  hidden: " << stats.drawsHidden
+					  << "  occluded: " << stats.drawsOccluded
+					  << "  rooms visible: " << stats.roomsVisible
+					  << "  transforms updated: " << stats.transformsUpdated
+					  << "  uploaded: " << stats.transformsUploaded
+					  << "  not loaded: " << stats.drawsNotLoaded
+					  << "  triangles: " << stats.trianglesDrawn
+					  << "  clusters culled: " << stats.clustersCulled
+					  << "  impostors: " << stats.impostorsDrawn
+					  << "  textures resident: " << stats.texturesResident;
+			if (indirectDrawCount) {
+				std::cout << "  gpu culling mismatches: " << stats.gpuCullingMismatches;
+			}
+			FrameTimes::Summary T = frameTimes.summarize();
+			std::cout << "  frame ms avg " << T.average << " p50 " << T.p50 << " p95 " << T.p95
+					  << " p99 " << T.p99 << " max " << T.max;
+			FrameTimes::Summary L = latencyProbe.summarize();
+			std::cout << "  input to gpu ms avg " << L.average << " p95 " << L.p95
+					  << " max " << L.max;
+			std::cout << "  cpu waits: " << statsFrameWaits
+					  << "  device memory: " << deviceMemoryInUse / (1024 * 1024) << " MB\n";
+			statsFrames = 0;
+			statsFrameWaits = 0;
+			statsLastReport = now;
+		}
+	}
+
+	void trackDeviceMemory(VkDeviceMemory memory, VkDeviceSize size) {
+		memoryAllocations[memory] = size;
+		deviceMemoryInUse += size;
+	}
+
+	void freeDeviceMemory(VkDeviceMemory memory) {
+		auto it = memoryAllocations.find(memory);
+		if (it != memoryAllocations.end()) {
+			deviceMemoryInUse -= it->second;
+			memoryAllocations.erase(it);
+		}
+		vkFreeMemory(device, memory, nullptr);
+	}
+
+	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
+
+	virtual void localCleanup() = 0;
+	
+	// All lessons
+	
+    void cleanup() {
+		vkDestroyImageView(device, depthImageView, nullptr);
+		vkDestroyImage(device, depthImage, nullptr);
+		freeDeviceMemory(depthImageMemory);
+
+		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
+			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
 		}
 		
 		vkFreeCommandBuffers(device, commandPool,
 				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
 
+		frameJobs.cleanup();
+		for (auto &contexts : recordingContexts) {
+			for (auto &ctx : contexts) {
+				vkDestroyCommandPool(device, ctx.pool, nullptr);
+			}
+		}
+
 		vkDestroyRenderPass(device, renderPass, nullptr);
 
 		for (size_t i = 0; i < swapChainImageViews.size(); i++){
@@ -1440,16 +2367,22 @@ protected:
 		
 		vkDestroySwapchainKHR(device, swapChain, nullptr);
 		
-		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    	
-    	
+		uploads.cleanup();
+		latencyProbe.cleanup();
+		if (computePassEnabled) {
+			computePass.cleanup();
+		}
+
+		// The application may return its descriptor sets to the pool
 		localCleanup();
     	
-    	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    	
+    	for (size_t i = 0; i < framesInFlight(); i++) {
 			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(device, inFlightFences[i], nullptr);
     	}
+		vkDestroySemaphore(device, frameTimeline, nullptr);
     	
     	vkDestroyCommandPool(device, commandPool, nullptr);
     	
@@ -1470,7 +2403,23 @@ protected:
 
 
 
+// A cooked mesh is used instead of the .obj file when it is not older
 void Model::loadModel(std::string file) {
+	std::string cooked = file + ".cooked";
+	std::error_code e1, e2;
+	bool fresh = std::filesystem::last_write_time(cooked, e1) >=
+				 std::filesystem::last_write_time(file, e2);
+	if (e1 || e2 || !fresh || !loadCooked(cooked)) {
+		loadObj(file);
+		optimize(file);
+	}
+
+	computeBounds();
+	buildSubmeshes();
+	buildMeshlets();
+}
+
+void Model::loadObj(const std::string &file) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -1481,6 +2430,9 @@ void Model::loadModel(std::string file) {
 		throw std::runtime_error(warn + err);
 	}
 	
+	// Corners shared by several faces become a single vertex
+	std::unordered_map<Vertex, uint32_t, VertexHash> uniqueVertices;
+
 	for (const auto& shape : shapes) {
 		for (const auto& index : shape.mesh.indices) {
 			Vertex vertex{};
@@ -1502,45 +2454,340 @@ void Model::loadModel(std::string file) {
 				attrib.normals[3 * index.normal_index + 2]
 			};
 			
-			vertices.push_back(vertex);
-			indices.push_back(vertices.size()-1);
+			auto it = uniqueVertices.find(vertex);
+			if (it == uniqueVertices.end()) {
+				it = uniqueVertices.emplace(vertex, static_cast<uint32_t>(vertices.size())).first;
+				vertices.push_back(vertex);
+			}
+			indices.push_back(it->second);
 		}
 	}
-	
-	
+}
+
+// Triangles reordered for the vertex cache and for overdraw, then
+// vertices for fetch locality (see mesh_optimizer.hpp)
+void Model::optimize(const std::string &name) {
+	VertexCacheStats before = simulateVertexCache(indices, vertices.size());
+
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++) {
+		positions[v] = vertices[v].pos;
+	}
+	optimizeTriangleOrder(indices, positions);
+	generateLods(positions);
+
+	std::vector<uint32_t> source = optimizeVertexFetch(indices, vertices.size());
+	std::vector<Vertex> reordered(source.size());
+	for (size_t v = 0; v < source.size(); v++) {
+		reordered[v] = vertices[source[v]];
+	}
+	vertices.swap(reordered);
+
+	std::vector<uint32_t> full(indices.begin(), indices.begin() + lods[0].indexCount);
+	VertexCacheStats after = simulateVertexCache(full, vertices.size());
+	std::cout << name << ": " << vertices.size() << " vertices, " << full.size() / 3
+			  << " triangles, ACMR " << before.acmr << " -> " << after.acmr
+			  << ", ATVR " << before.atvr << " -> " << after.atvr << ", LODs";
+	for (const Lod &L : lods) {
+		std::cout << " " << L.indexCount / 3;
+	}
+	std::cout << "\n";
+}
+
+// Every level is simplified from the previous one, so its error is at
+// most the sum of the errors of the steps
+void Model::generateLods(const std::vector<glm::vec3> &positions) {
+	lods.assign(1, { 0, static_cast<uint32_t>(indices.size()), 0, 0, 0.0f });
+
+	auto attributeDistance = [&](uint32_t a, uint32_t b) {
+		const Vertex &A = vertices[a], &B = vertices[b];
+		return (1.0f - glm::dot(A.norm, B.norm)) + glm::length(A.texCoord - B.texCoord);
+	};
+
+	std::vector<uint32_t> level = indices;
+	while (lods.size() < MAX_LOD_COUNT && level.size() / 3 >= 2 * MIN_LOD_TRIANGLES) {
+		float error;
+		std::vector<uint32_t> next = simplifyMesh(level, positions, level.size() / 6, error,
+												  attributeDistance);
+		// Stop when the mesh cannot be simplified much further
+		if (next.size() * 4 > level.size() * 3) {
+			break;
+		}
+		optimizeTriangleOrder(next, positions);
+		lods.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(next.size()),
+						 0, 0, lods.back().error + error });
+		indices.insert(indices.end(), next.begin(), next.end());
+		level.swap(next);
+	}
+}
+
+const uint32_t COOKED_MESH_MAGIC = 0x4853454d;		// "MESH"
+const uint32_t COOKED_MESH_VERSION = 2;
+
+// Header, then 8 floats per vertex (position, normal, UV), 32-bit indices,
+// the number of LODs and their index ranges and errors
+bool Model::loadCooked(const std::string &file) {
+	std::ifstream in(file, std::ios::binary);
+	uint32_t header[4];
+	if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+		header[0] != COOKED_MESH_MAGIC || header[1] != COOKED_MESH_VERSION) {
+		return false;
+	}
+
+	// A corrupt or truncated file must not size the arrays: the vertices,
+	// the indices and the LOD count have to fit in the rest of the file
+	const std::streampos start = in.tellg();
+	in.seekg(0, std::ios::end);
+	const uint64_t remaining = static_cast<uint64_t>(in.tellg() - start);
+	in.seekg(start);
+	const uint64_t vertexBytes = static_cast<uint64_t>(header[2]) * 8 * sizeof(float);
+	const uint64_t indexBytes = static_cast<uint64_t>(header[3]) * sizeof(uint32_t);
+	if (!in || vertexBytes + indexBytes + sizeof(uint32_t) > remaining) {
+		return false;
+	}
+
+	std::vector<float> data(static_cast<size_t>(header[2]) * 8);
+	std::vector<uint32_t> cookedIndices(header[3]);
+	in.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float));
+	in.read(reinterpret_cast<char *>(cookedIndices.data()), cookedIndices.size() * sizeof(uint32_t));
+	uint32_t lodCount = 0;
+	in.read(reinterpret_cast<char *>(&lodCount), sizeof(lodCount));
+	if (!in || lodCount == 0 || lodCount > MAX_LOD_COUNT) {
+		return false;
+	}
+	for (uint32_t i : cookedIndices) {
+		if (i >= header[2]) {
+			return false;
+		}
+	}
+	std::vector<Lod> cookedLods(lodCount, Lod{ 0, 0, 0, 0, 0.0f });
+	for (Lod &L : cookedLods) {
+		in.read(reinterpret_cast<char *>(&L.firstIndex), sizeof(L.firstIndex));
+		in.read(reinterpret_cast<char *>(&L.indexCount), sizeof(L.indexCount));
+		in.read(reinterpret_cast<char *>(&L.error), sizeof(L.error));
+		if (!in || L.firstIndex + static_cast<uint64_t>(L.indexCount) > cookedIndices.size()) {
+			return false;
+		}
+	}
+	lods.swap(cookedLods);
+
+	vertices.resize(header[2]);
+	for (size_t v = 0; v < vertices.size(); v++) {
+		const float *f = &data[v * 8];
+		vertices[v].pos = glm::vec3(f[0], f[1], f[2]);
+		vertices[v].norm = glm::vec3(f[3], f[4], f[5]);
+		vertices[v].texCoord = glm::vec2(f[6], f[7]);
+	}
+	indices.swap(cookedIndices);
+	return true;
+}
+
+void Model::saveCooked(const std::string &file) const {
+	std::ofstream out(file, std::ios::binary);
+	uint32_t header[4] = { COOKED_MESH_MAGIC, COOKED_MESH_VERSION,
+						   static_cast<uint32_t>(vertices.size()),
+						   static_cast<uint32_t>(indices.size()) };
+	out.write(reinterpret_cast<const char *>(header), sizeof(header));
+	for (const Vertex &v : vertices) {
+		const float f[8] = { v.pos.x, v.pos.y, v.pos.z, v.norm.x, v.norm.y, v.norm.z,
+							 v.texCoord.x, v.texCoord.y };
+		out.write(reinterpret_cast<const char *>(f), sizeof(f));
+	}
+	out.write(reinterpret_cast<const char *>(indices.data()), indices.size() * sizeof(uint32_t));
+	uint32_t lodCount = static_cast<uint32_t>(lods.size());
+	out.write(reinterpret_cast<const char *>(&lodCount), sizeof(lodCount));
+	for (const Lod &L : lods) {
+		out.write(reinterpret_cast<const char *>(&L.firstIndex), sizeof(L.firstIndex));
+		out.write(reinterpret_cast<const char *>(&L.indexCount), sizeof(L.indexCount));
+		out.write(reinterpret_cast<const char *>(&L.error), sizeof(L.error));
+	}
+	if (!out) {
+		throw std::runtime_error("failed to write cooked mesh " + file + "!");
+	}
+}
+
+// Meshes with more vertices than a 16-bit index can address are split
+// into submeshes of at most MAX_SUBMESH_VERTICES vertices, in the order
+// of their triangles: the vertices on the seams are duplicated.
+// Every LOD starts a new submesh.
+void Model::buildSubmeshes() {
+	indexType = VK_INDEX_TYPE_UINT16;
+	submeshes.clear();
+	if (lods.empty()) {
+		lods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0, 0, 0.0f });
+	}
+	if (vertices.size() <= MAX_SUBMESH_VERTICES) {
+		for (Lod &L : lods) {
+			L.firstSubmesh = static_cast<uint32_t>(submeshes.size());
+			L.submeshCount = 1;
+			submeshes.push_back({ L.firstIndex, L.indexCount, 0 });
+		}
+		return;
+	}
+
+	const uint32_t none = UINT32_MAX;
+	std::vector<Vertex> splitVertices;
+	std::vector<uint32_t> splitIndices;
+	std::vector<uint32_t> remap(vertices.size(), none);
+	std::vector<uint32_t> remapped;
+	Submesh S{ 0, 0, 0 };
+
+	auto startSubmesh = [&]() {
+		for (uint32_t v : remapped) {
+			remap[v] = none;
+		}
+		remapped.clear();
+		S.firstIndex = static_cast<uint32_t>(splitIndices.size());
+		S.vertexOffset = static_cast<int32_t>(splitVertices.size());
+	};
+	auto endSubmesh = [&]() {
+		S.indexCount = static_cast<uint32_t>(splitIndices.size()) - S.firstIndex;
+		submeshes.push_back(S);
+	};
+
+	for (Lod &L : lods) {
+		const size_t first = L.firstIndex;
+		L.firstSubmesh = static_cast<uint32_t>(submeshes.size());
+		L.firstIndex = static_cast<uint32_t>(splitIndices.size());
+		startSubmesh();
+		for (size_t t = first; t + 2 < first + L.indexCount; t += 3) {
+			size_t added = 0;
+			for (size_t k = 0; k < 3; k++) {
+				added += remap[indices[t + k]] == none;
+			}
+			if (splitVertices.size() - S.vertexOffset + added > MAX_SUBMESH_VERTICES) {
+				endSubmesh();
+				startSubmesh();
+			}
+			for (size_t k = 0; k < 3; k++) {
+				uint32_t v = indices[t + k];
+				if (remap[v] == none) {
+					remap[v] = static_cast<uint32_t>(splitVertices.size());
+					splitVertices.push_back(vertices[v]);
+					remapped.push_back(v);
+				}
+				splitIndices.push_back(remap[v]);
+			}
+		}
+		endSubmesh();
+		L.submeshCount = static_cast<uint32_t>(submeshes.size()) - L.firstSubmesh;
+	}
+
+	vertices.swap(splitVertices);
+	indices.swap(splitIndices);
+}
+
+// Meshlets never cross submeshes, so they can be drawn with the vertex
+// offset of their submesh
+void Model::buildMeshlets() {
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++) {
+		positions[v] = vertices[v].pos;
+	}
+	meshlets.clear();
+	for (Lod &L : lods) {
+		L.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+		for (uint32_t s = L.firstSubmesh; s < L.firstSubmesh + L.submeshCount; s++) {
+			const Submesh &S = submeshes[s];
+			appendMeshlets(indices, positions, S.firstIndex, S.indexCount, S.vertexOffset, meshlets);
+		}
+		L.meshletCount = static_cast<uint32_t>(meshlets.size()) - L.firstMeshlet;
+	}
+}
+
+// The sphere is centered in the AABB: not the tightest one, but it is
+// cheap and good enough to reject objects that are far from the frustum
+void Model::computeBounds() {
+	aabbMin = glm::vec3(0.0f);
+	aabbMax = glm::vec3(0.0f);
+	if (!vertices.empty()) {
+		aabbMin = aabbMax = vertices[0].pos;
+	}
+	for (const auto& v : vertices) {
+		aabbMin = glm::min(aabbMin, v.pos);
+		aabbMax = glm::max(aabbMax, v.pos);
+	}
+
+	sphereCenter = (aabbMin + aabbMax) * 0.5f;
+	float r2 = 0.0f;
+	for (const auto& v : vertices) {
+		glm::vec3 d = v.pos - sphereCenter;
+		r2 = std::max(r2, glm::dot(d, d));
+	}
+	sphereRadius = std::sqrt(r2);
+}
+
+// The vertices in the compact format, and the constants to decode their positions
+void Model::compactVertices(std::vector<CompactVertex> &out) {
+	glm::vec3 extent = aabbMax - aabbMin;
+	decode.scale = glm::vec4(extent, 0.0f);
+	decode.offset = glm::vec4(aabbMin, 0.0f);
+
+	out.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const Vertex &v = vertices[i];
+		CompactVertex &c = out[i];
+		for (int k = 0; k < 3; k++) {
+			float q = extent[k] > 0.0f ? (v.pos[k] - aabbMin[k]) / extent[k] : 0.0f;
+			c.pos[k] = glm::packUnorm1x16(q);
+		}
+		c.pos[3] = 0;
+		glm::vec2 e = octahedralEncode(v.norm);
+		c.norm[0] = static_cast<int16_t>(glm::packSnorm1x16(e.x));
+		c.norm[1] = static_cast<int16_t>(glm::packSnorm1x16(e.y));
+		c.texCoord[0] = glm::packHalf1x16(v.texCoord.x);
+		c.texCoord[1] = glm::packHalf1x16(v.texCoord.y);
+	}
 }
 
 // Lesson 21
 void Model::createVertexBuffer() {
+	std::vector<CompactVertex> compact;
+	const void *source = vertices.data();
 	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+	if (format == VERTEX_COMPACT) {
+		compactVertices(compact);
+		source = compact.data();
+		bufferSize = sizeof(compact[0]) * compact.size();
+	}
 	
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+						VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 						vertexBuffer, vertexBufferMemory);
-
-	void* data;
-	vkMapMemory(BP->device, vertexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, vertexBufferMemory);			
+	BP->uploads.uploadBuffer(vertexBuffer, source, bufferSize,
+							 VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+							 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 }
 
+// 16-bit indices are stored relative to the vertex offset of their submesh
 void Model::createIndexBuffer() {
+	std::vector<uint16_t> shortIndices;
+	const void *source = indices.data();
 	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+	if (indexType == VK_INDEX_TYPE_UINT16) {
+		shortIndices.resize(indices.size());
+		for (const Submesh &S : submeshes) {
+			for (uint32_t i = S.firstIndex; i < S.firstIndex + S.indexCount; i++) {
+				shortIndices[i] = static_cast<uint16_t>(indices[i] - S.vertexOffset);
+			}
+		}
+		source = shortIndices.data();
+		bufferSize = sizeof(shortIndices[0]) * shortIndices.size();
+	}
 
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-							 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+							 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+							 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 							 indexBuffer, indexBufferMemory);
-
-	void* data;
-	vkMapMemory(BP->device, indexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, indexBufferMemory);
+	BP->uploads.uploadBuffer(indexBuffer, source, bufferSize,
+							 VK_ACCESS_INDEX_READ_BIT,
+							 VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
 }
 
-void Model::init(BaseProject *bp, std::string file) {
+void Model::init(BaseProject *bp, std::string file, VertexFormat vertexFormat) {
 	BP = bp;
+	format = vertexFormat;
 	loadModel(file);
 	createVertexBuffer();
 	createIndexBuffer();
@@ -1548,9 +2795,9 @@ void Model::init(BaseProject *bp, std::string file) {
 
 void Model::cleanup() {
    	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
-   	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+   	BP->freeDeviceMemory(indexBufferMemory);
 	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
-   	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+   	BP->freeDeviceMemory(vertexBufferMemory);
 }
 
 
@@ -1567,45 +2814,27 @@ void Texture::createTextureImage(std::string file) {
 		throw std::runtime_error("failed to load texture image!");
 	}
 
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
+	createTextureImage(pixels, texWidth, texHeight);
+	stbi_image_free(pixels);
+}
+
+void Texture::createTextureImage(const stbi_uc *pixels, int texWidth, int texHeight) {
 	mipLevels = static_cast<uint32_t>(std::floor(
 					std::log2(std::max(texWidth, texHeight)))) + 1;
 	
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	 
-	BP->createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-	  						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-	  						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-	  						stagingBuffer, stagingBufferMemory);
-	void* data;
-	vkMapMemory(BP->device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(BP->device, stagingBufferMemory);
-	
-	stbi_image_free(pixels);
-	
-	BP->createImage(texWidth, texHeight, mipLevels, VK_FORMAT_R8G8B8A8_SRGB,
+	BP->createImage(texWidth, texHeight, mipLevels, format,
 				VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
 				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
 				textureImageMemory);
-				
-	BP->transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-	BP->copyBufferToImage(stagingBuffer, textureImage,
-			static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
 
-	BP->generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-					texWidth, texHeight, mipLevels);
-
-	vkDestroyBuffer(BP->device, stagingBuffer, nullptr);
-	vkFreeMemory(BP->device, stagingBufferMemory, nullptr);
+	// Copy, layout transitions and mipmaps
+	upload = BP->uploads.uploadTexture(*this, pixels, texWidth, texHeight);
 }
 
 void Texture::createTextureImageView() {
 	textureImageView = BP->createImageView(textureImage,
-									   VK_FORMAT_R8G8B8A8_SRGB,
+									   format,
 									   VK_IMAGE_ASPECT_COLOR_BIT,
 									   mipLevels);
 }
@@ -1646,11 +2875,20 @@ void Texture::init(BaseProject *bp, std::string file) {
 	createTextureSampler();
 }
 
+void Texture::init(BaseProject *bp, const stbi_uc *pixels, int width, int height,
+				   VkFormat imageFormat) {
+	BP = bp;
+	format = imageFormat;
+	createTextureImage(pixels, width, height);
+	createTextureImageView();
+	createTextureSampler();
+}
+
 void Texture::cleanup() {
    	vkDestroySampler(BP->device, textureSampler, nullptr);
    	vkDestroyImageView(BP->device, textureImageView, nullptr);
 	vkDestroyImage(BP->device, textureImage, nullptr);
-	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+	BP->freeDeviceMemory(textureImageMemory);
 }
 
 
@@ -1658,7 +2896,7 @@ void Texture::cleanup() {
 
 
 void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::string& FragShader,
-					std::vector<DescriptorSetLayout *> D) {
+					std::vector<DescriptorSetLayout *> D, VertexFormat format) {
 	BP = bp;
 	
 	auto vertShaderCode = readFile(VertShader);
@@ -1695,11 +2933,13 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType =
 			VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	auto bindingDescription = format == VERTEX_COMPACT ?
+			CompactVertex::getBindingDescription() : Vertex::getBindingDescription();
+	auto attributeDescriptions = format == VERTEX_COMPACT ?
+			CompactVertex::getAttributeDescriptions() : Vertex::getAttributeDescriptions();
 			
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.vertexAttributeDescriptionCount =
+	vertexInputInfo.vertexBindingDescriptionCount = format == VERTEX_IMPOSTOR ? 0 : 1;
+	vertexInputInfo.vertexAttributeDescriptionCount = format == VERTEX_IMPOSTOR ? 0 :
 			static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
 	vertexInputInfo.pVertexAttributeDescriptions =
@@ -1801,6 +3041,18 @@ void Pipeline::init(BaseProject *bp, const std::string& VertShader, const std::s
 	pipelineLayoutInfo.pSetLayouts = DSL.data();
 	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
 	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+
+	// Compact vertices need the decoding constants of their mesh,
+	// impostors the view to draw
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = format == VERTEX_IMPOSTOR ?
+			sizeof(ImpostorDraw) : sizeof(CompactVertexDecode);
+	if (format != VERTEX_FULL) {
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	}
 	
 	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
 				&pipelineLayout);
@@ -1935,10 +3187,10 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	toFree.resize(E.size());
 
 	for (int j = 0; j < E.size(); j++) {
-		uniformBuffers[j].resize(BP->swapChainImages.size());
-		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
+		uniformBuffers[j].resize(BP->framesInFlight());
+		uniformBuffersMemory[j].resize(BP->framesInFlight());
 		if(E[j].type == UNIFORM) {
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+			for (size_t i = 0; i < BP->framesInFlight(); i++) {
 				VkDeviceSize bufferSize = E[j].size;
 				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
@@ -1952,15 +3204,15 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	}
 	
 	// Create Descriptor set
-	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
+	std::vector<VkDescriptorSetLayout> layouts(BP->framesInFlight(),
 											   DSL->descriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = BP->descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(BP->swapChainImages.size());
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(BP->framesInFlight());
 	allocInfo.pSetLayouts = layouts.data();
 	
-	descriptorSets.resize(BP->swapChainImages.size());
+	descriptorSets.resize(BP->framesInFlight());
 	
 	VkResult result = vkAllocateDescriptorSets(BP->device, &allocInfo,
 										descriptorSets.data());
@@ -1969,12 +3221,16 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		throw std::runtime_error("failed to allocate descriptor sets!");
 	}
 	
-	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+	for (size_t i = 0; i < BP->framesInFlight(); i++) {
 		std::vector<VkWriteDescriptorSet> descriptorWrites(E.size());
+		// Must stay alive until vkUpdateDescriptorSets()
+		std::vector<VkDescriptorBufferInfo> bufferInfos(E.size());
+		std::vector<VkDescriptorImageInfo> imageInfos(E.size());
 		for (int j = 0; j < E.size(); j++) {
-			if(E[j].type == UNIFORM) {
-				VkDescriptorBufferInfo bufferInfo{};
-				bufferInfo.buffer = uniformBuffers[j][i];
+			if(E[j].type == UNIFORM || E[j].type == DYNAMIC_UNIFORM) {
+				VkDescriptorBufferInfo &bufferInfo = bufferInfos[j];
+				bufferInfo.buffer = (E[j].type == UNIFORM) ? uniformBuffers[j][i] :
+															 E[j].arena->buffers[i];
 				bufferInfo.offset = 0;
 				bufferInfo.range = E[j].size;
 				
@@ -1982,11 +3238,26 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 				descriptorWrites[j].dstSet = descriptorSets[i];
 				descriptorWrites[j].dstBinding = E[j].binding;
 				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				descriptorWrites[j].descriptorType = (E[j].type == UNIFORM) ?
+											VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+											VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+				descriptorWrites[j].descriptorCount = 1;
+				descriptorWrites[j].pBufferInfo = &bufferInfo;
+			} else if(E[j].type == STORAGE) {
+				VkDescriptorBufferInfo &bufferInfo = bufferInfos[j];
+				bufferInfo.buffer = E[j].storage->buffers[i];
+				bufferInfo.offset = 0;
+				bufferInfo.range = VK_WHOLE_SIZE;
+
+				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[j].dstSet = descriptorSets[i];
+				descriptorWrites[j].dstBinding = E[j].binding;
+				descriptorWrites[j].dstArrayElement = 0;
+				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 				descriptorWrites[j].descriptorCount = 1;
 				descriptorWrites[j].pBufferInfo = &bufferInfo;
 			} else if(E[j].type == TEXTURE) {
-				VkDescriptorImageInfo imageInfo{};
+				VkDescriptorImageInfo &imageInfo = imageInfos[j];
 				imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 				imageInfo.imageView = E[j].tex->textureImageView;
 				imageInfo.sampler = E[j].tex->textureSampler;
@@ -2011,10 +3282,680 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 void DescriptorSet::cleanup() {
 	for(int j = 0; j < uniformBuffers.size(); j++) {
 		if(toFree[j]) {
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+			for (size_t i = 0; i < BP->framesInFlight(); i++) {
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
-				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
+				BP->freeDeviceMemory(uniformBuffersMemory[j][i]);
+			}
+		}
+	}
+	if (BP->freeableDescriptorSets && !descriptorSets.empty()) {
+		vkFreeDescriptorSets(BP->device, BP->descriptorPool,
+							 static_cast<uint32_t>(descriptorSets.size()),
+							 descriptorSets.data());
+		descriptorSets.clear();
+	}
+}
+
+void UniformArena::init(BaseProject *bp, VkDeviceSize elementSize, uint32_t count) {
+	BP = bp;
+	capacity = count;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(BP->physicalDevice, &properties);
+	VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+	stride = (elementSize + alignment - 1) / alignment * alignment;
+
+	buffers.resize(BP->framesInFlight());
+	buffersMemory.resize(BP->framesInFlight());
+	mapped.resize(BP->framesInFlight());
+	for (size_t i = 0; i < BP->framesInFlight(); i++) {
+		BP->createBuffer(stride * std::max(count, 1u), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 buffers[i], buffersMemory[i]);
+		void *data;
+		VkResult result = vkMapMemory(BP->device, buffersMemory[i], 0, VK_WHOLE_SIZE, 0, &data);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to map uniform arena!");
+		}
+		mapped[i] = static_cast<char *>(data);
+	}
+}
+
+void UniformArena::cleanup() {
+	for (size_t i = 0; i < buffers.size(); i++) {
+		vkUnmapMemory(BP->device, buffersMemory[i]);
+		vkDestroyBuffer(BP->device, buffers[i], nullptr);
+		BP->freeDeviceMemory(buffersMemory[i]);
+	}
+}
+
+void StorageBuffer::init(BaseProject *bp, VkDeviceSize bufferSize, VkBufferUsageFlags usage,
+						 bool hostVisible) {
+	BP = bp;
+	size = std::max(bufferSize, VkDeviceSize(4));
+
+	buffers.resize(BP->framesInFlight());
+	buffersMemory.resize(BP->framesInFlight());
+	mapped.assign(BP->framesInFlight(), nullptr);
+	for (size_t i = 0; i < BP->framesInFlight(); i++) {
+		BP->createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | usage,
+						 hostVisible ? (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+										VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) :
+									   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						 buffers[i], buffersMemory[i], true);
+		if (hostVisible) {
+			void *data;
+			VkResult result = vkMapMemory(BP->device, buffersMemory[i], 0, VK_WHOLE_SIZE, 0, &data);
+			if (result != VK_SUCCESS) {
+				PrintVkError(result);
+				throw std::runtime_error("failed to map storage buffer!");
+			}
+			mapped[i] = static_cast<char *>(data);
+		}
+	}
+}
+
+void StorageBuffer::cleanup() {
+	for (size_t i = 0; i < buffers.size(); i++) {
+		if (mapped[i]) {
+			vkUnmapMemory(BP->device, buffersMemory[i]);
+		}
+		vkDestroyBuffer(BP->device, buffers[i], nullptr);
+		BP->freeDeviceMemory(buffersMemory[i]);
+	}
+}
+
+void UploadQueue::init(BaseProject *bp) {
+	BP = bp;
+	QueueFamilyIndices indices = BP->findQueueFamilies(BP->physicalDevice);
+	graphicsFamily = indices.graphicsFamily.value();
+	separateFamily = indices.transferFamily.has_value();
+	family = separateFamily ? indices.transferFamily.value() : graphicsFamily;
+	if (separateFamily) {
+		vkGetDeviceQueue(BP->device, family, 0, &queue);
+		copied = BP->createTimelineSemaphore();
+	} else {
+		queue = BP->graphicsQueue;
+	}
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = family;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	VkResult result = vkCreateCommandPool(BP->device, &poolInfo, nullptr, &pool);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create upload command pool!");
+	}
+}
+
+// Fills a new staging buffer and starts recording the copy
+UploadQueue::Upload &UploadQueue::stage(const void *data, VkDeviceSize size) {
+	pending.emplace_back();
+	Upload &U = pending.back();
+	U.ticket = nextTicket++;
+
+	BP->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 U.staging, U.stagingMemory);
+	void* mapped;
+	VkResult result = vkMapMemory(BP->device, U.stagingMemory, 0, size, 0, &mapped);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to map upload staging buffer!");
+	}
+	memcpy(mapped, data, static_cast<size_t>(size));
+	vkUnmapMemory(BP->device, U.stagingMemory);
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = pool;
+	allocInfo.commandBufferCount = 1;
+	result = vkAllocateCommandBuffers(BP->device, &allocInfo, &U.copyCommands);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	result = vkBeginCommandBuffer(U.copyCommands, &beginInfo);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to begin recording upload command buffer!");
+	}
+	return U;
+}
+
+void UploadQueue::submit(Upload &U) {
+	if (separateFamily) {
+		recordRelease(U.copyCommands, U);
+	} else {
+		recordAcquire(U.copyCommands, U);
+	}
+	VkResult result = vkEndCommandBuffer(U.copyCommands);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &U.copyCommands;
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+	if (separateFamily) {
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &U.ticket;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &copied;
+	}
+
+	result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to submit upload!");
+	}
+	// On the graphics queue the frames submitted later see the copy, and
+	// it is complete with the next of them
+	if (!separateFamily) {
+		U.ready = true;
+		U.doneFrame = BP->frameNumber + 1;
+	}
+}
+
+uint64_t UploadQueue::uploadBuffer(VkBuffer buffer, const void *data, VkDeviceSize size,
+								   VkAccessFlags dstAccess, VkPipelineStageFlags dstStage) {
+	Upload &U = stage(data, size);
+	U.buffer = buffer;
+	U.dstAccess = dstAccess;
+	U.dstStage = dstStage;
+
+	VkBufferCopy region{};
+	region.size = size;
+	vkCmdCopyBuffer(U.copyCommands, U.staging, buffer, 1, &region);
+
+	submit(U);
+	return U.ticket;
+}
+
+uint64_t UploadQueue::uploadTexture(Texture &T, const void *pixels, int width, int height) {
+	Upload &U = stage(pixels, static_cast<VkDeviceSize>(width) * height * 4);
+	U.texture = &T;
+	U.width = width;
+	U.height = height;
+
+	BP->transitionImageLayout(U.copyCommands, T.textureImage, T.format,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, T.mipLevels);
+	BP->copyBufferToImage(U.copyCommands, U.staging, T.textureImage,
+			static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+
+	submit(U);
+	return U.ticket;
+}
+
+// Transfer side of the ownership transfer
+void UploadQueue::recordRelease(VkCommandBuffer commandBuffer, const Upload &U) {
+	if (U.texture) {
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = family;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.image = U.texture->textureImage;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = U.texture->mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+							 0, nullptr, 0, nullptr, 1, &barrier);
+	} else {
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = family;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.buffer = U.buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+							 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+}
+
+// Graphics side: takes the ownership back if it was transferred, then
+// makes the data visible where it is used
+void UploadQueue::recordAcquire(VkCommandBuffer commandBuffer, const Upload &U) {
+	if (U.texture) {
+		if (separateFamily) {
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = family;
+			barrier.dstQueueFamilyIndex = graphicsFamily;
+			barrier.image = U.texture->textureImage;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = U.texture->mipLevels;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = 1;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+								 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+		BP->generateMipmaps(commandBuffer, U.texture->textureImage, U.texture->format,
+							U.width, U.height, U.texture->mipLevels);
+	} else {
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = separateFamily ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = U.dstAccess;
+		barrier.srcQueueFamilyIndex = separateFamily ? family : VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = separateFamily ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = U.buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer,
+							 separateFamily ? U.dstStage : VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 U.dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+}
+
+bool UploadQueue::ready(uint64_t ticket) const {
+	for (const Upload &U : pending) {
+		if (U.ticket == ticket) {
+			return U.ready;
+		}
+	}
+	return true;
+}
+
+void UploadQueue::poll() {
+	uint64_t copiedTicket = separateFamily ? BP->timelineValue(copied) : 0;
+	for (Upload &U : pending) {
+		if (U.ready || U.ticket > copiedTicket) {
+			continue;
+		}
+
+		// The copy is done, so the acquire does not hold up the frames behind it
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = BP->commandPool;
+		allocInfo.commandBufferCount = 1;
+		VkResult result = vkAllocateCommandBuffers(BP->device, &allocInfo, &U.acquireCommands);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to allocate upload acquire command buffer!");
+		}
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		result = vkBeginCommandBuffer(U.acquireCommands, &beginInfo);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to begin recording upload acquire command buffer!");
+		}
+		recordAcquire(U.acquireCommands, U);
+		result = vkEndCommandBuffer(U.acquireCommands);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to record upload acquire command buffer!");
+		}
+
+		VkPipelineStageFlags waitStage = U.texture ? VK_PIPELINE_STAGE_TRANSFER_BIT : U.dstStage;
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues = &U.ticket;
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &copied;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &U.acquireCommands;
+		result = vkQueueSubmit(BP->graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to submit upload acquire!");
+		}
+		// Completed, in queue order, before the next frame signals the timeline
+		U.ready = true;
+		U.doneFrame = BP->frameNumber + 1;
+	}
+
+	// The staging buffers are freed once the GPU is done with them
+	uint64_t completed = BP->framesCompleted();
+	auto finished = [&](Upload &U) {
+		if (!U.ready || completed < U.doneFrame) {
+			return false;
+		}
+		retire(U);
+		return true;
+	};
+	pending.erase(std::remove_if(pending.begin(), pending.end(), finished), pending.end());
+}
+
+void UploadQueue::retire(Upload &U) {
+	vkDestroyBuffer(BP->device, U.staging, nullptr);
+	BP->freeDeviceMemory(U.stagingMemory);
+	vkFreeCommandBuffers(BP->device, pool, 1, &U.copyCommands);
+	if (U.acquireCommands != VK_NULL_HANDLE) {
+		vkFreeCommandBuffers(BP->device, BP->commandPool, 1, &U.acquireCommands);
+	}
+}
+
+void UploadQueue::finish() {
+	// The acquires go to the graphics queue before the frames that use the data
+	if (separateFamily) {
+		BP->waitTimeline(copied, nextTicket - 1);
+	}
+	poll();
+}
+
+void UploadQueue::cleanup() {
+	for (Upload &U : pending) {
+		retire(U);
+	}
+	pending.clear();
+	if (separateFamily) {
+		vkDestroySemaphore(BP->device, copied, nullptr);
+	}
+	vkDestroyCommandPool(BP->device, pool, nullptr);
+}
+
+void FrameLatencyProbe::init(BaseProject *bp) {
+	BP = bp;
+	quit = false;
+	worker = std::thread(&FrameLatencyProbe::workerLoop, this);
+}
+
+void FrameLatencyProbe::frameSubmitted(uint64_t value, Clock::time_point inputTime) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frames.emplace_back(value, inputTime);
+	}
+	wakeUp.notify_one();
+}
+
+FrameTimes::Summary FrameLatencyProbe::summarize() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return latencies.summarize();
+}
+
+void FrameLatencyProbe::reset() {
+	std::lock_guard<std::mutex> lock(mutex);
+	frames.clear();
+	latencies.reset();
+}
+
+// Waits for the frames one at a time, in submission order. A frame already
+// complete when its turn comes (the thread was late, or a reset() dropped
+// its predecessors) is stamped late, so the figures err on the high side.
+void FrameLatencyProbe::workerLoop() {
+	for (;;) {
+		uint64_t value;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [&] { return quit || !frames.empty(); });
+			if (quit) {
+				return;
 			}
+			value = frames.front().first;
+		}
+
+		VkSemaphoreWaitInfoKHR waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &BP->frameTimeline;
+		waitInfo.pValues = &value;
+		VkResult result = BP->vkWaitSemaphoresKHR(BP->device, &waitInfo, LATENCY_PROBE_POLL);
+		if (result == VK_TIMEOUT) {
+			continue;
+		}
+		Clock::time_point now = Clock::now();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		while (result == VK_SUCCESS && !frames.empty() && frames.front().first <= value) {
+			latencies.add(std::chrono::duration<float, std::milli>(now - frames.front().second).count());
+			frames.pop_front();
+		}
+		if (result != VK_SUCCESS) {
+			// The frame loop reports the lost device
+			frames.clear();
+		}
+	}
+}
+
+void FrameLatencyProbe::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeUp.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+	frames.clear();
+	latencies.reset();
+}
+
+void ComputePass::init(BaseProject *bp) {
+	BP = bp;
+	queue = BP->computeQueue;
+	QueueFamilyIndices indices = BP->findQueueFamilies(BP->physicalDevice);
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = BP->asyncCompute ? indices.computeFamily.value() :
+												   indices.graphicsFamily.value();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	VkResult result = vkCreateCommandPool(BP->device, &poolInfo, nullptr, &pool);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create compute command pool!");
+	}
+
+	commandBuffers.resize(BP->framesInFlight());
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = pool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	result = vkAllocateCommandBuffers(BP->device, &allocInfo, commandBuffers.data());
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to allocate compute command buffers!");
+	}
+
+	finished.resize(BP->framesInFlight());
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	for (VkSemaphore &S : finished) {
+		result = vkCreateSemaphore(BP->device, &semaphoreInfo, nullptr, &S);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to create compute semaphore!");
 		}
 	}
+}
+
+// The command buffer of the image is free: the frame that used it last,
+// which waited for it, is done
+void ComputePass::begin(int currentImage) {
+	current = commandBuffers[currentImage];
+	vkResetCommandBuffer(current, 0);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(current, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording compute command buffer!");
+	}
+}
+
+void ComputePass::dispatch(ComputePipeline &P, DescriptorSet &DS, int currentImage,
+						   const void *pushConstants, uint32_t pushConstantSize,
+						   uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ) {
+	vkCmdBindPipeline(current, VK_PIPELINE_BIND_POINT_COMPUTE, P.computePipeline);
+	vkCmdBindDescriptorSets(current, VK_PIPELINE_BIND_POINT_COMPUTE, P.pipelineLayout,
+							0, 1, &DS.descriptorSets[currentImage], 0, nullptr);
+	if (pushConstantSize > 0) {
+		vkCmdPushConstants(current, P.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+						   0, pushConstantSize, pushConstants);
+	}
+	vkCmdDispatch(current, groupsX, groupsY, groupsZ);
+}
+
+void ComputePass::fillBuffer(VkBuffer buffer, uint32_t value) {
+	vkCmdFillBuffer(current, buffer, 0, VK_WHOLE_SIZE, value);
+}
+
+void ComputePass::bufferBarrier(const std::vector<VkBuffer> &buffers,
+								VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+								VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage) {
+	std::vector<VkBufferMemoryBarrier> barriers(buffers.size());
+	for (size_t k = 0; k < buffers.size(); k++) {
+		barriers[k].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barriers[k].srcAccessMask = srcAccess;
+		barriers[k].dstAccessMask = dstAccess;
+		barriers[k].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[k].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[k].buffer = buffers[k];
+		barriers[k].offset = 0;
+		barriers[k].size = VK_WHOLE_SIZE;
+	}
+	vkCmdPipelineBarrier(current, srcStage, dstStage, 0, 0, nullptr,
+						 static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void ComputePass::imageBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+							   uint32_t mipLevels, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+							   VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage) {
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(current, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// The semaphore makes the writes of the pass visible to the draws waiting on it
+void ComputePass::submit(int currentImage) {
+	if (vkEndCommandBuffer(current) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record compute command buffer!");
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &current;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &finished[currentImage];
+	VkResult result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to submit compute pass!");
+	}
+	current = VK_NULL_HANDLE;
+}
+
+void ComputePass::cleanup() {
+	for (VkSemaphore S : finished) {
+		vkDestroySemaphore(BP->device, S, nullptr);
+	}
+	vkDestroyCommandPool(BP->device, pool, nullptr);
+}
+
+void ComputePipeline::init(BaseProject *bp, const std::string& Shader,
+						   std::vector<DescriptorSetLayout *> D, uint32_t pushConstantSize) {
+	BP = bp;
+
+	auto shaderCode = Pipeline::readFile(Shader);
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = shaderCode.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+	VkShaderModule shaderModule;
+	VkResult result = vkCreateShaderModule(BP->device, &moduleInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create shader module!");
+	}
+
+	std::vector<VkDescriptorSetLayout> DSL(D.size());
+	for (size_t i = 0; i < D.size(); i++) {
+		DSL[i] = D[i]->descriptorSetLayout;
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = pushConstantSize;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = DSL.size();
+	pipelineLayoutInfo.pSetLayouts = DSL.data();
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
+									&pipelineLayout);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create compute pipeline layout!");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+
+	result = vkCreateComputePipelines(BP->device, VK_NULL_HANDLE, 1, &pipelineInfo,
+									  nullptr, &computePipeline);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+
+	vkDestroyShaderModule(BP->device, shaderModule, nullptr);
+}
+
+void ComputePipeline::cleanup() {
+	vkDestroyPipeline(BP->device, computePipeline, nullptr);
+	vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
 }
\ No newline at end of file
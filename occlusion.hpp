@@ -0,0 +1,419 @@
+#pragma once
+
+// Software occlusion culling.
+// Occluders (the walls) are rasterized every frame into a small depth
+// buffer on the CPU, then the screen rectangle of the bounding box of each
+// object is tested against it: an object whose nearest point is behind all
+// the pixels it covers cannot be seen.
+// The buffer is split in tiles that are rasterized in parallel, 8 (AVX) or
+// 4 (SSE) pixels at a time, with a scalar path used as reference and on the
+// other architectures. Nothing here needs a GPU: occlusionSelfCheck() runs
+// the whole pipeline on synthetic data (see --check-occlusion).
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "job_system.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define OCCLUSION_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+// Triangle soup in world space
+struct OccluderMesh {
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+// Triangle after setup, in pixel coordinates. A pixel center (x, y) is
+// inside when all the edge functions A * x + B * y + C are >= 0, and its
+// depth (z / w, Vulkan convention) is zA * x + zB * y + zC.
+struct RasterTriangle {
+	float A[3], B[3], C[3];
+	float zA, zB, zC;
+	int minX, minY, maxX, maxY;
+};
+
+struct OcclusionBuffer {
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 144;
+	static constexpr int TILE_WIDTH = 32;
+	static constexpr int TILE_HEIGHT = 16;
+	static constexpr int TILES_X = WIDTH / TILE_WIDTH;
+	static constexpr int TILES_Y = HEIGHT / TILE_HEIGHT;
+
+	std::vector<float> depth;
+	std::vector<RasterTriangle> triangles;
+	std::vector<std::vector<uint32_t>> tileBins;
+
+	// Scalar rasterization and tests, used as reference
+	bool useSimd = true;
+
+	void begin();
+	void addOccluder(const OccluderMesh &mesh, const glm::mat4 &viewProj);
+	void rasterize(JobSystem &jobs);
+	bool isVisible(const glm::mat4 &viewProj, const glm::vec3 &center,
+				   const glm::vec3 &extent) const;
+
+	void setupTriangle(const glm::vec4 *clip);
+	void rasterizeTile(int tile);
+	bool anyPixelBehind(int x0, int y0, int x1, int y1, float z) const;
+};
+
+// Starts a new frame: drops the occluders of the previous one
+inline void OcclusionBuffer::begin() {
+	depth.resize(WIDTH * HEIGHT);
+	triangles.clear();
+	tileBins.resize(TILES_X * TILES_Y);
+	for (auto &bin : tileBins) {
+		bin.clear();
+	}
+}
+
+// Clips a triangle against the near plane, projects it and bins it into
+// the tiles it overlaps
+inline void OcclusionBuffer::setupTriangle(const glm::vec4 *clip) {
+	glm::vec4 poly[4];
+	int n = 0;
+	for (int i = 0; i < 3; i++) {
+		const glm::vec4 &a = clip[i];
+		const glm::vec4 &b = clip[(i + 1) % 3];
+		if (a.z >= 0.0f) {
+			poly[n++] = a;
+		}
+		if ((a.z >= 0.0f) != (b.z >= 0.0f)) {
+			poly[n++] = a + (b - a) * (a.z / (a.z - b.z));
+		}
+	}
+	if (n < 3) {
+		return;
+	}
+
+	glm::vec3 s[4];
+	for (int i = 0; i < n; i++) {
+		float w = std::max(poly[i].w, 1e-6f);
+		s[i] = glm::vec3((poly[i].x / w * 0.5f + 0.5f) * WIDTH,
+						 (poly[i].y / w * 0.5f + 0.5f) * HEIGHT,
+						 poly[i].z / w);
+	}
+
+	// Fan triangulation of the clipped polygon
+	for (int f = 1; f + 1 < n; f++) {
+		glm::vec3 v[3] = { s[0], s[f], s[f + 1] };
+		float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) -
+					 (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (std::abs(area) < 1e-8f) {
+			continue;
+		}
+		// Both faces of the walls are occluders: make every triangle
+		// counter clockwise
+		if (area < 0.0f) {
+			std::swap(v[1], v[2]);
+			area = -area;
+		}
+
+		RasterTriangle T;
+		for (int e = 0; e < 3; e++) {
+			const glm::vec3 &a = v[e];
+			const glm::vec3 &b = v[(e + 1) % 3];
+			T.A[e] = a.y - b.y;
+			T.B[e] = b.x - a.x;
+			T.C[e] = -(T.A[e] * a.x + T.B[e] * a.y);
+		}
+		T.zA = ((v[1].z - v[0].z) * (v[2].y - v[0].y) -
+				(v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+		T.zB = ((v[2].z - v[0].z) * (v[1].x - v[0].x) -
+				(v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+		T.zC = v[0].z - T.zA * v[0].x - T.zB * v[0].y;
+
+		float minX = std::min({v[0].x, v[1].x, v[2].x});
+		float maxX = std::max({v[0].x, v[1].x, v[2].x});
+		float minY = std::min({v[0].y, v[1].y, v[2].y});
+		float maxY = std::max({v[0].y, v[1].y, v[2].y});
+		if (maxX < 0.0f || maxY < 0.0f || minX > WIDTH || minY > HEIGHT) {
+			continue;
+		}
+		T.minX = std::max(0, static_cast<int>(std::floor(minX)));
+		T.minY = std::max(0, static_cast<int>(std::floor(minY)));
+		T.maxX = std::min(WIDTH, static_cast<int>(std::ceil(maxX)));
+		T.maxY = std::min(HEIGHT, static_cast<int>(std::ceil(maxY)));
+		if (T.minX >= T.maxX || T.minY >= T.maxY) {
+			continue;
+		}
+
+		uint32_t index = static_cast<uint32_t>(triangles.size());
+		triangles.push_back(T);
+		for (int ty = T.minY / TILE_HEIGHT; ty <= (T.maxY - 1) / TILE_HEIGHT; ty++) {
+			for (int tx = T.minX / TILE_WIDTH; tx <= (T.maxX - 1) / TILE_WIDTH; tx++) {
+				tileBins[ty * TILES_X + tx].push_back(index);
+			}
+		}
+	}
+}
+
+inline void OcclusionBuffer::addOccluder(const OccluderMesh &mesh, const glm::mat4 &viewProj) {
+	std::vector<glm::vec4> clip(mesh.positions.size());
+	for (size_t i = 0; i < mesh.positions.size(); i++) {
+		clip[i] = viewProj * glm::vec4(mesh.positions[i], 1.0f);
+	}
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		glm::vec4 tri[3] = { clip[mesh.indices[i]], clip[mesh.indices[i + 1]],
+							 clip[mesh.indices[i + 2]] };
+		setupTriangle(tri);
+	}
+}
+
+inline void OcclusionBuffer::rasterizeTile(int tile) {
+	const int tx0 = (tile % TILES_X) * TILE_WIDTH;
+	const int ty0 = (tile / TILES_X) * TILE_HEIGHT;
+
+	for (int y = ty0; y < ty0 + TILE_HEIGHT; y++) {
+		std::fill(&depth[y * WIDTH + tx0], &depth[y * WIDTH + tx0] + TILE_WIDTH, 1.0f);
+	}
+
+	for (uint32_t index : tileBins[tile]) {
+		const RasterTriangle &T = triangles[index];
+		const int y0 = std::max(ty0, T.minY), y1 = std::min(ty0 + TILE_HEIGHT, T.maxY);
+		int x0 = std::max(tx0, T.minX);
+		const int x1 = std::min(tx0 + TILE_WIDTH, T.maxX);
+
+#if defined(OCCLUSION_AVX)
+		if (useSimd) {
+			// Whole groups of 8 pixels, aligned to the tile
+			x0 = tx0 + ((x0 - tx0) & ~7);
+			const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+			const __m256 zero = _mm256_setzero_ps();
+			__m256 A0 = _mm256_set1_ps(T.A[0]), A1 = _mm256_set1_ps(T.A[1]);
+			__m256 A2 = _mm256_set1_ps(T.A[2]), zA = _mm256_set1_ps(T.zA);
+			for (int y = y0; y < y1; y++) {
+				float fy = y + 0.5f;
+				__m256 R0 = _mm256_set1_ps(T.B[0] * fy + T.C[0]);
+				__m256 R1 = _mm256_set1_ps(T.B[1] * fy + T.C[1]);
+				__m256 R2 = _mm256_set1_ps(T.B[2] * fy + T.C[2]);
+				__m256 Rz = _mm256_set1_ps(T.zB * fy + T.zC);
+				for (int x = x0; x < x1; x += 8) {
+					__m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lane);
+					__m256 inside = _mm256_and_ps(
+						_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(A0, px), R0), zero, _CMP_GE_OQ),
+						_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(A1, px), R1), zero, _CMP_GE_OQ));
+					inside = _mm256_and_ps(inside,
+						_mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(A2, px), R2), zero, _CMP_GE_OQ));
+					if (_mm256_movemask_ps(inside) == 0) {
+						continue;
+					}
+					float *dst = &depth[y * WIDTH + x];
+					__m256 d = _mm256_loadu_ps(dst);
+					__m256 z = _mm256_add_ps(_mm256_mul_ps(zA, px), Rz);
+					_mm256_storeu_ps(dst, _mm256_blendv_ps(d, _mm256_min_ps(d, z), inside));
+				}
+			}
+			continue;
+		}
+#elif defined(OCCLUSION_SSE)
+		if (useSimd) {
+			// Whole groups of 4 pixels, aligned to the tile
+			x0 = tx0 + ((x0 - tx0) & ~3);
+			const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 zero = _mm_setzero_ps();
+			__m128 A0 = _mm_set1_ps(T.A[0]), A1 = _mm_set1_ps(T.A[1]);
+			__m128 A2 = _mm_set1_ps(T.A[2]), zA = _mm_set1_ps(T.zA);
+			for (int y = y0; y < y1; y++) {
+				float fy = y + 0.5f;
+				__m128 R0 = _mm_set1_ps(T.B[0] * fy + T.C[0]);
+				__m128 R1 = _mm_set1_ps(T.B[1] * fy + T.C[1]);
+				__m128 R2 = _mm_set1_ps(T.B[2] * fy + T.C[2]);
+				__m128 Rz = _mm_set1_ps(T.zB * fy + T.zC);
+				for (int x = x0; x < x1; x += 4) {
+					__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane);
+					__m128 inside = _mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(A0, px), R0), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(A1, px), R1), zero));
+					inside = _mm_and_ps(inside,
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(A2, px), R2), zero));
+					if (_mm_movemask_ps(inside) == 0) {
+						continue;
+					}
+					float *dst = &depth[y * WIDTH + x];
+					__m128 d = _mm_loadu_ps(dst);
+					__m128 z = _mm_min_ps(d, _mm_add_ps(_mm_mul_ps(zA, px), Rz));
+					_mm_storeu_ps(dst, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, d)));
+				}
+			}
+			continue;
+		}
+#endif
+
+		for (int y = y0; y < y1; y++) {
+			float fy = y + 0.5f;
+			float R0 = T.B[0] * fy + T.C[0];
+			float R1 = T.B[1] * fy + T.C[1];
+			float R2 = T.B[2] * fy + T.C[2];
+			float Rz = T.zB * fy + T.zC;
+			for (int x = x0; x < x1; x++) {
+				float px = x + 0.5f;
+				if (T.A[0] * px + R0 >= 0.0f && T.A[1] * px + R1 >= 0.0f &&
+					T.A[2] * px + R2 >= 0.0f) {
+					float &d = depth[y * WIDTH + x];
+					d = std::min(d, T.zA * px + Rz);
+				}
+			}
+		}
+	}
+}
+
+// Tiles do not share pixels, so they are rasterized by all the threads
+inline void OcclusionBuffer::rasterize(JobSystem &jobs) {
+	jobs.parallelFor(TILES_X * TILES_Y, [this](int tile, int) {
+		rasterizeTile(tile);
+	});
+}
+
+// True if some pixel of the rectangle is not closer than z
+inline bool OcclusionBuffer::anyPixelBehind(int x0, int y0, int x1, int y1, float z) const {
+	for (int y = y0; y < y1; y++) {
+		const float *row = &depth[y * WIDTH];
+		int x = x0;
+#if defined(OCCLUSION_AVX)
+		if (useSimd) {
+			__m256 vz = _mm256_set1_ps(z);
+			for (; x + 8 <= x1; x += 8) {
+				if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + x), vz, _CMP_GE_OQ))) {
+					return true;
+				}
+			}
+		}
+#elif defined(OCCLUSION_SSE)
+		if (useSimd) {
+			__m128 vz = _mm_set1_ps(z);
+			for (; x + 4 <= x1; x += 4) {
+				if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), vz))) {
+					return true;
+				}
+			}
+		}
+#endif
+		for (; x < x1; x++) {
+			if (row[x] >= z) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Tests a world space AABB (center / half extent) against the rasterized
+// occluders. Boxes crossing the near plane are always visible.
+inline bool OcclusionBuffer::isVisible(const glm::mat4 &viewProj, const glm::vec3 &center,
+									   const glm::vec3 &extent) const {
+	float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+	float minZ = 1e30f;
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner = center + extent * glm::vec3((i & 1) ? 1.0f : -1.0f,
+													   (i & 2) ? 1.0f : -1.0f,
+													   (i & 4) ? 1.0f : -1.0f);
+		glm::vec4 c = viewProj * glm::vec4(corner, 1.0f);
+		if (c.z < 0.0f) {
+			return true;
+		}
+		float x = (c.x / c.w * 0.5f + 0.5f) * WIDTH;
+		float y = (c.y / c.w * 0.5f + 0.5f) * HEIGHT;
+		minX = std::min(minX, x); maxX = std::max(maxX, x);
+		minY = std::min(minY, y); maxY = std::max(maxY, y);
+		minZ = std::min(minZ, c.z / c.w);
+	}
+
+	int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+	int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+	int x1 = std::min(WIDTH, static_cast<int>(std::ceil(maxX)));
+	int y1 = std::min(HEIGHT, static_cast<int>(std::ceil(maxY)));
+	if (x0 >= x1 || y0 >= y1) {
+		// Off screen: it is up to the frustum test
+		return true;
+	}
+	return anyPixelBehind(x0, y0, x1, y1, minZ);
+}
+
+// Checks the SIMD paths against the scalar ones on random triangles, and a
+// few boxes with a known answer behind and around a wall. Returns true if
+// everything matches.
+inline bool occlusionSelfCheck(JobSystem &jobs) {
+	bool ok = true;
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 10.0f);
+	proj[1][1] *= -1;
+	glm::mat4 viewProj = proj * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+											glm::vec3(0.0f, 1.0f, 0.0f));
+
+	// Random triangles, some of them crossing the near plane
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> xy(-6.0f, 6.0f), z(-9.0f, 0.5f);
+	OccluderMesh random;
+	for (int i = 0; i < 3 * 500; i++) {
+		random.positions.push_back(glm::vec3(xy(rng), xy(rng), z(rng)));
+		random.indices.push_back(i);
+	}
+
+	OcclusionBuffer simd, scalar;
+	scalar.useSimd = false;
+	for (OcclusionBuffer *B : { &simd, &scalar }) {
+		B->begin();
+		B->addOccluder(random, viewProj);
+		B->rasterize(jobs);
+	}
+	int mismatches = 0;
+	for (size_t i = 0; i < simd.depth.size(); i++) {
+		if (std::abs(simd.depth[i] - scalar.depth[i]) > 1e-5f) {
+			mismatches++;
+		}
+	}
+	// Pixel centers lying exactly on an edge may be decided differently
+	// if the compiler contracts the scalar code to FMAs
+	bool rasterOk = mismatches <= static_cast<int>(simd.depth.size() / 1000);
+	std::printf("occlusion: %zu triangles, %d / %zu pixels differ from the scalar path: %s\n",
+				simd.triangles.size(), mismatches, simd.depth.size(), rasterOk ? "ok" : "FAILED");
+	ok = ok && rasterOk;
+
+	// A 6 x 4 wall 5 units in front of the camera
+	OccluderMesh wall;
+	wall.positions = { {-3.0f, -2.0f, -5.0f}, {3.0f, -2.0f, -5.0f},
+					   {3.0f, 2.0f, -5.0f}, {-3.0f, 2.0f, -5.0f} };
+	wall.indices = { 0, 1, 2, 0, 2, 3 };
+
+	struct Case {
+		const char *name;
+		glm::vec3 center, extent;
+		bool visible;
+	} cases[] = {
+		{ "behind the wall", {0.0f, 0.0f, -8.0f}, {0.5f, 0.5f, 0.5f}, false },
+		{ "in front of the wall", {0.0f, 0.0f, -3.0f}, {0.5f, 0.5f, 0.5f}, true },
+		{ "behind, past the edge", {5.5f, 0.0f, -8.0f}, {0.3f, 0.3f, 0.3f}, true },
+		{ "across the near plane", {0.0f, 0.0f, 0.0f}, {0.5f, 0.5f, 0.5f}, true },
+		{ "touching the wall", {0.0f, 0.0f, -5.2f}, {0.3f, 0.3f, 0.3f}, true },
+	};
+	bool boxesOk = true;
+	for (OcclusionBuffer *B : { &simd, &scalar }) {
+		B->begin();
+		B->addOccluder(wall, viewProj);
+		B->rasterize(jobs);
+		for (const Case &c : cases) {
+			bool visible = B->isVisible(viewProj, c.center, c.extent);
+			if (visible != c.visible) {
+				std::printf("occlusion: box %s (%s): expected %s\n", c.name,
+							B->useSimd ? "simd" : "scalar", c.visible ? "visible" : "occluded");
+				boxesOk = false;
+			}
+		}
+	}
+	std::printf("occlusion: box tests %s\n", boxesOk ? "ok" : "FAILED");
+	return ok && boxesOk;
+}
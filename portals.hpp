@@ -0,0 +1,212 @@
+#pragma once
+
+// Room / portal visibility.
+// The building is described as a set of rooms (rectangles on the XZ plane)
+// connected by portals (the doorways, vertical rectangles in the walls).
+// Starting from the room of the camera, the rooms are visited through the
+// portals whose projection overlaps the part of the screen seen so far:
+// all the other rooms are hidden behind walls and do not need to be drawn.
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+// Axis aligned rectangle in normalized device coordinates
+struct ScreenRect {
+	float minX = -1.0f, minY = -1.0f;
+	float maxX = 1.0f, maxY = 1.0f;
+
+	bool empty() const { return minX >= maxX || minY >= maxY; }
+};
+
+inline ScreenRect intersectRects(const ScreenRect &a, const ScreenRect &b) {
+	ScreenRect r;
+	r.minX = std::max(a.minX, b.minX); r.minY = std::max(a.minY, b.minY);
+	r.maxX = std::min(a.maxX, b.maxX); r.maxY = std::min(a.maxY, b.maxY);
+	return r;
+}
+
+inline ScreenRect uniteRects(const ScreenRect &a, const ScreenRect &b) {
+	ScreenRect r;
+	r.minX = std::min(a.minX, b.minX); r.minY = std::min(a.minY, b.minY);
+	r.maxX = std::max(a.maxX, b.maxX); r.maxY = std::max(a.maxY, b.maxY);
+	return r;
+}
+
+struct PortalRoom {
+	float minX, minZ;
+	float maxX, maxZ;
+};
+
+// A doorway between two rooms: the wall segment from -> to (on the XZ
+// plane), open between minY and maxY
+struct Portal {
+	int rooms[2];
+	glm::vec2 from, to;
+	float minY, maxY;
+};
+
+struct PortalGraph {
+	// Room 0 is the outside, that is everything not covered by another room
+	std::vector<PortalRoom> rooms;
+	std::vector<Portal> portals;
+	std::vector<std::vector<int>> roomPortals;
+
+	// Distance from a doorway under which it is considered fully open,
+	// must be larger than the near plane of the camera
+	float doorwayMargin = 0.25f;
+
+	void clear();
+	int addRoom(float minX, float minZ, float maxX, float maxZ);
+	void addPortal(int roomA, int roomB, glm::vec2 from, glm::vec2 to, float minY, float maxY);
+
+	int roomCount() const { return static_cast<int>(rooms.size()); }
+	int roomAt(float x, float z) const;
+
+	bool projectPortal(const Portal &P, const glm::mat4 &viewProj, const glm::vec3 &eye,
+					   ScreenRect &rect) const;
+	int findVisibleRooms(const glm::mat4 &viewProj, const glm::vec3 &eye,
+						 std::vector<uint8_t> &visible) const;
+};
+
+inline void PortalGraph::clear() {
+	rooms.assign(1, PortalRoom{0.0f, 0.0f, 0.0f, 0.0f});
+	portals.clear();
+	roomPortals.assign(1, {});
+}
+
+inline int PortalGraph::addRoom(float minX, float minZ, float maxX, float maxZ) {
+	if (rooms.empty()) {
+		clear();
+	}
+	rooms.push_back({minX, minZ, maxX, maxZ});
+	roomPortals.push_back({});
+	return static_cast<int>(rooms.size()) - 1;
+}
+
+inline void PortalGraph::addPortal(int roomA, int roomB, glm::vec2 from, glm::vec2 to,
+								   float minY, float maxY) {
+	portals.push_back({{roomA, roomB}, from, to, minY, maxY});
+	roomPortals[roomA].push_back(static_cast<int>(portals.size()) - 1);
+	roomPortals[roomB].push_back(static_cast<int>(portals.size()) - 1);
+}
+
+inline int PortalGraph::roomAt(float x, float z) const {
+	for (size_t r = 1; r < rooms.size(); r++) {
+		const PortalRoom &R = rooms[r];
+		if (R.minX <= x && x < R.maxX && R.minZ <= z && z < R.maxZ) {
+			return static_cast<int>(r);
+		}
+	}
+	return 0;
+}
+
+// Screen area covered by a portal. Returns false if it is behind the camera.
+inline bool PortalGraph::projectPortal(const Portal &P, const glm::mat4 &viewProj,
+									   const glm::vec3 &eye, ScreenRect &rect) const {
+	// Standing in the doorway: the near plane would cut the portal away,
+	// but everything on the other side can be seen
+	glm::vec2 e(eye.x, eye.z);
+	glm::vec2 d = P.to - P.from;
+	float len = glm::length(d);
+	d /= len;
+	float along = glm::dot(e - P.from, d);
+	float across = std::abs(d.x * (e.y - P.from.y) - d.y * (e.x - P.from.x));
+	if (across < doorwayMargin && along > -doorwayMargin && along < len + doorwayMargin &&
+		eye.y > P.minY - doorwayMargin && eye.y < P.maxY + doorwayMargin) {
+		rect = ScreenRect();
+		return true;
+	}
+
+	glm::vec4 in[4] = {
+		viewProj * glm::vec4(P.from.x, P.minY, P.from.y, 1.0f),
+		viewProj * glm::vec4(P.to.x, P.minY, P.to.y, 1.0f),
+		viewProj * glm::vec4(P.to.x, P.maxY, P.to.y, 1.0f),
+		viewProj * glm::vec4(P.from.x, P.maxY, P.from.y, 1.0f)
+	};
+
+	// Clipping against the near plane (z >= 0 in Vulkan clip space)
+	glm::vec4 out[5];
+	int n = 0;
+	for (int i = 0; i < 4; i++) {
+		const glm::vec4 &a = in[i];
+		const glm::vec4 &b = in[(i + 1) % 4];
+		if (a.z >= 0.0f) {
+			out[n++] = a;
+		}
+		if ((a.z >= 0.0f) != (b.z >= 0.0f)) {
+			out[n++] = a + (b - a) * (a.z / (a.z - b.z));
+		}
+	}
+	if (n == 0) {
+		return false;
+	}
+
+	rect.minX = rect.minY = 1e30f;
+	rect.maxX = rect.maxY = -1e30f;
+	for (int i = 0; i < n; i++) {
+		float w = std::max(out[i].w, 1e-6f);
+		float x = out[i].x / w, y = out[i].y / w;
+		rect.minX = std::min(rect.minX, x); rect.maxX = std::max(rect.maxX, x);
+		rect.minY = std::min(rect.minY, y); rect.maxY = std::max(rect.maxY, y);
+	}
+	return true;
+}
+
+// Flood fill from the room of the camera. Every room keeps the union of the
+// screen areas through which it has been reached, and it is visited again
+// whenever that area grows. Sets visible[r] = 1 for the rooms that can be
+// seen, and returns how many they are.
+inline int PortalGraph::findVisibleRooms(const glm::mat4 &viewProj, const glm::vec3 &eye,
+										 std::vector<uint8_t> &visible) const {
+	visible.assign(rooms.size(), 0);
+	std::vector<ScreenRect> reached(rooms.size());
+	std::vector<uint8_t> queued(rooms.size(), 0);
+	std::vector<int> queue;
+
+	int start = roomAt(eye.x, eye.z);
+	visible[start] = 1;
+	queued[start] = 1;
+	queue.push_back(start);
+	int count = 1;
+
+	while (!queue.empty()) {
+		int r = queue.back();
+		queue.pop_back();
+		queued[r] = 0;
+
+		for (int p : roomPortals[r]) {
+			const Portal &P = portals[p];
+			int other = P.rooms[0] == r ? P.rooms[1] : P.rooms[0];
+
+			ScreenRect rect;
+			if (!projectPortal(P, viewProj, eye, rect)) {
+				continue;
+			}
+			rect = intersectRects(rect, reached[r]);
+			if (rect.empty()) {
+				continue;
+			}
+
+			if (!visible[other]) {
+				visible[other] = 1;
+				reached[other] = rect;
+				count++;
+			} else {
+				ScreenRect grown = uniteRects(reached[other], rect);
+				if (grown.minX >= reached[other].minX && grown.maxX <= reached[other].maxX &&
+					grown.minY >= reached[other].minY && grown.maxY <= reached[other].maxY) {
+					continue;
+				}
+				reached[other] = grown;
+			}
+			if (!queued[other]) {
+				queued[other] = 1;
+				queue.push_back(other);
+			}
+		}
+	}
+	return count;
+}
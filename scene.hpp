@@ -0,0 +1,276 @@
+#pragma once
+
+// Scene description loaded from a JSON file (see scenes/museum.json):
+// meshes and textures by name, the rooms and doorways of the floor plan,
+// and the placed object instances.
+// Instances are kept as parallel arrays sorted by room, mesh and texture:
+// the objects of a room are contiguous, and consecutive draws share their
+// buffers and descriptor sets as much as possible.
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <json.hpp>
+
+#include "portals.hpp"
+
+struct SceneRoom {
+	glm::vec2 min, max;		// X and Z
+};
+
+struct SceneDoorway {
+	int rooms[2];
+	glm::vec2 from, to;		// X and Z
+	float minY, maxY;
+};
+
+struct SceneInstances {
+	std::vector<uint32_t> mesh;
+	std::vector<uint32_t> texture;
+	std::vector<uint32_t> room;			// 0: outside, or the building itself
+	std::vector<glm::vec3> position;
+	std::vector<float> rotation;		// degrees around Y
+	std::vector<glm::vec3> scale;
+	std::vector<uint8_t> card;			// raised out of sight while the cards of its room are hidden
+	std::vector<uint8_t> occluder;		// rasterized by the occlusion culling
+	std::vector<uint8_t> statue;		// drawn as an impostor from far away (see impostors.hpp)
+
+	size_t size() const { return mesh.size(); }
+	void resize(size_t n) {
+		mesh.resize(n); texture.resize(n); room.resize(n);
+		position.resize(n); rotation.resize(n); scale.resize(n);
+		card.resize(n); occluder.resize(n); statue.resize(n);
+	}
+};
+
+struct Scene {
+	std::vector<std::string> meshNames, meshFiles;
+	std::vector<std::string> textureNames, textureFiles;
+	std::vector<SceneRoom> rooms;		// room r is rooms[r - 1]
+	std::vector<SceneDoorway> doorways;
+	SceneInstances instances;
+
+	// The instances of room r are [roomFirst[r], roomFirst[r + 1])
+	std::vector<uint32_t> roomFirst;
+
+	void load(const std::string &file);
+	void save(const std::string &file) const;
+	void sortInstances();
+	void buildPortalGraph(PortalGraph &G) const;
+
+	int roomCount() const { return static_cast<int>(rooms.size()) + 1; }
+};
+
+inline uint32_t sceneIndexOf(const std::vector<std::string> &names, const std::string &name,
+							 const char *what) {
+	auto it = std::find(names.begin(), names.end(), name);
+	if (it == names.end()) {
+		throw std::runtime_error(std::string("scene: unknown ") + what + " '" + name + "'");
+	}
+	return static_cast<uint32_t>(it - names.begin());
+}
+
+inline glm::vec2 sceneVec2(const nlohmann::json &j) {
+	return glm::vec2(j.at(0).get<float>(), j.at(1).get<float>());
+}
+
+inline glm::vec3 sceneVec3(const nlohmann::json &j) {
+	return glm::vec3(j.at(0).get<float>(), j.at(1).get<float>(), j.at(2).get<float>());
+}
+
+inline void Scene::load(const std::string &file) {
+	std::ifstream in(file);
+	if (!in) {
+		throw std::runtime_error("failed to open scene " + file + "!");
+	}
+
+	using nlohmann::json;
+	json J;
+	try {
+		J = json::parse(in);
+
+		for (auto &m : J.at("meshes").items()) {
+			meshNames.push_back(m.key());
+			meshFiles.push_back(m.value().get<std::string>());
+		}
+		for (auto &t : J.at("textures").items()) {
+			textureNames.push_back(t.key());
+			textureFiles.push_back(t.value().get<std::string>());
+		}
+
+		for (auto &r : J.value("rooms", json::array())) {
+			rooms.push_back({ sceneVec2(r.at("min")), sceneVec2(r.at("max")) });
+		}
+		for (auto &d : J.value("doorways", json::array())) {
+			SceneDoorway D;
+			D.rooms[0] = d.at("rooms").at(0).get<int>();
+			D.rooms[1] = d.at("rooms").at(1).get<int>();
+			D.from = sceneVec2(d.at("from"));
+			D.to = sceneVec2(d.at("to"));
+			D.minY = d.at("height").at(0).get<float>();
+			D.maxY = d.at("height").at(1).get<float>();
+			if (D.rooms[0] < 0 || D.rooms[0] >= roomCount() ||
+				D.rooms[1] < 0 || D.rooms[1] >= roomCount()) {
+				throw std::runtime_error("scene: doorway to an unknown room");
+			}
+			doorways.push_back(D);
+		}
+
+		const json &I = J.at("instances");
+		instances.resize(I.size());
+		for (size_t i = 0; i < I.size(); i++) {
+			const json &e = I[i];
+			instances.mesh[i] = sceneIndexOf(meshNames, e.at("mesh").get<std::string>(), "mesh");
+			instances.texture[i] = sceneIndexOf(textureNames, e.at("texture").get<std::string>(),
+												"texture");
+			instances.room[i] = e.value("room", 0u);
+			if (instances.room[i] >= static_cast<uint32_t>(roomCount())) {
+				throw std::runtime_error("scene: instance in an unknown room");
+			}
+			instances.position[i] = e.contains("position") ? sceneVec3(e["position"]) : glm::vec3(0.0f);
+			instances.rotation[i] = e.value("rotation", 0.0f);
+			if (!e.contains("scale")) {
+				instances.scale[i] = glm::vec3(1.0f);
+			} else if (e["scale"].is_number()) {
+				instances.scale[i] = glm::vec3(e["scale"].get<float>());
+			} else {
+				instances.scale[i] = sceneVec3(e["scale"]);
+			}
+			instances.card[i] = e.value("card", false) ? 1 : 0;
+			instances.occluder[i] = e.value("occluder", false) ? 1 : 0;
+			instances.statue[i] = e.value("statue", false) ? 1 : 0;
+		}
+	} catch (const json::exception &e) {
+		throw std::runtime_error("failed to read scene " + file + ": " + e.what());
+	}
+
+	sortInstances();
+}
+
+// Floats rounded to a few decimals, so that saved scenes stay readable
+inline double sceneNumber(float v) {
+	return std::round(static_cast<double>(v) * 1e5) / 1e5;
+}
+
+// One room, doorway or instance per line
+inline void Scene::save(const std::string &file) const {
+	using nlohmann::json;
+	auto pair = [](glm::vec2 v) { return json::array({ sceneNumber(v.x), sceneNumber(v.y) }); };
+	auto triple = [](glm::vec3 v) {
+		return json::array({ sceneNumber(v.x), sceneNumber(v.y), sceneNumber(v.z) });
+	};
+
+	json meshes = json::object(), textures = json::object();
+	for (size_t m = 0; m < meshNames.size(); m++) {
+		meshes[meshNames[m]] = meshFiles[m];
+	}
+	for (size_t t = 0; t < textureNames.size(); t++) {
+		textures[textureNames[t]] = textureFiles[t];
+	}
+
+	std::vector<json> roomLines, doorwayLines, instanceLines;
+	for (const SceneRoom &R : rooms) {
+		json r;
+		r["min"] = pair(R.min);
+		r["max"] = pair(R.max);
+		roomLines.push_back(r);
+	}
+	for (const SceneDoorway &D : doorways) {
+		json d;
+		d["rooms"] = json::array({ D.rooms[0], D.rooms[1] });
+		d["from"] = pair(D.from);
+		d["to"] = pair(D.to);
+		d["height"] = json::array({ sceneNumber(D.minY), sceneNumber(D.maxY) });
+		doorwayLines.push_back(d);
+	}
+	const SceneInstances &I = instances;
+	for (size_t i = 0; i < I.size(); i++) {
+		json e;
+		e["mesh"] = meshNames[I.mesh[i]];
+		e["texture"] = textureNames[I.texture[i]];
+		e["room"] = I.room[i];
+		e["position"] = triple(I.position[i]);
+		e["rotation"] = sceneNumber(I.rotation[i]);
+		e["scale"] = triple(I.scale[i]);
+		if (I.card[i]) {
+			e["card"] = true;
+		}
+		if (I.occluder[i]) {
+			e["occluder"] = true;
+		}
+		if (I.statue[i]) {
+			e["statue"] = true;
+		}
+		instanceLines.push_back(e);
+	}
+
+	std::ofstream out(file);
+	if (!out) {
+		throw std::runtime_error("failed to write scene " + file + "!");
+	}
+	auto array = [&out](const char *name, const std::vector<json> &lines, bool last) {
+		out << "\t\"" << name << "\": [\n";
+		for (size_t i = 0; i < lines.size(); i++) {
+			out << "\t\t" << lines[i].dump() << (i + 1 < lines.size() ? ",\n" : "\n");
+		}
+		out << "\t]" << (last ? "\n" : ",\n");
+	};
+	out << "{\n";
+	out << "\t\"meshes\": " << meshes.dump() << ",\n";
+	out << "\t\"textures\": " << textures.dump() << ",\n";
+	array("rooms", roomLines, false);
+	array("doorways", doorwayLines, false);
+	array("instances", instanceLines, true);
+	out << "}\n";
+}
+
+inline void Scene::sortInstances() {
+	const SceneInstances &I = instances;
+	std::vector<uint32_t> order(I.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		if (I.room[a] != I.room[b]) return I.room[a] < I.room[b];
+		if (I.mesh[a] != I.mesh[b]) return I.mesh[a] < I.mesh[b];
+		return I.texture[a] < I.texture[b];
+	});
+
+	SceneInstances sorted;
+	sorted.resize(I.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		uint32_t o = order[i];
+		sorted.mesh[i] = I.mesh[o];
+		sorted.texture[i] = I.texture[o];
+		sorted.room[i] = I.room[o];
+		sorted.position[i] = I.position[o];
+		sorted.rotation[i] = I.rotation[o];
+		sorted.scale[i] = I.scale[o];
+		sorted.card[i] = I.card[o];
+		sorted.occluder[i] = I.occluder[o];
+		sorted.statue[i] = I.statue[o];
+	}
+	instances = std::move(sorted);
+
+	roomFirst.assign(roomCount() + 1, 0);
+	for (uint32_t r : instances.room) {
+		roomFirst[r + 1]++;
+	}
+	for (int r = 0; r < roomCount(); r++) {
+		roomFirst[r + 1] += roomFirst[r];
+	}
+}
+
+inline void Scene::buildPortalGraph(PortalGraph &G) const {
+	G.clear();
+	for (const SceneRoom &R : rooms) {
+		G.addRoom(R.min.x, R.min.y, R.max.x, R.max.y);
+	}
+	for (const SceneDoorway &D : doorways) {
+		G.addPortal(D.rooms[0], D.rooms[1], D.from, D.to, D.minY, D.maxY);
+	}
+}
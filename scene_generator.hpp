@@ -0,0 +1,285 @@
+#pragma once
+
+// Procedural museums for scale testing (see --generate).
+// Rooms are laid out on a grid, every wall between two rooms has a door in
+// the middle and the first room also opens to the outside, in front of the
+// starting position of the camera. Walls are built from Rectangle.obj
+// quads, one per side, each one belonging to the room it faces, so that
+// the portal culling hides them with the rest of the room. Every wall gets
+// the same number of paintings (with their cards) on its inner side, and
+// the statues are spread over the rooms.
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "scene.hpp"
+
+struct MuseumGenerator {
+	// Rectangle.obj spans [-2.002256, 2.002256] x [-1, 1] on the XY plane,
+	// facing +Z; Floor.obj is 9 x 5 on the XZ plane
+	static constexpr float QUAD_WIDTH = 4.004512f;
+	static constexpr float QUAD_HEIGHT = 2.0f;
+	static constexpr float FLOOR_WIDTH = 9.0f;
+	static constexpr float FLOOR_DEPTH = 5.0f;
+	static constexpr float FLOOR_CENTER_X = 0.012389f;
+
+	static constexpr float FLOOR_Y = 0.03f;
+	static constexpr float WALL_HEIGHT = 2.0f;
+	static constexpr float DOOR_WIDTH = 0.5f;
+	static constexpr float DOOR_HEIGHT = 1.0f;
+	// Every wall is split in slots, one of them is the door
+	static constexpr float SLOT_WIDTH = 1.2f;
+	static constexpr float MIN_ROOM_SIZE = 3.0f;
+
+	static constexpr float PAINTING_SCALE = 0.25f;
+	static constexpr float PAINTING_Y = 1.0f;
+	static constexpr float CARD_SCALE = 0.07f;
+	static constexpr float CARD_Y = 0.45f;
+	static constexpr float WALL_GAP = 0.03f;
+
+	Scene &S;
+	int roomCount, paintingsPerWall, statueCount;
+	int columns, rows;
+	float roomSize;
+	float doorAt;			// distance of the door center from the start of a wall
+	glm::vec2 origin;		// corner of room 1 (maximum X, minimum Z)
+	uint32_t paintingsPlaced = 0;
+
+	MuseumGenerator(Scene &scene, int rooms, int paintings, int statues);
+
+	void generate();
+
+	int roomAtCell(int row, int column) const;
+	glm::vec2 cellMin(int row, int column) const;
+
+	uint32_t addInstance(const std::string &mesh, const std::string &texture, int room,
+						 glm::vec3 position, float rotation, glm::vec3 scale);
+	void addQuad(int room, glm::vec2 center, float minY, float maxY, float width,
+				 glm::vec2 normal, bool occluder);
+	void addWall(glm::vec2 start, glm::vec2 dir, int roomLeft, int roomRight, bool door);
+	void addPaintings(int room, glm::vec2 start, glm::vec2 dir, glm::vec2 inward);
+	void addStatues();
+};
+
+// Rotation around Y (degrees) that turns +Z into the given direction
+inline float facingDegrees(glm::vec2 normal) {
+	return glm::degrees(std::atan2(normal.x, normal.y));
+}
+
+inline MuseumGenerator::MuseumGenerator(Scene &scene, int rooms, int paintings, int statues)
+	: S(scene), roomCount(std::max(rooms, 1)), paintingsPerWall(std::max(paintings, 0)),
+	  statueCount(std::max(statues, 0)) {
+	columns = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(roomCount))));
+	rows = (roomCount + columns - 1) / columns;
+
+	int slots = paintingsPerWall + 1;
+	roomSize = std::max(MIN_ROOM_SIZE, slots * SLOT_WIDTH + 1.0f);
+	float firstSlot = (roomSize - slots * SLOT_WIDTH) / 2.0f;
+	doorAt = firstSlot + (paintingsPerWall / 2 + 0.5f) * SLOT_WIDTH;
+
+	// The entrance of room 1 ends up where the original museum had its door
+	origin = glm::vec2(4.0f, -1.0f - doorAt);
+}
+
+inline int MuseumGenerator::roomAtCell(int row, int column) const {
+	if (row < 0 || row >= rows || column < 0 || column >= columns) {
+		return 0;
+	}
+	int index = row * columns + column;
+	return index < roomCount ? index + 1 : 0;
+}
+
+// Rooms grow towards -X and +Z from the origin
+inline glm::vec2 MuseumGenerator::cellMin(int row, int column) const {
+	return glm::vec2(origin.x - (column + 1) * roomSize, origin.y + row * roomSize);
+}
+
+inline uint32_t MuseumGenerator::addInstance(const std::string &mesh, const std::string &texture,
+											 int room, glm::vec3 position, float rotation,
+											 glm::vec3 scale) {
+	SceneInstances &I = S.instances;
+	uint32_t i = static_cast<uint32_t>(I.size());
+	I.resize(i + 1);
+	I.mesh[i] = sceneIndexOf(S.meshNames, mesh, "mesh");
+	I.texture[i] = sceneIndexOf(S.textureNames, texture, "texture");
+	I.room[i] = room;
+	I.position[i] = position;
+	I.rotation[i] = rotation;
+	I.scale[i] = scale;
+	return i;
+}
+
+inline void MuseumGenerator::addQuad(int room, glm::vec2 center, float minY, float maxY,
+									 float width, glm::vec2 normal, bool occluder) {
+	uint32_t i = addInstance("frame", "walls", room,
+							 glm::vec3(center.x, (minY + maxY) / 2.0f, center.y),
+							 facingDegrees(normal),
+							 glm::vec3(width / QUAD_WIDTH, (maxY - minY) / QUAD_HEIGHT, 1.0f));
+	S.instances.occluder[i] = occluder ? 1 : 0;
+}
+
+// A wall from start, one room long in direction dir. Its two sides face the
+// rooms on the left and on the right of dir (0 is the outside). The
+// occlusion culling is two sided, so only one side is an occluder.
+inline void MuseumGenerator::addWall(glm::vec2 start, glm::vec2 dir, int roomLeft, int roomRight,
+									 bool door) {
+	glm::vec2 left(-dir.y, dir.x);
+	const float top = FLOOR_Y + WALL_HEIGHT;
+	auto segment = [&](float from, float to, float minY) {
+		glm::vec2 center = start + dir * ((from + to) / 2.0f);
+		addQuad(roomLeft, center, minY, top, to - from, left, true);
+		addQuad(roomRight, center, minY, top, to - from, -left, false);
+	};
+
+	if (!door) {
+		segment(0.0f, roomSize, FLOOR_Y);
+		return;
+	}
+	float doorFrom = doorAt - DOOR_WIDTH / 2.0f, doorTo = doorAt + DOOR_WIDTH / 2.0f;
+	segment(0.0f, doorFrom, FLOOR_Y);
+	segment(doorTo, roomSize, FLOOR_Y);
+	segment(doorFrom, doorTo, FLOOR_Y + DOOR_HEIGHT);
+
+	SceneDoorway D;
+	D.rooms[0] = roomLeft;
+	D.rooms[1] = roomRight;
+	D.from = start + dir * doorFrom;
+	D.to = start + dir * doorTo;
+	D.minY = FLOOR_Y;
+	D.maxY = FLOOR_Y + DOOR_HEIGHT;
+	S.doorways.push_back(D);
+}
+
+// One painting per slot of the wall, except the door slot, with its card
+inline void MuseumGenerator::addPaintings(int room, glm::vec2 start, glm::vec2 dir,
+										  glm::vec2 inward) {
+	static const char *paintings[] = {
+		"ART", "manet", "matisse", "monet", "munch", "picasso",
+		"pisarro", "seurat", "vgstar", "vgself", "cezanne", "volpedo"
+	};
+	const int slots = paintingsPerWall + 1;
+	const float firstSlot = (roomSize - slots * SLOT_WIDTH) / 2.0f;
+	const float rotation = facingDegrees(inward);
+
+	for (int k = 0; k < slots; k++) {
+		if (k == paintingsPerWall / 2) {
+			continue;
+		}
+		glm::vec2 p = start + dir * (firstSlot + (k + 0.5f) * SLOT_WIDTH) + inward * WALL_GAP;
+		std::string name = paintings[paintingsPlaced++ % 12];
+		addInstance("frame", name, room, glm::vec3(p.x, PAINTING_Y, p.y), rotation,
+					glm::vec3(PAINTING_SCALE));
+		uint32_t card = addInstance("frame", name + "_card", room, glm::vec3(p.x, CARD_Y, p.y),
+									rotation, glm::vec3(CARD_SCALE));
+		S.instances.card[card] = 1;
+	}
+}
+
+// Statues go to the rooms in turn, on a small grid in the middle of each room
+inline void MuseumGenerator::addStatues() {
+	int perRoom = (statueCount + roomCount - 1) / roomCount;
+	int grid = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(std::max(perRoom, 1)))));
+	float cell = (roomSize - 1.2f) / grid;
+
+	for (int s = 0; s < statueCount; s++) {
+		int index = s % roomCount, k = s / roomCount;
+		glm::vec2 corner = cellMin(index / columns, index % columns);
+		glm::vec2 p = corner + glm::vec2(0.6f + (k % grid + 0.5f) * cell,
+										 0.6f + (k / grid + 0.5f) * cell);
+		uint32_t statue;
+		if (s % 2 == 0) {
+			statue = addInstance("amogus", "amogus", index + 1, glm::vec3(p.x, FLOOR_Y, p.y), 180.0f,
+								 glm::vec3(0.4f));
+		} else {
+			statue = addInstance("suzanne", "suzanne", index + 1, glm::vec3(p.x, 0.3f, p.y), 180.0f,
+								 glm::vec3(0.3f));
+		}
+		S.instances.statue[statue] = 1;
+	}
+}
+
+inline void MuseumGenerator::generate() {
+	S = Scene();
+	S.meshNames = { "frame", "floor", "amogus", "suzanne" };
+	S.meshFiles = { "models/Rectangle.obj", "models/Floor.obj", "models/Amogus.obj",
+					"models/Suzanne.obj" };
+	S.textureNames = {
+		"walls", "floor", "amogus", "suzanne",
+		"ART", "ART_card", "manet", "manet_card", "matisse", "matisse_card",
+		"monet", "monet_card", "munch", "munch_card", "picasso", "picasso_card",
+		"pisarro", "pisarro_card", "seurat", "seurat_card", "vgstar", "vgstar_card",
+		"vgself", "vgself_card", "cezanne", "cezanne_card", "volpedo", "volpedo_card"
+	};
+	S.textureFiles = {
+		"textures/wall.png", "textures/parquet.png", "textures/marble.png",
+		"textures/Suzanne_texture.png",
+		"textures/ART.png", "textures/ART_card.png",
+		"textures/Manet_Dejeuner.png", "textures/Manet_Dejeuner_card.png",
+		"textures/Matisse_theDance.png", "textures/Matisse_theDance_card.png",
+		"textures/Monet-Sunrise.png", "textures/Monet-Sunrise_card.png",
+		"textures/Munch_Scream.png", "textures/Munch_Scream_card.png",
+		"textures/Picasso_Guernica.png", "textures/Picasso_Guernica_card.png",
+		"textures/pisarro_boulevard_monmarte.png", "textures/pisarro_boulevard_monmarte_card.png",
+		"textures/Seurat_a_sunday.png", "textures/Seurat_a_sunday_card.png",
+		"textures/starringNight.png", "textures/starringNight_card.png",
+		"textures/VanGogh_self.png", "textures/VanGogh_self_card.png",
+		"textures/theBathers_Cezanne.png", "textures/theBathers_Cezanne_card.png",
+		"textures/Volpedo_FourthEstate.png", "textures/Volpedo_FourthEstate_card.png"
+	};
+
+	for (int r = 0; r < roomCount; r++) {
+		glm::vec2 min = cellMin(r / columns, r % columns);
+		S.rooms.push_back({ min, min + glm::vec2(roomSize) });
+	}
+
+	// Walls along Z (between columns), then along X (between rows). Room 1
+	// also gets a door in its +X wall, the entrance.
+	for (int row = 0; row < rows; row++) {
+		for (int c = 0; c <= columns; c++) {
+			int west = roomAtCell(row, c), east = roomAtCell(row, c - 1);
+			if (!west && !east) {
+				continue;
+			}
+			glm::vec2 start(origin.x - c * roomSize, origin.y + row * roomSize);
+			bool door = (west && east) || (row == 0 && c == 0);
+			addWall(start, glm::vec2(0.0f, 1.0f), west, east, door);
+		}
+	}
+	for (int c = 0; c < columns; c++) {
+		for (int row = 0; row <= rows; row++) {
+			int south = roomAtCell(row - 1, c), north = roomAtCell(row, c);
+			if (!south && !north) {
+				continue;
+			}
+			glm::vec2 start(origin.x - (c + 1) * roomSize, origin.y + row * roomSize);
+			addWall(start, glm::vec2(1.0f, 0.0f), north, south, south && north);
+		}
+	}
+
+	// Floor and paintings of every room
+	for (int r = 0; r < roomCount; r++) {
+		glm::vec2 min = S.rooms[r].min, max = S.rooms[r].max;
+		glm::vec2 center = (min + max) / 2.0f;
+		glm::vec3 scale(roomSize / FLOOR_WIDTH, 1.0f, roomSize / FLOOR_DEPTH);
+		addInstance("floor", "floor", r + 1,
+					glm::vec3(center.x - FLOOR_CENTER_X * scale.x, 0.0f, center.y), 0.0f, scale);
+
+		addPaintings(r + 1, glm::vec2(min.x, min.y), glm::vec2(0.0f, 1.0f), glm::vec2(1.0f, 0.0f));
+		addPaintings(r + 1, glm::vec2(max.x, min.y), glm::vec2(0.0f, 1.0f), glm::vec2(-1.0f, 0.0f));
+		addPaintings(r + 1, glm::vec2(min.x, min.y), glm::vec2(1.0f, 0.0f), glm::vec2(0.0f, 1.0f));
+		addPaintings(r + 1, glm::vec2(min.x, max.y), glm::vec2(1.0f, 0.0f), glm::vec2(0.0f, -1.0f));
+	}
+
+	addStatues();
+	S.sortInstances();
+}
+
+// Fills scene with a generated museum
+inline void generateMuseum(Scene &scene, int rooms, int paintingsPerWall, int statues) {
+	MuseumGenerator generator(scene, rooms, paintingsPerWall, statues);
+	generator.generate();
+}
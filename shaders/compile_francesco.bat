@@ -1,4 +1,9 @@
 C:/VulkanSDK/1.3.204.1/Bin/glslc.exe shader.vert -o vert.spv
 C:/VulkanSDK/1.3.204.1/Bin/glslc.exe shader.frag -o frag.spv
+C:/VulkanSDK/1.3.204.1/Bin/glslc.exe shader_compact.vert -o compact_vert.spv
+C:/VulkanSDK/1.3.204.1/Bin/glslc.exe impostor.vert -o impostor_vert.spv
+C:/VulkanSDK/1.3.204.1/Bin/glslc.exe impostor.frag -o impostor_frag.spv
+C:/VulkanSDK/1.3.204.1/Bin/glslc.exe shader_indirect.vert -o indirect_vert.spv
+C:/VulkanSDK/1.3.204.1/Bin/glslc.exe cull.comp -o cull_comp.spv
 
 pause
\ No newline at end of file
@@ -0,0 +1,46 @@
+#version 450
+
+// Lit like shader.frag, with the albedo and the model space normal of the
+// view stored in the atlases
+
+layout(set = 1, binding = 1) uniform sampler2D albedoAtlas;
+layout(set = 1, binding = 2) uniform sampler2D normalAtlas;
+
+layout(location = 0) in vec3 fragViewDir;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in float fragFade;
+layout(location = 3) flat in mat3 fragModel;
+
+layout(location = 0) out vec4 outColor;
+
+// Same as shader.frag
+float dither() {
+	const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+									  3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+}
+
+void main() {
+	vec4 albedo = texture(albedoAtlas, fragTexCoord);
+
+	// Outside of the statue, or where its mesh is still drawn
+	if (albedo.a < 0.5f || dither() >= fragFade) {
+		discard;
+	}
+
+	const vec3  diffColor = albedo.rgb;
+	const vec3  specColor = vec3(1.0f, 1.0f, 1.0f);
+	const float specPower = 150.0f;
+	const vec3  L = vec3(-0.4830f, 0.8365f, -0.2588f);
+
+	vec3 N = normalize(fragModel * (texture(normalAtlas, fragTexCoord).xyz * 2.0f - 1.0f));
+	vec3 R = -reflect(L, N);
+	vec3 V = normalize(fragViewDir);
+
+	vec3 diffuse  = diffColor * max(dot(N,L), 0.0f);
+	vec3 specular = specColor * pow(max(dot(R,V), 0.0f), specPower);
+	vec3 ambient  = (vec3(0.1f,0.1f, 0.1f) * (1.0f + N.y) + vec3(0.0f,0.0f, 0.1f) * (1.0f - N.y)) * diffColor;
+
+	outColor = vec4(clamp(ambient + diffuse + specular, vec3(0.0f), vec3(1.0f)), 1.0f);
+}
@@ -0,0 +1,46 @@
+#version 450
+
+// Impostor of a statue (see impostors.hpp): a quad with no vertex buffer,
+// turned around the vertical axis to face the camera and textured with
+// the view of the atlas chosen by the application
+
+layout(set = 0, binding = 0) uniform globalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} gubo;
+
+layout(set = 1, binding = 0) uniform UniformBufferObjet {
+	mat4 model;
+	float fade;
+} ubo;
+
+layout(push_constant) uniform ImpostorDraw {
+	vec4 frame;		// model space center and half size of the views
+	vec4 cell;		// u, v, width, height of the view in the atlas
+} impostor;
+
+layout(location = 0) out vec3 fragViewDir;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out float fragFade;
+layout(location = 3) flat out mat3 fragModel;
+
+const vec2 corners[6] = vec2[6](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+								vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+	vec2 corner = corners[gl_VertexIndex];
+	vec3 center = (ubo.model * vec4(impostor.frame.xyz, 1.0)).xyz;
+	vec3 eye = -transpose(mat3(gubo.view)) * gubo.view[3].xyz;
+
+	vec3 toEye = vec3(eye.x - center.x, 0.0, eye.z - center.z);
+	vec3 d = dot(toEye, toEye) > 0.0 ? normalize(toEye) : vec3(0.0, 0.0, 1.0);
+	vec3 right = vec3(d.z, 0.0, -d.x);
+	vec2 size = impostor.frame.w * vec2(length(ubo.model[0].xyz), length(ubo.model[1].xyz));
+	vec3 pos = center + right * corner.x * size.x + vec3(0.0, corner.y * size.y, 0.0);
+
+	gl_Position  = gubo.proj * gubo.view * vec4(pos, 1.0);
+	fragViewDir  = eye - pos;
+	fragTexCoord = impostor.cell.xy + vec2(0.5 + corner.x * 0.5, 0.5 - corner.y * 0.5) * impostor.cell.zw;
+	fragFade     = ubo.fade;
+	fragModel    = mat3(ubo.model);
+}
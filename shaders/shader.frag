@@ -5,10 +5,24 @@ layout(set = 1, binding = 1) uniform sampler2D texSampler;
 layout(location = 0) in vec3 fragViewDir;
 layout(location = 1) in vec3 fragNorm;
 layout(location = 2) in vec2 fragTexCoord;
+layout(location = 3) flat in float fragFade;
 
 layout(location = 0) out vec4 outColor;
 
+// 4x4 ordered dither threshold of the pixel, in (0, 1)
+float dither() {
+	const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+									  3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+}
+
 void main() {
+	// Statues fading into their impostor leave it the other pixels (impostor.frag)
+	if (dither() < fragFade) {
+		discard;
+	}
+
 	const vec3  diffColor = texture(texSampler, fragTexCoord).rgb;
 	const vec3  specColor = vec3(1.0f, 1.0f, 1.0f);
 	const float specPower = 150.0f;
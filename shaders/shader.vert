@@ -7,6 +7,7 @@ layout(set = 0, binding = 0) uniform globalUniformBufferObject {
 
 layout(set = 1, binding = 0) uniform UniformBufferObjet {
 	mat4 model;
+	float fade;
 } ubo;
 
 layout(location = 0) in vec3 pos;
@@ -16,10 +17,12 @@ layout(location = 2) in vec2 texCoord;
 layout(location = 0) out vec3 fragViewDir;
 layout(location = 1) out vec3 fragNorm;
 layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) flat out float fragFade;
 
 void main() {
 	gl_Position = gubo.proj * gubo.view * ubo.model * vec4(pos, 1.0);
 	fragViewDir  = (gubo.view[3]).xyz - (ubo.model * vec4(pos,  1.0)).xyz;
 	fragNorm     = (ubo.model * vec4(norm, 0.0)).xyz;
 	fragTexCoord = texCoord;
+	fragFade     = ubo.fade;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#version 450
+
+// Same as shader.vert, for the compact vertex format (CompactVertex):
+// positions quantized inside the bounds of the mesh, octahedral normals
+// and half float texture coordinates
+
+layout(set = 0, binding = 0) uniform globalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} gubo;
+
+layout(set = 1, binding = 0) uniform UniformBufferObjet {
+	mat4 model;
+	float fade;
+} ubo;
+
+layout(push_constant) uniform CompactVertexDecode {
+	vec4 scale;
+	vec4 offset;
+} decode;
+
+layout(location = 0) in vec4 quantizedPos;
+layout(location = 1) in vec2 octNorm;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec3 fragViewDir;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) flat out float fragFade;
+
+vec3 octahedralDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+	return normalize(n);
+}
+
+void main() {
+	vec3 pos  = decode.offset.xyz + quantizedPos.xyz * decode.scale.xyz;
+	vec3 norm = octahedralDecode(octNorm);
+	gl_Position = gubo.proj * gubo.view * ubo.model * vec4(pos, 1.0);
+	fragViewDir  = (gubo.view[3]).xyz - (ubo.model * vec4(pos,  1.0)).xyz;
+	fragNorm     = (ubo.model * vec4(norm, 0.0)).xyz;
+	fragTexCoord = texCoord;
+	fragFade     = ubo.fade;
+}
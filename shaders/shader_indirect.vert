@@ -0,0 +1,39 @@
+#version 450
+
+// Vertex shader of the GPU driven draws (--gpu-culling): the culling sets
+// firstInstance to the index of the instance, so its world matrix is read
+// from the instances buffer instead of a uniform
+
+layout(set = 0, binding = 0) uniform globalUniformBufferObject {
+	mat4 view;
+	mat4 proj;
+} gubo;
+
+struct Instance {
+	mat4 model;
+	vec4 center;
+	vec4 extent;
+	uint group;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Instances {
+	Instance instances[];
+};
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 norm;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec3 fragViewDir;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 fragTexCoord;
+layout(location = 3) flat out float fragFade;
+
+void main() {
+	mat4 model = instances[gl_InstanceIndex].model;
+	gl_Position = gubo.proj * gubo.view * model * vec4(pos, 1.0);
+	fragViewDir  = (gubo.view[3]).xyz - (model * vec4(pos,  1.0)).xyz;
+	fragNorm     = (model * vec4(norm, 0.0)).xyz;
+	fragTexCoord = texCoord;
+	fragFade     = 0.0;
+}
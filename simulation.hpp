@@ -0,0 +1,87 @@
+#pragma once
+
+// Fixed timestep simulation on its own thread ("Fix Your Timestep!",
+// G. Fiedler): the state advances in ticks of constant length whatever the
+// frame rate, and every tick is published through a triple buffer. The
+// render thread takes the latest state without ever waiting for the
+// simulation, and interpolates between its last two ticks.
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+// Ticks late by more than this many are dropped instead of run back to
+// back (e.g. after the process was suspended)
+const int SIMULATION_MAX_CATCH_UP = 8;
+
+// Lock free, for one writer and one reader thread. The writer fills its
+// own slot and swaps it with the middle one; the reader swaps its slot
+// with the middle one when a newer state is there. Neither blocks, and the
+// reader always sees a complete state. The slot given back to the writer
+// holds an older state, so every publish() must write a whole state.
+template <typename T>
+struct TripleBuffer {
+	static const uint32_t FRESH = 4;
+
+	T slots[3];
+	std::atomic<uint32_t> middle{1};
+	uint32_t back = 0, front = 2;
+
+	// Writer side
+	T &writeSlot() { return slots[back]; }
+	void publish() {
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+	}
+
+	// Reader side: true if a newer state has been published since the last call
+	bool update() {
+		if (!(middle.load(std::memory_order_acquire) & FRESH)) {
+			return false;
+		}
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+		return true;
+	}
+	const T &readSlot() const { return slots[front]; }
+};
+
+struct FixedStepThread {
+	using Clock = std::chrono::steady_clock;
+
+	std::thread worker;
+	std::atomic<bool> quit{false};
+
+	~FixedStepThread() { stop(); }
+
+	// Calls step(time) tickRate times per second on a new thread, time
+	// being when the tick was due: late ticks keep their own time, so
+	// the simulation stays uniform even when the OS wakes the thread late
+	void start(double tickRate, std::function<void(Clock::time_point)> step);
+	void stop();
+};
+
+inline void FixedStepThread::start(double tickRate, std::function<void(Clock::time_point)> step) {
+	quit = false;
+	worker = std::thread([this, tickRate, step] {
+		const Clock::duration tick = std::chrono::duration_cast<Clock::duration>(
+				std::chrono::duration<double>(1.0 / tickRate));
+		Clock::time_point next = Clock::now();
+		while (!quit.load(std::memory_order_relaxed)) {
+			step(next);
+			next += tick;
+			Clock::time_point now = Clock::now();
+			if (now - next > tick * SIMULATION_MAX_CATCH_UP) {
+				next = now;
+			}
+			std::this_thread::sleep_until(next);
+		}
+	});
+}
+
+inline void FixedStepThread::stop() {
+	quit = true;
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+// Room streaming: only the textures of the room the visitor is in, of the
+// rooms next to it and of the building itself are kept on the GPU.
+// Images are decoded by a background thread (AssetLoader) while the
+// visitor walks towards them, the upload to the GPU is left to the
+// caller and runs in the background as well. Textures that are no
+// longer needed stop being drawn at once and are destroyed once the
+// frames that could still use them are complete on the GPU.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <string>
+
+// stb_image.h is included, with its implementation, by museum_project.hpp
+#include "scene.hpp"
+
+struct DecodedImage {
+	uint32_t id = 0;
+	int width = 0, height = 0;
+	stbi_uc *pixels = nullptr;		// RGBA, nullptr if the file could not be read
+	std::string file;
+};
+
+// Decodes image files on a background thread, in the order they are requested
+struct AssetLoader {
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::deque<DecodedImage> requests;
+	std::vector<DecodedImage> decoded;
+	bool quit = false;
+
+	~AssetLoader() { cleanup(); }
+
+	void init();
+	void request(uint32_t id, const std::string &file);
+	// Takes one of the decoded images, the caller frees its pixels
+	bool poll(DecodedImage &image);
+	void cleanup();
+
+	void workerLoop();
+};
+
+inline void AssetLoader::init() {
+	quit = false;
+	worker = std::thread(&AssetLoader::workerLoop, this);
+}
+
+inline void AssetLoader::request(uint32_t id, const std::string &file) {
+	DecodedImage R;
+	R.id = id;
+	R.file = file;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(std::move(R));
+	}
+	wakeUp.notify_one();
+}
+
+inline bool AssetLoader::poll(DecodedImage &image) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (decoded.empty()) {
+		return false;
+	}
+	image = std::move(decoded.front());
+	decoded.erase(decoded.begin());
+	return true;
+}
+
+inline void AssetLoader::workerLoop() {
+	for (;;) {
+		DecodedImage R;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [&] { return quit || !requests.empty(); });
+			if (quit) {
+				return;
+			}
+			R = std::move(requests.front());
+			requests.pop_front();
+		}
+
+		int channels;
+		R.pixels = stbi_load(R.file.c_str(), &R.width, &R.height, &channels, STBI_rgb_alpha);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.push_back(std::move(R));
+	}
+}
+
+inline void AssetLoader::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeUp.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+	for (DecodedImage &D : decoded) {
+		stbi_image_free(D.pixels);
+	}
+	decoded.clear();
+	requests.clear();
+}
+
+
+// Which textures should be resident, given the room of the visitor
+enum TextureResidency : uint8_t {
+	TEXTURE_UNLOADED,
+	TEXTURE_LOADING,		// requested to the loader
+	TEXTURE_UPLOADING,		// decoded, being copied to the GPU
+	TEXTURE_RESIDENT,
+	TEXTURE_RELEASING		// not drawn anymore, destroyed when the GPU is done with it
+};
+
+struct RoomStreamer {
+	std::vector<std::vector<int>> neighbours;			// per room, through the doorways
+	std::vector<std::vector<uint32_t>> roomTextures;	// per room, without repetitions
+	std::vector<uint8_t> state;						// per texture
+	std::vector<uint8_t> wanted;
+	std::vector<uint64_t> releaseFrame;
+	int currentRoom = -1;
+
+	void init(const Scene &S);
+	// Moves the visitor to room: appends to load the textures to be requested,
+	// the ones not needed anymore start to be released
+	void setRoom(int room, uint64_t frame, std::vector<uint32_t> &load);
+	// Called when the image of texture t has been decoded: true if it
+	// must be uploaded, false if it is not wanted anymore
+	bool loaded(uint32_t t);
+	// Called when the upload of texture t is done: true if it can be
+	// drawn, false if it is not wanted anymore and starts to be released
+	// (the GPU may use it up to frame - 1)
+	bool uploaded(uint32_t t, uint64_t frame);
+	// Appends to destroy the released textures whose frames are among the
+	// completed ones: released at frame n, a texture is last drawn by frame n - 1
+	void collect(uint64_t completedFrames, std::vector<uint32_t> &destroy);
+
+	bool ready(uint32_t t) const { return state[t] == TEXTURE_RESIDENT; }
+	// True if texture t has its GPU objects
+	bool allocated(uint32_t t) const {
+		return state[t] == TEXTURE_UPLOADING || state[t] == TEXTURE_RESIDENT ||
+			   state[t] == TEXTURE_RELEASING;
+	}
+	uint32_t residentCount() const;
+	// True if no texture is being loaded, uploaded or released
+	bool settled() const;
+};
+
+inline void RoomStreamer::init(const Scene &S) {
+	const int rooms = S.roomCount();
+	const size_t textureCount = S.textureNames.size();
+	neighbours.assign(rooms, {});
+	for (const SceneDoorway &D : S.doorways) {
+		neighbours[D.rooms[0]].push_back(D.rooms[1]);
+		neighbours[D.rooms[1]].push_back(D.rooms[0]);
+	}
+
+	std::vector<int> lastRoom(textureCount, -1);
+	roomTextures.assign(rooms, {});
+	for (int r = 0; r < rooms; r++) {
+		for (uint32_t i = S.roomFirst[r]; i < S.roomFirst[r + 1]; i++) {
+			uint32_t t = S.instances.texture[i];
+			if (lastRoom[t] != r) {
+				lastRoom[t] = r;
+				roomTextures[r].push_back(t);
+			}
+		}
+	}
+
+	state.assign(textureCount, TEXTURE_UNLOADED);
+	wanted.assign(textureCount, 0);
+	releaseFrame.assign(textureCount, 0);
+	currentRoom = -1;
+}
+
+inline void RoomStreamer::setRoom(int room, uint64_t frame, std::vector<uint32_t> &load) {
+	if (room == currentRoom) {
+		return;
+	}
+	currentRoom = room;
+
+	// The building (room 0) is always needed
+	std::fill(wanted.begin(), wanted.end(), 0);
+	auto want = [&](int r) {
+		for (uint32_t t : roomTextures[r]) {
+			wanted[t] = 1;
+		}
+	};
+	want(0);
+	want(room);
+	for (int n : neighbours[room]) {
+		want(n);
+	}
+
+	for (uint32_t t = 0; t < state.size(); t++) {
+		if (wanted[t]) {
+			if (state[t] == TEXTURE_UNLOADED) {
+				state[t] = TEXTURE_LOADING;
+				load.push_back(t);
+			} else if (state[t] == TEXTURE_RELEASING) {
+				state[t] = TEXTURE_RESIDENT;
+			}
+		} else if (state[t] == TEXTURE_RESIDENT) {
+			state[t] = TEXTURE_RELEASING;
+			releaseFrame[t] = frame;
+		}
+	}
+}
+
+inline bool RoomStreamer::loaded(uint32_t t) {
+	state[t] = wanted[t] ? TEXTURE_UPLOADING : TEXTURE_UNLOADED;
+	return wanted[t] != 0;
+}
+
+inline bool RoomStreamer::uploaded(uint32_t t, uint64_t frame) {
+	if (wanted[t]) {
+		state[t] = TEXTURE_RESIDENT;
+		return true;
+	}
+	state[t] = TEXTURE_RELEASING;
+	releaseFrame[t] = frame;
+	return false;
+}
+
+inline void RoomStreamer::collect(uint64_t completedFrames, std::vector<uint32_t> &destroy) {
+	for (uint32_t t = 0; t < state.size(); t++) {
+		if (state[t] == TEXTURE_RELEASING && releaseFrame[t] <= completedFrames) {
+			state[t] = TEXTURE_UNLOADED;
+			destroy.push_back(t);
+		}
+	}
+}
+
+inline bool RoomStreamer::settled() const {
+	for (uint8_t s : state) {
+		if (s == TEXTURE_LOADING || s == TEXTURE_UPLOADING || s == TEXTURE_RELEASING) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline uint32_t RoomStreamer::residentCount() const {
+	uint32_t count = 0;
+	for (uint32_t t = 0; t < state.size(); t++) {
+		count += allocated(t);
+	}
+	return count;
+}
@@ -0,0 +1,469 @@
+#pragma once
+
+// World transforms of the scene objects.
+// Position, rotation (around Y) and scale are kept as separate arrays, and
+// the world matrices are recomputed only for the objects that changed since
+// the last update(). Since every frame in flight has its own uniform
+// buffer, a changed matrix stays pending for each of them until it has been
+// uploaded there too: the per-frame cost follows what moves, not the size
+// of the scene.
+// The matrices are composed 8 (AVX) or 4 (SSE / NEON) at a time, and
+// multiplyMatrices() does the same for batches of products such as
+// viewProj * world. transformSelfCheck() compares both with glm
+// (see --check-transforms), transformBenchmark() times them
+// (see --bench-transforms).
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORMS_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORMS_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TRANSFORMS_NEON
+#endif
+
+// Index of the lowest set bit of a non zero word
+inline uint32_t lowestBit(uint64_t word) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return static_cast<uint32_t>(index);
+#else
+	return static_cast<uint32_t>(__builtin_ctzll(word));
+#endif
+}
+
+#if defined(TRANSFORMS_AVX) || defined(TRANSFORMS_SSE)
+// Writes column col of four matrices, whose components x, y, z, w are
+// given lane by lane (lane k goes to dst[k])
+inline void storeColumns(glm::mat4 *const dst[4], int col,
+						 __m128 x, __m128 y, __m128 z, __m128 w) {
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	_mm_storeu_ps(&(*dst[0])[col][0], x);
+	_mm_storeu_ps(&(*dst[1])[col][0], y);
+	_mm_storeu_ps(&(*dst[2])[col][0], z);
+	_mm_storeu_ps(&(*dst[3])[col][0], w);
+}
+#elif defined(TRANSFORMS_NEON)
+inline void storeColumns(glm::mat4 *const dst[4], int col,
+						 float32x4_t x, float32x4_t y, float32x4_t z, float32x4_t w) {
+	float32x4x2_t xy = vtrnq_f32(x, y), zw = vtrnq_f32(z, w);
+	vst1q_f32(&(*dst[0])[col][0], vcombine_f32(vget_low_f32(xy.val[0]), vget_low_f32(zw.val[0])));
+	vst1q_f32(&(*dst[1])[col][0], vcombine_f32(vget_low_f32(xy.val[1]), vget_low_f32(zw.val[1])));
+	vst1q_f32(&(*dst[2])[col][0], vcombine_f32(vget_high_f32(xy.val[0]), vget_high_f32(zw.val[0])));
+	vst1q_f32(&(*dst[3])[col][0], vcombine_f32(vget_high_f32(xy.val[1]), vget_high_f32(zw.val[1])));
+}
+#endif
+
+struct TransformStore {
+	std::vector<float> px, py, pz;		// position
+	std::vector<float> rotation;		// radians around Y
+	std::vector<float> cosY, sinY;		// of the rotation, computed by set()
+	std::vector<float> sx, sy, sz;		// scale
+	std::vector<glm::mat4> world;
+
+	// One bit per transform: changed since the last update()
+	std::vector<uint64_t> dirty;
+	// One bitset per frame in flight: updated, but not uploaded there yet
+	std::vector<std::vector<uint64_t>> pending;
+
+	// Scalar composition, used as reference
+	bool useSimd = true;
+
+	void resize(uint32_t count, uint32_t frames);
+	uint32_t size() const { return static_cast<uint32_t>(px.size()); }
+
+	void set(uint32_t i, const glm::vec3 &position, float degrees, const glm::vec3 &scale);
+	void setPosition(uint32_t i, const glm::vec3 &position);
+	glm::vec3 position(uint32_t i) const { return glm::vec3(px[i], py[i], pz[i]); }
+
+	void markDirty(uint32_t i) { dirty[i >> 6] |= uint64_t(1) << (i & 63); }
+
+	// Recomputes the world matrices of the dirty transforms, appends their
+	// indices to changed and marks them pending for all the frames in flight
+	uint32_t update(std::vector<uint32_t> &changed);
+
+	// world[i] = T * R(Y) * S for the listed transforms
+	void compose(const uint32_t *indices, uint32_t count);
+	void composeScalar(uint32_t i);
+
+	// Calls upload(i) for every transform pending for the frame, then
+	// clears them. Returns how many they were.
+	template <class F>
+	uint32_t flush(uint32_t frame, F upload);
+};
+
+inline void TransformStore::resize(uint32_t count, uint32_t frames) {
+	px.resize(count); py.resize(count); pz.resize(count);
+	rotation.resize(count); cosY.resize(count, 1.0f); sinY.resize(count);
+	sx.resize(count, 1.0f); sy.resize(count, 1.0f); sz.resize(count, 1.0f);
+	world.resize(count, glm::mat4(1.0f));
+
+	// Everything has to be computed and uploaded at least once
+	uint32_t words = (count + 63) / 64;
+	dirty.assign(words, ~uint64_t(0));
+	if (count % 64) {
+		dirty.back() = (uint64_t(1) << (count % 64)) - 1;
+	}
+	pending.assign(frames, std::vector<uint64_t>(words, 0));
+}
+
+inline void TransformStore::set(uint32_t i, const glm::vec3 &position, float degrees,
+								const glm::vec3 &scale) {
+	px[i] = position.x; py[i] = position.y; pz[i] = position.z;
+	rotation[i] = glm::radians(degrees);
+	cosY[i] = std::cos(rotation[i]); sinY[i] = std::sin(rotation[i]);
+	sx[i] = scale.x; sy[i] = scale.y; sz[i] = scale.z;
+	markDirty(i);
+}
+
+inline void TransformStore::setPosition(uint32_t i, const glm::vec3 &position) {
+	px[i] = position.x; py[i] = position.y; pz[i] = position.z;
+	markDirty(i);
+}
+
+inline uint32_t TransformStore::update(std::vector<uint32_t> &changed) {
+	size_t first = changed.size();
+	for (size_t w = 0; w < dirty.size(); w++) {
+		uint64_t bits = dirty[w];
+		if (!bits) {
+			continue;
+		}
+		for (std::vector<uint64_t> &p : pending) {
+			p[w] |= bits;
+		}
+		dirty[w] = 0;
+
+		while (bits) {
+			changed.push_back(static_cast<uint32_t>(w * 64) + lowestBit(bits));
+			bits &= bits - 1;
+		}
+	}
+
+	uint32_t count = static_cast<uint32_t>(changed.size() - first);
+	compose(changed.data() + first, count);
+	return count;
+}
+
+inline void TransformStore::composeScalar(uint32_t i) {
+	glm::mat4 &M = world[i];
+	M[0] = glm::vec4(cosY[i] * sx[i], 0.0f, -sinY[i] * sx[i], 0.0f);
+	M[1] = glm::vec4(0.0f, sy[i], 0.0f, 0.0f);
+	M[2] = glm::vec4(sinY[i] * sz[i], 0.0f, cosY[i] * sz[i], 0.0f);
+	M[3] = glm::vec4(px[i], py[i], pz[i], 1.0f);
+}
+
+inline void TransformStore::compose(const uint32_t *indices, uint32_t count) {
+	uint32_t k = 0;
+
+#if defined(TRANSFORMS_AVX)
+	if (useSimd) {
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		for (; k + 8 <= count; k += 8) {
+			const uint32_t *n = indices + k;
+			auto gather = [n](const std::vector<float> &v) {
+				return _mm256_setr_ps(v[n[0]], v[n[1]], v[n[2]], v[n[3]],
+									  v[n[4]], v[n[5]], v[n[6]], v[n[7]]);
+			};
+			__m256 c = gather(cosY), s = gather(sinY);
+			__m256 sX = gather(sx), sZ = gather(sz);
+			__m256 m00 = _mm256_mul_ps(c, sX);
+			__m256 m02 = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(s, sX));
+			__m256 m20 = _mm256_mul_ps(s, sZ), m22 = _mm256_mul_ps(c, sZ);
+			__m256 m11 = gather(sy);
+			__m256 tx = gather(px), ty = gather(py), tz = gather(pz);
+
+			for (int half = 0; half < 2; half++) {
+				glm::mat4 *dst[4] = { &world[n[4 * half]], &world[n[4 * half + 1]],
+									  &world[n[4 * half + 2]], &world[n[4 * half + 3]] };
+				auto lanes = [half](__m256 v) {
+					return half ? _mm256_extractf128_ps(v, 1) : _mm256_castps256_ps128(v);
+				};
+				storeColumns(dst, 0, lanes(m00), zero, lanes(m02), zero);
+				storeColumns(dst, 1, zero, lanes(m11), zero, zero);
+				storeColumns(dst, 2, lanes(m20), zero, lanes(m22), zero);
+				storeColumns(dst, 3, lanes(tx), lanes(ty), lanes(tz), one);
+			}
+		}
+	}
+#elif defined(TRANSFORMS_SSE)
+	if (useSimd) {
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		for (; k + 4 <= count; k += 4) {
+			const uint32_t *n = indices + k;
+			auto gather = [n](const std::vector<float> &v) {
+				return _mm_setr_ps(v[n[0]], v[n[1]], v[n[2]], v[n[3]]);
+			};
+			__m128 c = gather(cosY), s = gather(sinY);
+			__m128 sX = gather(sx), sZ = gather(sz);
+			glm::mat4 *dst[4] = { &world[n[0]], &world[n[1]], &world[n[2]], &world[n[3]] };
+			storeColumns(dst, 0, _mm_mul_ps(c, sX), zero,
+						 _mm_sub_ps(zero, _mm_mul_ps(s, sX)), zero);
+			storeColumns(dst, 1, zero, gather(sy), zero, zero);
+			storeColumns(dst, 2, _mm_mul_ps(s, sZ), zero, _mm_mul_ps(c, sZ), zero);
+			storeColumns(dst, 3, gather(px), gather(py), gather(pz), one);
+		}
+	}
+#elif defined(TRANSFORMS_NEON)
+	if (useSimd) {
+		const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+		for (; k + 4 <= count; k += 4) {
+			const uint32_t *n = indices + k;
+			auto gather = [n](const std::vector<float> &v) {
+				float lanes[4] = { v[n[0]], v[n[1]], v[n[2]], v[n[3]] };
+				return vld1q_f32(lanes);
+			};
+			float32x4_t c = gather(cosY), s = gather(sinY);
+			float32x4_t sX = gather(sx), sZ = gather(sz);
+			glm::mat4 *dst[4] = { &world[n[0]], &world[n[1]], &world[n[2]], &world[n[3]] };
+			storeColumns(dst, 0, vmulq_f32(c, sX), zero, vnegq_f32(vmulq_f32(s, sX)), zero);
+			storeColumns(dst, 1, zero, gather(sy), zero, zero);
+			storeColumns(dst, 2, vmulq_f32(s, sZ), zero, vmulq_f32(c, sZ), zero);
+			storeColumns(dst, 3, gather(px), gather(py), gather(pz), one);
+		}
+	}
+#endif
+
+	for (; k < count; k++) {
+		composeScalar(indices[k]);
+	}
+}
+
+template <class F>
+inline uint32_t TransformStore::flush(uint32_t frame, F upload) {
+	uint32_t count = 0;
+	std::vector<uint64_t> &bitset = pending[frame];
+	for (size_t w = 0; w < bitset.size(); w++) {
+		uint64_t bits = bitset[w];
+		bitset[w] = 0;
+		while (bits) {
+			upload(static_cast<uint32_t>(w * 64) + lowestBit(bits));
+			bits &= bits - 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+// out[i] = A * B[i] for count matrices (out may alias B)
+inline void multiplyMatrices(const glm::mat4 &A, const glm::mat4 *B, glm::mat4 *out,
+							 uint32_t count, bool useSimd = true) {
+	uint32_t i = 0;
+
+#if defined(TRANSFORMS_AVX)
+	if (useSimd) {
+		// Two columns of the result per register
+		const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&A[0][0]));
+		const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&A[1][0]));
+		const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&A[2][0]));
+		const __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&A[3][0]));
+		for (; i < count; i++) {
+			for (int col = 0; col < 4; col += 2) {
+				__m256 b = _mm256_loadu_ps(&B[i][col][0]);
+				__m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(b, 0x00));
+#if defined(__FMA__)
+				r = _mm256_fmadd_ps(a1, _mm256_permute_ps(b, 0x55), r);
+				r = _mm256_fmadd_ps(a2, _mm256_permute_ps(b, 0xAA), r);
+				r = _mm256_fmadd_ps(a3, _mm256_permute_ps(b, 0xFF), r);
+#else
+				r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(b, 0x55)));
+				r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(b, 0xAA)));
+				r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(b, 0xFF)));
+#endif
+				_mm256_storeu_ps(&out[i][col][0], r);
+			}
+		}
+	}
+#elif defined(TRANSFORMS_SSE)
+	if (useSimd) {
+		const __m128 a0 = _mm_loadu_ps(&A[0][0]), a1 = _mm_loadu_ps(&A[1][0]);
+		const __m128 a2 = _mm_loadu_ps(&A[2][0]), a3 = _mm_loadu_ps(&A[3][0]);
+		for (; i < count; i++) {
+			__m128 b[4] = { _mm_loadu_ps(&B[i][0][0]), _mm_loadu_ps(&B[i][1][0]),
+							_mm_loadu_ps(&B[i][2][0]), _mm_loadu_ps(&B[i][3][0]) };
+			for (int col = 0; col < 4; col++) {
+				__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(b[col], b[col], 0x00));
+				r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(b[col], b[col], 0x55)));
+				r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(b[col], b[col], 0xAA)));
+				r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(b[col], b[col], 0xFF)));
+				_mm_storeu_ps(&out[i][col][0], r);
+			}
+		}
+	}
+#elif defined(TRANSFORMS_NEON)
+	if (useSimd) {
+		const float32x4_t a0 = vld1q_f32(&A[0][0]), a1 = vld1q_f32(&A[1][0]);
+		const float32x4_t a2 = vld1q_f32(&A[2][0]), a3 = vld1q_f32(&A[3][0]);
+		for (; i < count; i++) {
+			float b[16];
+			std::copy(&B[i][0][0], &B[i][0][0] + 16, b);
+			for (int col = 0; col < 4; col++) {
+				float32x4_t r = vmulq_n_f32(a0, b[4 * col]);
+				r = vmlaq_n_f32(r, a1, b[4 * col + 1]);
+				r = vmlaq_n_f32(r, a2, b[4 * col + 2]);
+				r = vmlaq_n_f32(r, a3, b[4 * col + 3]);
+				vst1q_f32(&out[i][col][0], r);
+			}
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		out[i] = A * B[i];
+	}
+}
+
+inline float maxMatrixError(const glm::mat4 &a, const glm::mat4 &b) {
+	float error = 0.0f;
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 4; r++) {
+			error = std::max(error, std::abs(a[c][r] - b[c][r]));
+		}
+	}
+	return error;
+}
+
+// Random transforms composed with the SIMD kernel, the scalar one and
+// glm::translate / rotate / scale, then multiplied by a view-projection
+inline bool transformSelfCheck() {
+	const uint32_t objects = 1003;		// not a multiple of the SIMD width
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> pos(-50.0f, 50.0f), angle(-360.0f, 360.0f);
+	std::uniform_real_distribution<float> size(0.05f, 3.0f);
+
+	TransformStore simd, scalar;
+	scalar.useSimd = false;
+	simd.resize(objects, 1);
+	scalar.resize(objects, 1);
+	std::vector<glm::mat4> reference(objects);
+	for (uint32_t i = 0; i < objects; i++) {
+		glm::vec3 p(pos(rng), pos(rng), pos(rng)), s(size(rng), size(rng), size(rng));
+		float a = angle(rng);
+		simd.set(i, p, a, s);
+		scalar.set(i, p, a, s);
+		reference[i] = glm::translate(glm::mat4(1.0f), p) *
+			glm::rotate(glm::mat4(1.0f), glm::radians(a), glm::vec3(0, 1, 0)) *
+			glm::scale(glm::mat4(1.0f), s);
+	}
+
+	// First everything, then a scattered subset
+	std::vector<uint32_t> changed;
+	bool ok = simd.update(changed) == objects && scalar.update(changed) == objects;
+	for (uint32_t i = 0; i < objects; i += 1 + i % 5) {
+		glm::vec3 p(pos(rng), pos(rng), pos(rng));
+		simd.setPosition(i, p);
+		scalar.setPosition(i, p);
+		reference[i][3] = glm::vec4(p, 1.0f);
+	}
+	changed.clear();
+	simd.update(changed);
+	scalar.update(changed);
+
+	float composeError = 0.0f, simdError = 0.0f;
+	for (uint32_t i = 0; i < objects; i++) {
+		composeError = std::max(composeError, maxMatrixError(simd.world[i], reference[i]));
+		simdError = std::max(simdError, maxMatrixError(simd.world[i], scalar.world[i]));
+	}
+	std::printf("transforms: compose max error %g vs glm, %g vs scalar\n",
+				composeError, simdError);
+	ok = ok && composeError < 1e-4f && simdError == 0.0f;
+
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	proj[1][1] *= -1;
+	glm::mat4 viewProj = proj * glm::lookAt(glm::vec3(3.0f, 2.0f, 1.0f), glm::vec3(0.0f),
+											glm::vec3(0.0f, 1.0f, 0.0f));
+	std::vector<glm::mat4> product(objects);
+	multiplyMatrices(viewProj, simd.world.data(), product.data(), objects);
+	float productError = 0.0f;
+	for (uint32_t i = 0; i < objects; i++) {
+		glm::mat4 expected = viewProj * simd.world[i];
+		float scale = 1.0f + maxMatrixError(expected, glm::mat4(0.0f));
+		productError = std::max(productError, maxMatrixError(product[i], expected) / scale);
+	}
+	std::printf("transforms: viewProj * world max relative error %g\n", productError);
+	ok = ok && productError < 1e-5f;
+
+	std::printf("transforms: %s\n", ok ? "ok" : "FAILED");
+	return ok;
+}
+
+// Time per object of the composition and of the products, glm against
+// the batched kernels (best of a few runs)
+inline bool transformBenchmark(uint32_t objects) {
+	using Clock = std::chrono::high_resolution_clock;
+	auto best = [objects](auto run) {
+		double fastest = 1e30;
+		for (int r = 0; r < 5; r++) {
+			auto t0 = Clock::now();
+			run();
+			auto t1 = Clock::now();
+			fastest = std::min(fastest, std::chrono::duration<double, std::nano>(t1 - t0).count());
+		}
+		return fastest / objects;
+	};
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> pos(-100.0f, 100.0f), angle(0.0f, 360.0f);
+	TransformStore store;
+	store.resize(objects, 1);
+	for (uint32_t i = 0; i < objects; i++) {
+		store.set(i, glm::vec3(pos(rng), pos(rng), pos(rng)), angle(rng), glm::vec3(0.4f));
+	}
+	std::vector<uint32_t> all(objects);
+	for (uint32_t i = 0; i < objects; i++) {
+		all[i] = i;
+	}
+	std::vector<glm::mat4> out(objects);
+
+	double composeGlm = best([&]() {
+		for (uint32_t i = 0; i < objects; i++) {
+			out[i] = glm::translate(glm::mat4(1.0f), store.position(i)) *
+				glm::rotate(glm::mat4(1.0f), store.rotation[i], glm::vec3(0, 1, 0)) *
+				glm::scale(glm::mat4(1.0f), glm::vec3(store.sx[i], store.sy[i], store.sz[i]));
+		}
+	});
+	store.useSimd = false;
+	double composeScalar = best([&]() { store.compose(all.data(), objects); });
+	store.useSimd = true;
+	double composeSimd = best([&]() { store.compose(all.data(), objects); });
+	std::printf("transforms: %u objects, compose glm %.1f ns, scalar %.1f ns, simd %.1f ns\n",
+				objects, composeGlm, composeScalar, composeSimd);
+
+	float error = 0.0f;
+	for (uint32_t i = 0; i < objects; i++) {
+		error = std::max(error, maxMatrixError(out[i], store.world[i]));
+	}
+
+	glm::mat4 viewProj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	double productGlm = best([&]() {
+		for (uint32_t i = 0; i < objects; i++) {
+			out[i] = viewProj * store.world[i];
+		}
+	});
+	double productSimd = best([&]() {
+		multiplyMatrices(viewProj, store.world.data(), out.data(), objects);
+	});
+	std::printf("transforms: viewProj * world glm %.1f ns, simd %.1f ns\n",
+				productGlm, productSimd);
+
+	bool ok = error < 1e-3f;
+	std::printf("transforms: %s\n", ok ? "ok" : "MISMATCH");
+	return ok;
+}